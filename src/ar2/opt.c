@@ -25,8 +25,12 @@
 #include "blake2/blake2.h"
 #include "blake2/blamka-round-opt.h"
 
-void fill_block(__m128i *state, const block *ref_block, block *next_block,
-                int with_xor) {
+#if defined(ARGON2_AVX2)
+#include <cpuid.h>
+#endif
+
+void fill_block_sse2(__m128i *state, const block *ref_block, block *next_block,
+                     int with_xor) {
     __m128i block_XY[ARGON2_OWORDS_IN_BLOCK];
     unsigned int i;
 
@@ -62,6 +66,32 @@ void fill_block(__m128i *state, const block *ref_block, block *next_block,
     }
 }
 
+/* Set by argon2_select_impl() */
+static void (*fill_block)(__m128i *state, const block *ref_block,
+                          block *next_block, int with_xor) = fill_block_sse2;
+
+const char *argon2_select_impl(int use_avx2) {
+#if defined(ARGON2_AVX2)
+    unsigned int eax, ebx, ecx, edx;
+    if (use_avx2 && __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+        ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && /* OSXSAVE and AVX */
+        __get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if ((ebx >> 5) & 1) {
+            /* The OS must save the YMM registers too */
+            unsigned int xcr0_lo, xcr0_hi;
+            __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+            if ((xcr0_lo & 6) == 6) {
+                fill_block = fill_block_avx2;
+                return "avx2";
+            }
+        }
+    }
+#endif
+    fill_block = fill_block_sse2;
+    return "sse2";
+}
+
 static void next_addresses(block *address_block, block *input_block) {
     /*Temporary zero-initialized blocks*/
     __m128i zero_block[ARGON2_OWORDS_IN_BLOCK];
@@ -30,6 +30,12 @@
  * @param with_xor Whether to XOR into the new block (1) or just overwrite (0)
  * @pre all block pointers must be valid
  */
-void fill_block(__m128i *s, const block *ref_block, block *next_block, int with_xor);
+void fill_block_sse2(__m128i *s, const block *ref_block, block *next_block, int with_xor);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define ARGON2_AVX2
+/* The same on 256-bit registers, see opt_avx2.c */
+void fill_block_avx2(__m128i *s, const block *ref_block, block *next_block, int with_xor);
+#endif
 
 #endif /* ARGON2_OPT_H */
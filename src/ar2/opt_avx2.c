@@ -0,0 +1,199 @@
+/*
+ * Argon2 reference source code package - reference C implementations
+ *
+ * Copyright 2015
+ * Daniel Dinu, Dmitry Khovratovich, Jean-Philippe Aumasson, and Samuel Neves
+ *
+ * You may use this work under the terms of a Creative Commons CC0 1.0 
+ * License/Waiver or the Apache Public License 2.0, at your option. The terms of
+ * these licenses can be found at:
+ *
+ * - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+ * - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * You should have received a copy of both of these licenses along with this
+ * software. If not, they may be obtained at the above URLs.
+ */
+
+/*
+ * AVX2 version of fill_block() in opt.c, each 256-bit register holding four
+ * 64-bit words of the block. Built with a per-function target attribute, so
+ * nothing else needs -mavx2; opt.c only calls it once argon2_select_impl()
+ * has found AVX2 on the CPU.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "argon2.h"
+#include "opt.h"
+
+#define ARGON2_AVX2_TARGET __attribute__((target("avx2")))
+
+#define rotr32(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define rotr24(x)                                                              \
+    _mm256_shuffle_epi8((x), _mm256_setr_epi8(                                 \
+        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,                 \
+        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10))
+#define rotr16(x)                                                              \
+    _mm256_shuffle_epi8((x), _mm256_setr_epi8(                                 \
+        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,                 \
+        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9))
+#define rotr63(x) _mm256_xor_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+/* x + y + 2 * lo32(x) * lo32(y) on every 64-bit word */
+ARGON2_AVX2_TARGET static inline __m256i fBlaMka_avx2(__m256i x, __m256i y) {
+    __m256i z = _mm256_mul_epu32(x, y);
+    return _mm256_add_epi64(_mm256_add_epi64(x, y), _mm256_add_epi64(z, z));
+}
+
+#define G1_AVX2(A0, A1, B0, B1, C0, C1, D0, D1)                                \
+    do {                                                                       \
+        A0 = fBlaMka_avx2(A0, B0);                                             \
+        A1 = fBlaMka_avx2(A1, B1);                                             \
+        D0 = rotr32(_mm256_xor_si256(D0, A0));                                 \
+        D1 = rotr32(_mm256_xor_si256(D1, A1));                                 \
+        C0 = fBlaMka_avx2(C0, D0);                                             \
+        C1 = fBlaMka_avx2(C1, D1);                                             \
+        B0 = rotr24(_mm256_xor_si256(B0, C0));                                 \
+        B1 = rotr24(_mm256_xor_si256(B1, C1));                                 \
+    } while ((void)0, 0)
+
+#define G2_AVX2(A0, A1, B0, B1, C0, C1, D0, D1)                                \
+    do {                                                                       \
+        A0 = fBlaMka_avx2(A0, B0);                                             \
+        A1 = fBlaMka_avx2(A1, B1);                                             \
+        D0 = rotr16(_mm256_xor_si256(D0, A0));                                 \
+        D1 = rotr16(_mm256_xor_si256(D1, A1));                                 \
+        C0 = fBlaMka_avx2(C0, D0);                                             \
+        C1 = fBlaMka_avx2(C1, D1);                                             \
+        B0 = rotr63(_mm256_xor_si256(B0, C0));                                 \
+        B1 = rotr63(_mm256_xor_si256(B1, C1));                                 \
+    } while ((void)0, 0)
+
+/* Rows of 16 words, one register per row of the 4x4 matrix */
+#define DIAGONALIZE_1(A0, B0, C0, D0, A1, B1, C1, D1)                          \
+    do {                                                                       \
+        B0 = _mm256_permute4x64_epi64(B0, _MM_SHUFFLE(0, 3, 2, 1));            \
+        C0 = _mm256_permute4x64_epi64(C0, _MM_SHUFFLE(1, 0, 3, 2));            \
+        D0 = _mm256_permute4x64_epi64(D0, _MM_SHUFFLE(2, 1, 0, 3));            \
+        B1 = _mm256_permute4x64_epi64(B1, _MM_SHUFFLE(0, 3, 2, 1));            \
+        C1 = _mm256_permute4x64_epi64(C1, _MM_SHUFFLE(1, 0, 3, 2));            \
+        D1 = _mm256_permute4x64_epi64(D1, _MM_SHUFFLE(2, 1, 0, 3));            \
+    } while ((void)0, 0)
+
+#define UNDIAGONALIZE_1(A0, B0, C0, D0, A1, B1, C1, D1)                        \
+    do {                                                                       \
+        B0 = _mm256_permute4x64_epi64(B0, _MM_SHUFFLE(2, 1, 0, 3));            \
+        C0 = _mm256_permute4x64_epi64(C0, _MM_SHUFFLE(1, 0, 3, 2));            \
+        D0 = _mm256_permute4x64_epi64(D0, _MM_SHUFFLE(0, 3, 2, 1));            \
+        B1 = _mm256_permute4x64_epi64(B1, _MM_SHUFFLE(2, 1, 0, 3));            \
+        C1 = _mm256_permute4x64_epi64(C1, _MM_SHUFFLE(1, 0, 3, 2));            \
+        D1 = _mm256_permute4x64_epi64(D1, _MM_SHUFFLE(0, 3, 2, 1));            \
+    } while ((void)0, 0)
+
+/*
+ * Columns, two at a time: each register holds two words of a matrix row for
+ * both columns, so a row of one column is split over the X0 and X1 halves.
+ */
+#define DIAGONALIZE_2(A0, A1, B0, B1, C0, C1, D0, D1)                          \
+    do {                                                                       \
+        __m256i t0 = _mm256_blend_epi32(B0, B1, 0xCC);                         \
+        __m256i t1 = _mm256_blend_epi32(B0, B1, 0x33);                         \
+        B1 = _mm256_permute4x64_epi64(t0, _MM_SHUFFLE(2, 3, 0, 1));            \
+        B0 = _mm256_permute4x64_epi64(t1, _MM_SHUFFLE(2, 3, 0, 1));            \
+                                                                               \
+        t0 = C0;                                                               \
+        C0 = C1;                                                               \
+        C1 = t0;                                                               \
+                                                                               \
+        t0 = _mm256_blend_epi32(D0, D1, 0xCC);                                 \
+        t1 = _mm256_blend_epi32(D0, D1, 0x33);                                 \
+        D0 = _mm256_permute4x64_epi64(t0, _MM_SHUFFLE(2, 3, 0, 1));            \
+        D1 = _mm256_permute4x64_epi64(t1, _MM_SHUFFLE(2, 3, 0, 1));            \
+    } while ((void)0, 0)
+
+#define UNDIAGONALIZE_2(A0, A1, B0, B1, C0, C1, D0, D1)                        \
+    do {                                                                       \
+        __m256i t0 = _mm256_blend_epi32(B0, B1, 0xCC);                         \
+        __m256i t1 = _mm256_blend_epi32(B0, B1, 0x33);                         \
+        B0 = _mm256_permute4x64_epi64(t0, _MM_SHUFFLE(2, 3, 0, 1));            \
+        B1 = _mm256_permute4x64_epi64(t1, _MM_SHUFFLE(2, 3, 0, 1));            \
+                                                                               \
+        t0 = C0;                                                               \
+        C0 = C1;                                                               \
+        C1 = t0;                                                               \
+                                                                               \
+        t0 = _mm256_blend_epi32(D0, D1, 0x33);                                 \
+        t1 = _mm256_blend_epi32(D0, D1, 0xCC);                                 \
+        D0 = _mm256_permute4x64_epi64(t0, _MM_SHUFFLE(2, 3, 0, 1));            \
+        D1 = _mm256_permute4x64_epi64(t1, _MM_SHUFFLE(2, 3, 0, 1));            \
+    } while ((void)0, 0)
+
+#define BLAKE2_ROUND_1(A0, A1, B0, B1, C0, C1, D0, D1)                         \
+    do {                                                                       \
+        G1_AVX2(A0, A1, B0, B1, C0, C1, D0, D1);                               \
+        G2_AVX2(A0, A1, B0, B1, C0, C1, D0, D1);                               \
+        DIAGONALIZE_1(A0, B0, C0, D0, A1, B1, C1, D1);                         \
+        G1_AVX2(A0, A1, B0, B1, C0, C1, D0, D1);                               \
+        G2_AVX2(A0, A1, B0, B1, C0, C1, D0, D1);                               \
+        UNDIAGONALIZE_1(A0, B0, C0, D0, A1, B1, C1, D1);                       \
+    } while ((void)0, 0)
+
+#define BLAKE2_ROUND_2(A0, A1, B0, B1, C0, C1, D0, D1)                         \
+    do {                                                                       \
+        G1_AVX2(A0, A1, B0, B1, C0, C1, D0, D1);                               \
+        G2_AVX2(A0, A1, B0, B1, C0, C1, D0, D1);                               \
+        DIAGONALIZE_2(A0, A1, B0, B1, C0, C1, D0, D1);                         \
+        G1_AVX2(A0, A1, B0, B1, C0, C1, D0, D1);                               \
+        G2_AVX2(A0, A1, B0, B1, C0, C1, D0, D1);                               \
+        UNDIAGONALIZE_2(A0, A1, B0, B1, C0, C1, D0, D1);                       \
+    } while ((void)0, 0)
+
+#define ARGON2_HWORDS_IN_BLOCK (ARGON2_BLOCK_SIZE / 32)
+
+ARGON2_AVX2_TARGET void fill_block_avx2(__m128i *s, const block *ref_block,
+                                        block *next_block, int with_xor) {
+    __m256i state[ARGON2_HWORDS_IN_BLOCK];
+    __m256i block_XY[ARGON2_HWORDS_IN_BLOCK];
+    unsigned int i;
+
+    /* The caller's state is only 16-byte aligned */
+    for (i = 0; i < ARGON2_HWORDS_IN_BLOCK; i++) {
+        state[i] = _mm256_xor_si256(
+            _mm256_loadu_si256((const __m256i *)s + i),
+            _mm256_loadu_si256((const __m256i *)ref_block->v + i));
+        if (with_xor) {
+            block_XY[i] = _mm256_xor_si256(
+                state[i], _mm256_loadu_si256((const __m256i *)next_block->v + i));
+        } else {
+            block_XY[i] = state[i];
+        }
+    }
+
+    /* Rows (0,...,15), (16,...,31), ... two at a time */
+    for (i = 0; i < 4; ++i) {
+        BLAKE2_ROUND_1(state[8 * i + 0], state[8 * i + 4], state[8 * i + 1],
+            state[8 * i + 5], state[8 * i + 2], state[8 * i + 6],
+            state[8 * i + 3], state[8 * i + 7]);
+    }
+
+    /* Columns (0,1,16,17,...,112,113), ... two at a time */
+    for (i = 0; i < 4; ++i) {
+        BLAKE2_ROUND_2(state[0 + i], state[4 + i], state[8 + i],
+            state[12 + i], state[16 + i], state[20 + i], state[24 + i],
+            state[28 + i]);
+    }
+
+    for (i = 0; i < ARGON2_HWORDS_IN_BLOCK; i++) {
+        state[i] = _mm256_xor_si256(state[i], block_XY[i]);
+        _mm256_storeu_si256((__m256i *)s + i, state[i]);
+        _mm256_storeu_si256((__m256i *)next_block->v + i, state[i]);
+    }
+}
+
+#endif
@@ -78,6 +78,11 @@ static void next_addresses(block *address_block, block *input_block,
     fill_block(zero_block, address_block, address_block, 0);
 }
 
+const char *argon2_select_impl(int use_avx2) {
+    (void)use_avx2;
+    return "ref";
+}
+
 void fill_segment(const argon2_instance_t *instance,
                   argon2_position_t position) {
     block *ref_block = NULL, *curr_block = NULL;
@@ -427,6 +427,14 @@ ARGON2_PUBLIC size_t argon2_encodedlen(uint32_t t_cost, uint32_t m_cost,
                                        uint32_t parallelism, uint32_t saltlen,
                                        uint32_t hashlen, argon2_type type);
 
+/**
+ * Selects the fill_block implementation for this CPU: AVX2 where the CPU has
+ * it and use_avx2 is set, SSE2 otherwise in the optimised build
+ * @param use_avx2 Whether AVX2 may be used
+ * @return  The name of the implementation selected
+ */
+ARGON2_PUBLIC const char *argon2_select_impl(int use_avx2);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -6,6 +6,7 @@
 
 #include "core.h"
 #include "coins.h"
+#include "sha256.h"
 
 #include "util.h"
 #include "sync.h"
@@ -78,29 +79,26 @@ void CTxOut::print() const
     LogPrintf("%s\n", ToString());
 }
 
-uint256 CTransaction::GetHash() const
-{
-  return SerializeHash(*this);
-}
+CMutableTransaction::CMutableTransaction() : nVersion(CTransaction::CURRENT_VERSION), nLockTime(0) {}
+CMutableTransaction::CMutableTransaction(const CTransaction& tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime) {}
 
-uint256 CTransaction::GetCachedHash() const
+uint256 CMutableTransaction::GetHash() const
 {
-  if (hash!=uint256(0)) {
-    return hash;
-  }
-  else {
     return SerializeHash(*this);
-  }
 }
 
 void CTransaction::UpdateHash() const
 {
   if (this->vector_format) {
+    // A merge-mined parent chain's coinbase is identified by the hash of its
+    // raw bytes, as the parent chain computes it
+    const unsigned char* pbegin = vector_rep.empty() ? NULL : &vector_rep[0];
+    const unsigned char* pend = pbegin + vector_rep.size();
     if (this->keccak_hash) {
-      *const_cast<uint256*>(&hash) = KeccakHashCBTX((unsigned char *)&vector_rep[0],(unsigned char *)&vector_rep[vector_rep.size()]);
+      *const_cast<uint256*>(&hash) = KeccakHashCBTX((unsigned char *)pbegin,(unsigned char *)pend);
     }
     else {
-      *const_cast<uint256*>(&hash) = Hash((unsigned char *)&vector_rep[0],(unsigned char *)&vector_rep[vector_rep.size()]);
+      *const_cast<uint256*>(&hash) = Hash(pbegin,pend);
     }
   }
   else {
@@ -108,6 +106,26 @@ void CTransaction::UpdateHash() const
   }
 }
 
+CTransaction::CTransaction() : hash(0), nVersion(CTransaction::CURRENT_VERSION), vin(), vout(), nLockTime(0), vector_format(false), keccak_hash(false) { }
+
+CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), vector_format(false), keccak_hash(false)
+{
+    UpdateHash();
+}
+
+CTransaction& CTransaction::operator=(const CTransaction &tx)
+{
+    *const_cast<int*>(&nVersion) = tx.nVersion;
+    *const_cast<std::vector<CTxIn>*>(&vin) = tx.vin;
+    *const_cast<std::vector<CTxOut>*>(&vout) = tx.vout;
+    *const_cast<unsigned int*>(&nLockTime) = tx.nLockTime;
+    vector_format = tx.vector_format;
+    vector_rep = tx.vector_rep;
+    keccak_hash = tx.keccak_hash;
+    *const_cast<uint256*>(&hash) = tx.hash;
+    return *this;
+}
+
 bool CTransaction::IsNewerThan(const CTransaction& old) const
 {
     if (vin.size() != old.vin.size())
@@ -246,16 +264,22 @@ uint64_t CTxOutCompressor::DecompressAmount(uint64_t x)
 uint256 CBlock::BuildMerkleTree() const
 {
     vMerkleTree.clear();
+    vMerkleTree.reserve(vtx.size() * 2 + 16);
     BOOST_FOREACH(const CTransaction& tx, vtx)
         vMerkleTree.push_back(tx.GetHash());
     int j = 0;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
+        // The nodes of a level are contiguous, so its pairs are already the
+        // 64-byte messages SHA256D64 hashes; an odd last node pairs with itself
+        int nPairs = nSize / 2;
+        int nOut = vMerkleTree.size();
+        vMerkleTree.resize(nOut + (nSize + 1) / 2);
+        SHA256D64(vMerkleTree[nOut].begin(), vMerkleTree[j].begin(), nPairs);
+        if (nSize & 1)
         {
-            int i2 = std::min(i+1, nSize-1);
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+            uint256 pair[2] = { vMerkleTree[j+nSize-1], vMerkleTree[j+nSize-1] };
+            SHA256D64(vMerkleTree[nOut+nPairs].begin(), pair[0].begin(), 1);
         }
         j += nSize;
     }
@@ -12,6 +12,7 @@
 #include "uint256.h"
 #include "scrypt.h"
 #include <stdint.h>
+#include <bitset>
 #include "hash.h"
 #include "bignum.h"
 #include "chainparams.h"
@@ -192,32 +193,51 @@ public:
     void print() const;
 };
 
+struct CMutableTransaction;
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
+ *
+ * Transactions are immutable once constructed, so their hash is computed
+ * exactly once, on construction or deserialization. Build new transactions
+ * with CMutableTransaction and convert.
  */
 class CTransaction
 {
  private:
-  uint256 hash;
+  /** Memory only. */
+  const uint256 hash;
   void UpdateHash() const;
-  
+
 public:
     static int64_t nMinTxFee;
     static int64_t nMinRelayTxFee;
     static const int CURRENT_VERSION=1;
-    int nVersion;
-    std::vector<CTxIn> vin;
-    std::vector<CTxOut> vout;
-    unsigned int nLockTime;
 
+    // The local variables are made const to prevent unintended modification
+    // without updating the cached hash value. However, CTransaction is not
+    // actually immutable; deserialization and assignment are implemented,
+    // and bypass the constness. This is safe, as they update the entire
+    // structure, including the hash.
+    const int nVersion;
+    const std::vector<CTxIn> vin;
+    const std::vector<CTxOut> vout;
+    const unsigned int nLockTime;
+
+    // Wire format of a merge-mined parent chain's coinbase (see CAuxPow);
+    // must be set before deserializing
     bool vector_format;
     std::vector<unsigned char> vector_rep;
     bool keccak_hash;
 
-    CTransaction()
-    {
-        SetNull();
-    }
+    /** Construct a CTransaction that qualifies as IsNull() */
+    CTransaction();
+
+    /** Convert a CMutableTransaction into a CTransaction. */
+    CTransaction(const CMutableTransaction &tx);
+
+    CTransaction(const CTransaction& tx) = default;
+    CTransaction& operator=(const CTransaction& tx);
 
     IMPLEMENT_SERIALIZE
     (
@@ -225,34 +245,25 @@ public:
        READWRITE(this->vector_rep);
      }
      else {
-       READWRITE(this->nVersion);
+       READWRITE(*const_cast<int*>(&this->nVersion));
        nVersion = this->nVersion;
-       READWRITE(vin);
-       READWRITE(vout);
-       READWRITE(nLockTime);
+       READWRITE(*const_cast<std::vector<CTxIn>*>(&vin));
+       READWRITE(*const_cast<std::vector<CTxOut>*>(&vout));
+       READWRITE(*const_cast<unsigned int*>(&nLockTime));
      }
      if (fRead) UpdateHash();
     )
 
-    void SetNull()
+    bool IsNull() const
     {
-        nVersion = CTransaction::CURRENT_VERSION;
-        vin.clear();
-        vout.clear();
-        nLockTime = 0;
-	*const_cast<uint256*>(&hash) = uint256(0);
-	vector_format = false;
-	vector_rep.clear();
-	keccak_hash = false;
+        return (vin.empty() && vout.empty());
     }
 
-    bool IsNull() const
+    const uint256& GetHash() const
     {
-        return (vin.empty() && vout.empty());
+        return hash;
     }
 
-    uint256 GetHash() const;
-    uint256 GetCachedHash() const;
     bool IsNewerThan(const CTransaction& old) const;
 
     // Return sum of txouts.
@@ -270,15 +281,12 @@ public:
 
     friend bool operator==(const CTransaction& a, const CTransaction& b)
     {
-      return (a.nVersion  == b.nVersion &&
-                a.vin       == b.vin &&
-                a.vout      == b.vout &&
-                a.nLockTime == b.nLockTime);
+        return a.hash == b.hash;
     }
 
     friend bool operator!=(const CTransaction& a, const CTransaction& b)
     {
-        return !(a == b);
+        return a.hash != b.hash;
     }
 
 
@@ -286,6 +294,32 @@ public:
     void print() const;
 };
 
+/** A mutable version of CTransaction. */
+struct CMutableTransaction
+{
+    int nVersion;
+    std::vector<CTxIn> vin;
+    std::vector<CTxOut> vout;
+    unsigned int nLockTime;
+
+    CMutableTransaction();
+    CMutableTransaction(const CTransaction& tx);
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(vin);
+        READWRITE(vout);
+        READWRITE(nLockTime);
+    )
+
+    /** Compute the hash of this CMutableTransaction. This is computed on the
+     * fly, as opposed to GetHash() in CTransaction, which uses a cached result.
+     */
+    uint256 GetHash() const;
+};
+
 class CAuxPow;
 class CBlock;
 
@@ -469,11 +503,6 @@ public:
    * @return The expected index for the aux hash.
    */
     static int getExpectedIndex(int nNonce, int nChainId, unsigned h);
-
-    inline uint256 GetHash() const
-    {
-      return CTransaction::GetCachedHash();
-    }
 };
 
 /** Nodes collect new transactions into a block, hash them into a hash tree,
@@ -718,6 +747,7 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    bool fPoWChecked; // proof of work already verified, see VerifyBlocksProofOfWork()
 
     CBlock()
     {
@@ -741,6 +771,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         vMerkleTree.clear();
+        fPoWChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -787,7 +818,9 @@ enum BlockStatus {
 
     BLOCK_FAILED_VALID       =   32, // stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, // descends from failed block
-    BLOCK_FAILED_MASK        =   96
+    BLOCK_FAILED_MASK        =   96,
+
+    BLOCK_HAVE_SSF           =  128, // subsidy scaling factor known, memory only (kept under its own block tree DB key)
 };
 
 FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly);
@@ -796,10 +829,22 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 
 bool CheckAuxPowProofOfWork(const CBlockHeader& block, const CChainParams& params);
 
+extern bool fVerifyBlockReads;
+
+class CBlockIndex;
+
+/** Get the auxpow of a block index entry, paging it in from the block tree DB if it is not in memory */
+boost::shared_ptr<CAuxPow> GetBlockIndexAuxPow(const CBlockIndex* pindex);
+
 unsigned int GetAlgoWeight (const int algo);
 
 static const int64_t nForkHeight = 200; // We set it in past so not really used for fork condition
 
+// Fork activation: nForkMajority of the last nForkWindow blocks must have version >= nForkVersion
+static const int nForkVersion = 4;
+static const unsigned int nForkMajority = 75;
+static const unsigned int nForkWindow = 100;
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -814,7 +859,20 @@ public:
     // pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
 
-    // pointer to the AuxPoW header, if this block has one
+    // pointer to the index of some further predecessor of this block
+    CBlockIndex* pskip;
+
+    // pointer to the closest predecessor mined with the same algo, only following blocks on the fork
+    CBlockIndex* pprevAlgo;
+
+    // pointer to some further same-algo predecessor of this block, the pskip of the pprevAlgo chain
+    CBlockIndex* pskipAlgo;
+
+    // (memory only) number of blocks reachable through pprevAlgo, used to index the pskipAlgo skiplist
+    int nAlgoHeight;
+
+    // pointer to the AuxPoW header, if this block has one. Entries in mapBlockIndex leave it
+    // in the block tree DB and IsAuxpow() is all that is kept, see GetBlockIndexAuxPow()
     boost::shared_ptr<CAuxPow> pauxpow;
 
     // height of the entry in the chain. The genesis block has height 0
@@ -861,10 +919,28 @@ public:
     // (memory only) Sequencial id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    // (memory only) Rolling window over the last nForkWindow blocks up to and including this one,
+    // bit i is set if the block i steps back has version >= nForkVersion. See BuildForkState()
+    std::bitset<nForkWindow> forkWindow;
+
+    // (memory only) Cached fork activation flags, valid once fForkStateBuilt is set
+    unsigned int fForkStateBuilt : 1;
+    unsigned int fForkMajority : 1; // IsSuperMajority(nForkVersion,this,nForkMajority,nForkWindow)
+    unsigned int fOnFork : 1;
+    unsigned int fAlgoSkipBuilt : 1; // pprevAlgo, pskipAlgo and nAlgoHeight are set, see BuildAlgoSkip()
+    unsigned int fMedianTimeBuilt : 1; // nMedianTimePast is set, see BuildMedianTimePast()
+
+    // (memory only) Cached GetMedianTimePast(), valid once fMedianTimeBuilt is set
+    unsigned int nMedianTimePast;
+
     void SetNull()
     {
         phashBlock = NULL;
         pprev = NULL;
+        pskip = NULL;
+        pprevAlgo = NULL;
+        pskipAlgo = NULL;
+        nAlgoHeight = 0;
 	pauxpow.reset();
         nHeight = 0;
         nMoneySupply = 0;
@@ -877,6 +953,13 @@ public:
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+        forkWindow.reset();
+        fForkStateBuilt = 0;
+        fForkMajority = 0;
+        fOnFork = 0;
+        fAlgoSkipBuilt = 0;
+        fMedianTimeBuilt = 0;
+        nMedianTimePast = 0;
 
         nVersion       = 0;
         hashMerkleRoot = 0;
@@ -924,10 +1007,17 @@ public:
     }
 
     bool onFork() const {
-      if (this->nHeight >= nForkHeight && IsSuperMajority(4,this->pprev,75,100)) return true;
+      if (fForkStateBuilt) return fOnFork;
+      if (this->nHeight >= nForkHeight && this->pprev && this->pprev->IsForkMajority()) return true;
       return false;
     }
 
+    // Whether a block built on top of this one would be on the fork
+    bool IsForkMajority() const {
+      if (fForkStateBuilt) return fForkMajority;
+      return IsSuperMajority(nForkVersion,this,nForkMajority,nForkWindow);
+    }
+
     bool onFork2() const {
       //if (this->nHeight >= nForkHeight && IsSuperMajorityVariant12(4,true,this->pprev,950,1000)) return true;
       return false;
@@ -937,7 +1027,14 @@ public:
       //if (this->nHeight >= nForkHeight && IsSuperMajorityVariant2(4,true,this->pprev,950,1000)) return true;
       return false;
     }
-    
+
+    // Proof of work is checked before a block can reach BLOCK_VALID_TRANSACTIONS,
+    // so it holds even if the entry later failed on connect.
+    bool IsProofOfWorkChecked() const
+    {
+        return (nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS;
+    }
+
     CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
@@ -953,7 +1050,7 @@ public:
 	    catch (const std::exception& e) {
 	      LogPrintf("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), "");
 	    }
-	    if (!CheckAuxPowProofOfWork(block, Params()))
+	    if ((fVerifyBlockReads || !IsProofOfWorkChecked()) && !CheckAuxPowProofOfWork(block, Params()))
 	      LogPrintf("ReadBlockFromDisk: Errors in block header at %s", "");
 	    if (block.GetHash() != GetBlockHash())
 	      LogPrintf("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1024,6 +1121,13 @@ public:
     enum { nMedianTimeSpan=11 };
 
     int64_t GetMedianTimePast() const
+    {
+        if (fMedianTimeBuilt)
+            return nMedianTimePast;
+        return ComputeMedianTimePast();
+    }
+
+    int64_t ComputeMedianTimePast() const
     {
         int64_t pmedian[nMedianTimeSpan];
         int64_t* pbegin = &pmedian[nMedianTimeSpan];
@@ -1110,6 +1214,20 @@ public:
     // Build the skiplist pointer for this entry.
     void BuildSkip();
 
+    // Compute the cached fork activation flags for this entry, using the parent's window.
+    // Requires pprev and nHeight to be set.
+    void BuildForkState();
+
+    // Build the same-algo predecessor and skiplist pointers. Requires the fork state to be built.
+    void BuildAlgoSkip();
+
+    // Cache the median time past of this entry. Requires the fork state of its ancestors to be built.
+    void BuildMedianTimePast();
+
+    // Efficiently find a same-algo ancestor of this block by its nAlgoHeight.
+    CBlockIndex* GetAlgoAncestor(int algoHeight);
+    const CBlockIndex* GetAlgoAncestor(int algoHeight) const;
+
     // Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
@@ -1128,6 +1246,10 @@ public:
 
     explicit CDiskBlockIndex(CBlockIndex* pindex) : CBlockIndex(*pindex) {
       hashPrev = (pprev ? pprev->GetBlockHash() : 0);
+      // older clients would carry the flag over without the factor it stands for
+      nStatus &= ~BLOCK_HAVE_SSF;
+      if (IsAuxpow() && !pauxpow)
+        pauxpow = GetBlockIndexAuxPow(pindex);
     }
 
     unsigned int GetSerializeSize(int nType, int nVersion) const \
@@ -1173,7 +1295,8 @@ public:
 	  READWRITE(nNonce);
 	}
 	if (this->IsAuxpow() && onFork) {
-	  assert(pauxpow);
+	  if (!pauxpow) // not paged back in, CBlockTreeDB::WriteBlockIndex refuses these
+	    throw std::ios_base::failure("CDiskBlockIndex : auxpow not loaded");
 	  (*pauxpow).parentBlock.isParent = true;
 	  int algo = CBlockIndex::GetAlgo();
 	  (*pauxpow).parentBlock.algoParent = algo;
@@ -1227,7 +1350,8 @@ public:
 	  READWRITE(nNonce);
 	}
 	if (this->IsAuxpow() && onFork) {
-	  assert(pauxpow);
+	  if (!pauxpow) // not paged back in, CBlockTreeDB::WriteBlockIndex refuses these
+	    throw std::ios_base::failure("CDiskBlockIndex : auxpow not loaded");
 	  (*pauxpow).parentBlock.isParent = true;
 	  int algo = CBlockIndex::GetAlgo();
 	  (*pauxpow).parentBlock.algoParent = algo;
@@ -1374,6 +1498,35 @@ struct CBlockLocator
     }
 };
 
+/** Storage for block index entries. Entries are handed out from large chunks in the order
+ *  they are created, so a chain that was loaded or synced in order is walked backwards
+ *  through neighbouring memory, and no heap allocation is paid per entry. Entries keep
+ *  their address until the whole arena is cleared.
+ */
+class CBlockIndexArena {
+private:
+    static const size_t nChunkSize = 4096;
+    std::vector<CBlockIndex*> vChunks;
+    size_t nUsed; // entries handed out from the last chunk
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    void operator=(const CBlockIndexArena&);
+
+public:
+    CBlockIndexArena() : nUsed(nChunkSize) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    /** Return an entry in its default constructed state */
+    CBlockIndex* Allocate();
+
+    /** Destroy all entries */
+    void Clear();
+
+    size_t size() const {
+        return vChunks.empty() ? 0 : (vChunks.size() - 1) * nChunkSize + nUsed;
+    }
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
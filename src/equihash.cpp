@@ -24,6 +24,10 @@
 
 #include <boost/optional.hpp>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 EhSolverCancelledException solver_cancelled;
 
 template<unsigned int N, unsigned int K>
@@ -53,6 +57,174 @@ void GenerateHash(const eh_HashState& base_state, eh_index g,
     crypto_generichash_blake2b_final(&state, hash, hLen);
 }
 
+static const uint64_t blake2b_IV[8] =
+{
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t blake2b_sigma[12][16] =
+{
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+static inline uint64_t ReadLE64(const unsigned char* p)
+{
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return le64toh(x);
+}
+
+#if defined(__SSE2__)
+// Two 64-bit BLAKE2b lanes per register
+typedef __m128i eh_lane;
+static const size_t EH_LANE_WIDTH = 2;
+
+static inline eh_lane LaneAdd(eh_lane a, eh_lane b) { return _mm_add_epi64(a, b); }
+static inline eh_lane LaneXor(eh_lane a, eh_lane b) { return _mm_xor_si128(a, b); }
+static inline eh_lane LaneSet(uint64_t x) { return _mm_set1_epi64x(x); }
+static inline eh_lane LaneLoad(const uint64_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline void LaneStore(uint64_t* p, eh_lane x) { _mm_storeu_si128((__m128i*)p, x); }
+template<int n> inline eh_lane LaneRotr(eh_lane x) { return _mm_or_si128(_mm_srli_epi64(x, n), _mm_slli_epi64(x, 64 - n)); }
+template<> inline eh_lane LaneRotr<32>(eh_lane x) { return _mm_shuffle_epi32(x, _MM_SHUFFLE(2,3,0,1)); }
+#else
+typedef uint64_t eh_lane;
+static const size_t EH_LANE_WIDTH = 1;
+
+static inline eh_lane LaneAdd(eh_lane a, eh_lane b) { return a + b; }
+static inline eh_lane LaneXor(eh_lane a, eh_lane b) { return a ^ b; }
+static inline eh_lane LaneSet(uint64_t x) { return x; }
+static inline eh_lane LaneLoad(const uint64_t* p) { return *p; }
+static inline void LaneStore(uint64_t* p, eh_lane x) { *p = x; }
+template<int n> inline eh_lane LaneRotr(eh_lane x) { return (x >> n) | (x << (64 - n)); }
+#endif
+
+BOOST_STATIC_ASSERT(EH_HASH_LANES % EH_LANE_WIDTH == 0);
+
+static inline void LaneG(eh_lane& a, eh_lane& b, eh_lane& c, eh_lane& d, eh_lane x, eh_lane y)
+{
+    a = LaneAdd(LaneAdd(a, b), x);
+    d = LaneRotr<32>(LaneXor(d, a));
+    c = LaneAdd(c, d);
+    b = LaneRotr<24>(LaneXor(b, c));
+    a = LaneAdd(LaneAdd(a, b), y);
+    d = LaneRotr<16>(LaneXor(d, a));
+    c = LaneAdd(c, d);
+    b = LaneRotr<63>(LaneXor(b, c));
+}
+
+// BLAKE2b compression of EH_HASH_LANES blocks that start from the same
+// chaining value h and the same counter. Word w of lane l is m[w][l].
+static void Blake2bCompressLanes(const uint64_t h[8], const uint64_t m[16][EH_HASH_LANES],
+                                 uint64_t nLength, bool fLast, uint64_t out[8][EH_HASH_LANES])
+{
+    const size_t nVectors = EH_HASH_LANES / EH_LANE_WIDTH;
+    for (size_t j = 0; j < nVectors; j++) {
+        eh_lane v[16];
+        for (int i = 0; i < 8; i++) {
+            v[i] = LaneSet(h[i]);
+            v[i+8] = LaneSet(blake2b_IV[i]);
+        }
+        v[12] = LaneSet(blake2b_IV[4] ^ nLength);
+        if (fLast)
+            v[14] = LaneSet(~blake2b_IV[6]);
+
+        eh_lane x[16];
+        for (int w = 0; w < 16; w++)
+            x[w] = LaneLoad(&m[w][j * EH_LANE_WIDTH]);
+
+        for (int r = 0; r < 12; r++) {
+            const uint8_t* s = blake2b_sigma[r];
+            LaneG(v[0], v[4], v[ 8], v[12], x[s[ 0]], x[s[ 1]]);
+            LaneG(v[1], v[5], v[ 9], v[13], x[s[ 2]], x[s[ 3]]);
+            LaneG(v[2], v[6], v[10], v[14], x[s[ 4]], x[s[ 5]]);
+            LaneG(v[3], v[7], v[11], v[15], x[s[ 6]], x[s[ 7]]);
+            LaneG(v[0], v[5], v[10], v[15], x[s[ 8]], x[s[ 9]]);
+            LaneG(v[1], v[6], v[11], v[12], x[s[10]], x[s[11]]);
+            LaneG(v[2], v[7], v[ 8], v[13], x[s[12]], x[s[13]]);
+            LaneG(v[3], v[4], v[ 9], v[14], x[s[14]], x[s[15]]);
+        }
+
+        for (int i = 0; i < 8; i++)
+            LaneStore(&out[i][j * EH_LANE_WIDTH], LaneXor(LaneSet(h[i]), LaneXor(v[i], v[i+8])));
+    }
+}
+
+EhHeaderHasher::EhHeaderHasher(unsigned int n, unsigned int k, const unsigned char* header, size_t len)
+{
+    nOutLen = (512/n)*n/8;
+    nLength = len + sizeof(eh_index);
+    assert(len % 128 + sizeof(eh_index) <= 128);
+
+    // Parameter block as in Equihash<N,K>::InitialiseState
+    unsigned char personalization[16] = {};
+    uint32_t le_N = htole32(n);
+    uint32_t le_K = htole32(k);
+    memcpy(personalization, "ZcashPoW", 8);
+    memcpy(personalization+8,  &le_N, 4);
+    memcpy(personalization+12, &le_K, 4);
+    for (int i = 0; i < 8; i++)
+        h[i] = blake2b_IV[i];
+    h[0] ^= 0x01010000ULL ^ nOutLen;
+    h[6] ^= ReadLE64(personalization);
+    h[7] ^= ReadLE64(personalization+8);
+
+    // The full blocks are never the last, the index always follows them
+    uint64_t m[16][EH_HASH_LANES];
+    uint64_t hNext[8][EH_HASH_LANES];
+    size_t nBlocks = len / 128;
+    for (size_t b = 0; b < nBlocks; b++) {
+        for (int w = 0; w < 16; w++)
+            for (size_t l = 0; l < EH_HASH_LANES; l++)
+                m[w][l] = ReadLE64(header + 128*b + 8*w);
+        Blake2bCompressLanes(h, m, 128*(b+1), false, hNext);
+        for (int i = 0; i < 8; i++)
+            h[i] = hNext[i][0];
+    }
+
+    nTail = len - 128*nBlocks;
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, header + 128*nBlocks, nTail);
+}
+
+void EhHeaderHasher::Hash(const eh_index* g, size_t nCount, unsigned char* out) const
+{
+    uint64_t m[16][EH_HASH_LANES];
+    uint64_t hOut[8][EH_HASH_LANES];
+    unsigned char block[128];
+    memcpy(block, tail, sizeof(block));
+    for (size_t i = 0; i < nCount; i += EH_HASH_LANES) {
+        size_t nLanes = std::min(nCount - i, EH_HASH_LANES);
+        for (size_t l = 0; l < EH_HASH_LANES; l++) {
+            // spare lanes repeat the last index
+            eh_index lei = htole32(g[i + std::min(l, nLanes - 1)]);
+            memcpy(block + nTail, &lei, sizeof(eh_index));
+            for (int w = 0; w < 16; w++)
+                m[w][l] = ReadLE64(block + 8*w);
+        }
+        Blake2bCompressLanes(h, m, nLength, true, hOut);
+        for (size_t l = 0; l < nLanes; l++) {
+            unsigned char hash[64];
+            for (int w = 0; w < 8; w++) {
+                uint64_t x = htole64(hOut[w][l]);
+                memcpy(hash + 8*w, &x, 8);
+            }
+            memcpy(out + (i + l) * nOutLen, hash, nOutLen);
+        }
+    }
+}
+
 void ExpandArray(const unsigned char* in, size_t in_len,
                  unsigned char* out, size_t out_len,
                  size_t bit_len, size_t byte_pad)
@@ -698,50 +870,99 @@ invalidsolution:
     return false;
 }
 
+// Read nOut fields of nBits bits each, packed big-endian as in ExpandArray
+static void ReadPackedFields(const unsigned char* in, size_t nBits, uint32_t* out, size_t nOut)
+{
+    uint64_t acc = 0;
+    size_t nAcc = 0;
+    for (size_t i = 0; i < nOut; i++) {
+        while (nAcc < nBits) {
+            acc = (acc << 8) | *in++;
+            nAcc += 8;
+        }
+        nAcc -= nBits;
+        out[i] = (acc >> nAcc) & (((uint64_t)1 << nBits) - 1);
+    }
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln)
+{
+    return IsValidTree(soln, &base_state, NULL);
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::IsValidSolution(const EhHeaderHasher& hasher, const std::vector<unsigned char>& soln)
+{
+    assert(hasher.GetOutputLength() == HashOutput);
+    return IsValidTree(soln, NULL, &hasher);
+}
+
+// Same checks as the row by row merge the solvers use, on fixed size arrays:
+// every leaf hash is split into its K+1 collision digits, and each level
+// merges pairs of subtrees in place.
 template<unsigned int N, unsigned int K>
-bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln)
+bool Equihash<N,K>::IsValidTree(const std::vector<unsigned char>& soln, const eh_HashState* pbase_state, const EhHeaderHasher* phasher)
 {
+    enum : size_t { Leaves=1 << K };
+    BOOST_STATIC_ASSERT(Leaves % EH_HASH_LANES == 0);
+
     if (soln.size() != SolutionWidth) {
         return false;
     }
 
-    //LogPrintf("good solution size\n");
-    
-    std::vector<FullStepRow<FinalFullWidth>> X;
-    X.reserve(1 << K);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
-                       N/8, HashLength, CollisionBitLength, i);
+    eh_index indices[Leaves];
+    ReadPackedFields(soln.data(), CollisionBitLength + 1, indices, Leaves);
+
+    uint32_t digits[Leaves][K+1];
+    unsigned char hashes[EH_HASH_LANES * HashOutput];
+    eh_index g[EH_HASH_LANES];
+    for (size_t i = 0; i < Leaves; i += EH_HASH_LANES) {
+        for (size_t l = 0; l < EH_HASH_LANES; l++)
+            g[l] = indices[i+l] / IndicesPerHashOutput;
+        if (phasher) {
+            phasher->Hash(g, EH_HASH_LANES, hashes);
+        } else {
+            for (size_t l = 0; l < EH_HASH_LANES; l++)
+                GenerateHash(*pbase_state, g[l], hashes + l*HashOutput, HashOutput);
+        }
+        for (size_t l = 0; l < EH_HASH_LANES; l++)
+            ReadPackedFields(hashes + l*HashOutput + (indices[i+l] % IndicesPerHashOutput) * N/8,
+                             CollisionBitLength, digits[i+l], K+1);
     }
 
-    size_t hashLen = HashLength;
-    size_t lenIndices = sizeof(eh_index);
-    while (X.size() > 1) {
-        std::vector<FullStepRow<FinalFullWidth>> Xc;
-        for (int i = 0; i < X.size(); i += 2) {
-            if (!HasCollision(X[i], X[i+1], CollisionByteLength)) {
-	      LogPrintf("!hascollision %d\n",i);
-                return false;
-            }
-            if (X[i+1].IndicesBefore(X[i], hashLen, lenIndices)) {
-	      LogPrintf("indicesbefore %d\n",i);
+    eh_index sorted[Leaves];
+    std::copy(indices, indices + Leaves, sorted);
+    std::sort(sorted, sorted + Leaves);
+    if (std::adjacent_find(sorted, sorted + Leaves) != sorted + Leaves) {
+        LogPrintf("!distinctindices\n");
+        return false;
+    }
+
+    // The leftmost index of every subtree; with the indices distinct,
+    // comparing these orders the subtrees the same as comparing all of them
+    eh_index first[Leaves];
+    std::copy(indices, indices + Leaves, first);
+    size_t nNodes = Leaves;
+    for (size_t r = 0; r < K; r++, nNodes /= 2) {
+        for (size_t i = 0; i < nNodes; i += 2) {
+            const uint32_t* a = digits[i];
+            const uint32_t* b = digits[i+1];
+            if (a[r] != b[r]) {
+                LogPrintf("!hascollision %d\n", i);
                 return false;
             }
-            if (!DistinctIndices(X[i], X[i+1], hashLen, lenIndices)) {
-	      LogPrintf("!distinctindices %d\n",i);
+            if (first[i+1] < first[i]) {
+                LogPrintf("indicesbefore %d\n", i);
                 return false;
             }
-            Xc.emplace_back(X[i], X[i+1], hashLen, lenIndices, CollisionByteLength);
+            for (size_t j = r + 1; j <= K; j++)
+                digits[i/2][j] = a[j] ^ b[j];
+            first[i/2] = first[i];
         }
-        X = Xc;
-        hashLen -= CollisionByteLength;
-        lenIndices *= 2;
     }
 
-    assert(X.size() == 1);
-    return X[0].IsZero(hashLen);
+    return digits[0][K] == 0;
 }
 
 // Explicit instantiations for Equihash<96,3>
@@ -752,7 +973,8 @@ template bool Equihash<96,3>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<96,3>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+template bool Equihash<96,3>::IsValidSolution(const EhHeaderHasher& hasher, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<200,9>
 template int Equihash<200,9>::InitialiseState(eh_HashState& base_state);
@@ -762,7 +984,8 @@ template bool Equihash<200,9>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<200,9>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(std::vector<unsigned char>)> validBlock,
                                               const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+template bool Equihash<200,9>::IsValidSolution(const EhHeaderHasher& hasher, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<96,5>
 template int Equihash<96,5>::InitialiseState(eh_HashState& base_state);
@@ -772,7 +995,8 @@ template bool Equihash<96,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<96,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+template bool Equihash<96,5>::IsValidSolution(const EhHeaderHasher& hasher, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<48,5>
 template int Equihash<48,5>::InitialiseState(eh_HashState& base_state);
@@ -782,4 +1006,5 @@ template bool Equihash<48,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+template bool Equihash<48,5>::IsValidSolution(const EhHeaderHasher& hasher, const std::vector<unsigned char>& soln);
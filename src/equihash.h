@@ -154,6 +154,34 @@ class EhSolverCancelledException : public std::exception
     }
 };
 
+/** Number of leaf hashes EhHeaderHasher computes side by side */
+static const size_t EH_HASH_LANES = 4;
+
+/** BLAKE2b of one header followed by each of many leaf hash indices.
+ *
+ * Every leaf hash of a solution is BLAKE2b(I||V||le32(g)) for the same I||V.
+ * The full blocks of I||V are compressed once, and Hash() then only has to
+ * compress the final block, EH_HASH_LANES indices at a time (two per SSE2
+ * register where available). Unlike libsodium's state this needs the
+ * index to fit in the final block, so len % 128 may be at most 124.
+ */
+class EhHeaderHasher
+{
+private:
+    uint64_t h[8];
+    unsigned char tail[128];
+    size_t nTail;
+    uint64_t nLength; // of I||V||index
+    size_t nOutLen;
+
+public:
+    EhHeaderHasher(unsigned int n, unsigned int k, const unsigned char* header, size_t len);
+
+    size_t GetOutputLength() const { return nOutLen; }
+    /** Write the hash of each of the nCount indices in g to out, GetOutputLength() bytes apart */
+    void Hash(const eh_index* g, size_t nCount, unsigned char* out) const;
+};
+
 inline constexpr const size_t max(const size_t A, const size_t B) { return A > B ? A : B; }
 
 inline constexpr size_t equihash_solution_size(unsigned int N, unsigned int K) {
@@ -189,7 +217,11 @@ public:
     bool OptimisedSolve(const eh_HashState& base_state,
                         const std::function<bool(std::vector<unsigned char>)> validBlock,
                         const std::function<bool(EhSolverCancelCheck)> cancelled);
-    bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+    bool IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+    bool IsValidSolution(const EhHeaderHasher& hasher, const std::vector<unsigned char>& soln);
+
+private:
+    bool IsValidTree(const std::vector<unsigned char>& soln, const eh_HashState* pbase_state, const EhHeaderHasher* phasher);
 };
 
 #include "equihash.tcc"
@@ -273,4 +305,20 @@ inline bool EhOptimisedSolveUncancellable(unsigned int n, unsigned int k, const
         throw std::invalid_argument("Unsupported Equihash parameters"); \
     }
 
+inline bool EhIsValidHeaderSolution(unsigned int n, unsigned int k, const EhHeaderHasher& hasher,
+                                    const std::vector<unsigned char>& soln)
+{
+    if (n == 96 && k == 3) {
+        return Eh96_3.IsValidSolution(hasher, soln);
+    } else if (n == 200 && k == 9) {
+        return Eh200_9.IsValidSolution(hasher, soln);
+    } else if (n == 96 && k == 5) {
+        return Eh96_5.IsValidSolution(hasher, soln);
+    } else if (n == 48 && k == 5) {
+        return Eh48_5.IsValidSolution(hasher, soln);
+    } else {
+        throw std::invalid_argument("Unsupported Equihash parameters");
+    }
+}
+
 #endif // BITCOIN_EQUIHASH_H
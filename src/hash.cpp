@@ -6,6 +6,14 @@
 #include "cryptonight/crypto/hash-ops.h"
 #include "yescrypt/yescrypt.h"
 
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#include <boost/thread/tss.hpp>
+
+extern "C" void slow_hash_free_state(void);
+
 uint32_t murmur3_32(const uint8_t* key, size_t len, uint32_t seed) {
   uint32_t h = seed;
   if (len > 3) {
@@ -157,11 +165,11 @@ void hash_easy (const char* input, char * output) {
 }
 
 void hash_argon2(const char * input, char * output) {
-  argon2d_hash_raw(1,4096,1,input,80,input,80,output,32);
+  CPoWHasher::ForThread().HashArgon2(input,output);
 }
 
 uint256 hash_x17(const char * begin, const char * end) {
-  return HashX17(begin,end);
+  return CPoWHasher::ForThread().X17().Hash(begin, end - begin);
 }
 
 void hash_lyra2rev2(const char * input, char * output) {
@@ -173,9 +181,121 @@ void hash_equihash(const char * input, char * output) {
 }
 
 void hash_cryptonight(const char * input, char * output, int len) {
-  cn_slow_hash((const void*)input,len,(char*)output,1,0);
+  CPoWHasher::ForThread().HashCryptonight(input,output,len);
 }
 
 void hash_yescrypt(const char * input, char * output) {
   yescrypt_hash(input,output);
 }
+
+static boost::thread_specific_ptr<CPoWHasher> powhasher;
+
+CPoWHasher& CPoWHasher::ForThread()
+{
+    CPoWHasher *phasher = powhasher.get();
+    if (!phasher) {
+        // thread_specific_ptr deletes the context when the thread ends.
+        phasher = new CPoWHasher();
+        powhasher.reset(phasher);
+    }
+    return *phasher;
+}
+
+CPoWHasher::CPoWHasher() : pArgon2Memory(NULL), nArgon2Size(0), fArgon2Mapped(false), pX17(NULL)
+{
+}
+
+CPoWHasher::~CPoWHasher()
+{
+    FreeArgon2Memory();
+    delete pX17;
+    // cn_slow_hash keeps its scratchpad in a thread local of its own
+    slow_hash_free_state();
+}
+
+void CPoWHasher::FreeArgon2Memory()
+{
+    if (!pArgon2Memory)
+        return;
+#if !defined(WIN32) && defined(MAP_HUGETLB)
+    if (fArgon2Mapped)
+        munmap(pArgon2Memory, nArgon2Size);
+    else
+#endif
+        free(pArgon2Memory);
+    pArgon2Memory = NULL;
+    nArgon2Size = 0;
+    fArgon2Mapped = false;
+}
+
+unsigned char *CPoWHasher::GetArgon2Memory(size_t nSize)
+{
+    if (pArgon2Memory && nArgon2Size >= nSize)
+        return pArgon2Memory;
+
+    FreeArgon2Memory();
+#if !defined(WIN32) && defined(MAP_HUGETLB)
+    void *p = mmap(0, nSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        pArgon2Memory = (unsigned char*)p;
+        fArgon2Mapped = true;
+    }
+#endif
+    if (!pArgon2Memory)
+        pArgon2Memory = (unsigned char*)malloc(nSize);
+    if (pArgon2Memory)
+        nArgon2Size = nSize;
+    return pArgon2Memory;
+}
+
+CHashX17& CPoWHasher::X17()
+{
+    if (!pX17)
+        pX17 = new CHashX17();
+    return *pX17;
+}
+
+// argon2 hands the allocator no user data, so route through the thread's context
+static int AllocateArgon2Memory(uint8_t **memory, size_t bytes_to_allocate)
+{
+    *memory = CPoWHasher::ForThread().GetArgon2Memory(bytes_to_allocate);
+    return *memory ? ARGON2_OK : ARGON2_MEMORY_ALLOCATION_ERROR;
+}
+
+static void KeepArgon2Memory(uint8_t *memory, size_t bytes_to_allocate)
+{
+}
+
+void CPoWHasher::HashArgon2(const char *input, char *output)
+{
+    // Same parameters as argon2d_hash_raw(1,4096,1,input,80,input,80,output,32)
+    argon2_context context;
+    context.out = (uint8_t*)output;
+    context.outlen = 32;
+    context.pwd = (uint8_t*)input;
+    context.pwdlen = 80;
+    context.salt = (uint8_t*)input;
+    context.saltlen = 80;
+    context.secret = NULL;
+    context.secretlen = 0;
+    context.ad = NULL;
+    context.adlen = 0;
+    context.t_cost = 1;
+    context.m_cost = 4096;
+    context.lanes = 1;
+    context.threads = 1;
+    context.allocate_cbk = AllocateArgon2Memory;
+    context.free_cbk = KeepArgon2Memory;
+    context.flags = ARGON2_DEFAULT_FLAGS;
+    context.version = ARGON2_VERSION_NUMBER;
+
+    argon2_ctx(&context, Argon2_d);
+}
+
+void CPoWHasher::HashCryptonight(const char *input, char *output, int len)
+{
+    // slow-hash.c allocates its huge page scratchpad on first use per thread
+    // and keeps it until slow_hash_free_state(), which ~CPoWHasher calls.
+    cn_slow_hash((const void*)input,len,(char*)output,1,0);
+}
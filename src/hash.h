@@ -210,4 +210,45 @@ void hash_cryptonight(const char * input, char * output, int len);
 void hash_yescrypt(const char * input, char * output);
 void hash_easy(const char * input, char * output); //special hash for testing
 
+class CHashX17;
+
+/** Per-thread scratch memory for the memory-hard proof of work hashes.
+ *
+ * Argon2d needs a 4MB work area and CryptoNight a 2MB scratchpad for every
+ * hash. Rather than allocating and releasing them on each call, every thread
+ * that hashes (validation, the miner threads, RPC) keeps one context whose
+ * buffers are allocated on first use, backed by huge pages where the OS
+ * allows it, and released when the thread exits. The thread's X17 hasher
+ * lives here too.
+ */
+class CPoWHasher
+{
+private:
+    unsigned char *pArgon2Memory;
+    size_t nArgon2Size;
+    bool fArgon2Mapped;
+    CHashX17 *pX17;
+
+    CPoWHasher(const CPoWHasher&);
+    CPoWHasher& operator=(const CPoWHasher&);
+
+    void FreeArgon2Memory();
+
+public:
+    CPoWHasher();
+    ~CPoWHasher();
+
+    /** The context of the calling thread, created on first use. */
+    static CPoWHasher& ForThread();
+
+    /** Scratch area of at least nSize bytes, kept for the next call. */
+    unsigned char *GetArgon2Memory(size_t nSize);
+
+    /** X17 hasher of this thread, for single or batched hashes. */
+    CHashX17& X17();
+
+    void HashArgon2(const char *input, char *output);
+    void HashCryptonight(const char *input, char *output, int len);
+};
+
 #endif
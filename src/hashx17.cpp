@@ -0,0 +1,166 @@
+// Copyright (c) 2014 Project Bitmark
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hashx17.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__))
+#define ENABLE_X17_AVX2
+#include <cpuid.h>
+namespace x17_avx2
+{
+void Blake512_4way(unsigned char* out, const unsigned char* in, size_t len);
+void Keccak512_4way(unsigned char* out, const unsigned char* in);
+void Skein512_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+namespace
+{
+
+typedef void (*StageUpdate)(void*, const void*, size_t);
+typedef void (*StageClose)(void*, void*);
+
+/** Hash the 64-byte chain value of each lane in place, from a fresh context */
+template<typename Context>
+inline void Stage(Context& ctx, const Context& init, StageUpdate update, StageClose close, unsigned char* chain, size_t nLanes)
+{
+    for (size_t i = 0; i < nLanes; i++) {
+        ctx = init;
+        update(&ctx, chain + 64 * i, 64);
+        close(&ctx, chain + 64 * i);
+    }
+}
+
+bool DetectAVX2()
+{
+#if defined(ENABLE_X17_AVX2)
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    // OSXSAVE and AVX, then AVX2 itself, and the OS saving the YMM registers
+    if (!((ecx >> 27) & 1) || !((ecx >> 28) & 1) || __get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (!((ebx >> 5) & 1))
+        return false;
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    return (xcr0_lo & 6) == 6;
+#else
+    return false;
+#endif
+}
+
+} // namespace
+
+CHashX17::Contexts::Contexts()
+{
+    sph_blake512_init(&blake);
+    sph_bmw512_init(&bmw);
+    sph_groestl512_init(&groestl);
+    sph_jh512_init(&jh);
+    sph_keccak512_init(&keccak);
+    sph_skein512_init(&skein);
+    sph_luffa512_init(&luffa);
+    sph_cubehash512_init(&cubehash);
+    sph_shavite512_init(&shavite);
+    sph_simd512_init(&simd);
+    sph_echo512_init(&echo);
+    sph_hamsi512_init(&hamsi);
+    sph_fugue512_init(&fugue);
+    sph_shabal512_init(&shabal);
+    sph_whirlpool_init(&whirlpool);
+    sph_sha512_init(&sha2);
+    sph_haval256_5_init(&haval);
+}
+
+const size_t CHashX17::LANES;
+
+const CHashX17::Contexts& CHashX17::Initial()
+{
+    static const Contexts init;
+    return init;
+}
+
+bool CHashX17::IsVectorized()
+{
+    static const bool fAVX2 = DetectAVX2();
+    return fAVX2;
+}
+
+CHashX17::CHashX17() : ctx(Initial())
+{
+}
+
+void CHashX17::HashLanes(const unsigned char* data, size_t len, size_t nLanes, bool fVector)
+{
+    const Contexts& init = Initial();
+    unsigned char* chain = vchChain;
+
+#if defined(ENABLE_X17_AVX2)
+    // The vector BLAKE takes single-block messages, which headers are
+    if (fVector && len <= 111)
+        x17_avx2::Blake512_4way(chain, data, len);
+    else
+#endif
+    {
+        for (size_t i = 0; i < nLanes; i++) {
+            ctx.blake = init.blake;
+            sph_blake512(&ctx.blake, data + len * i, len);
+            sph_blake512_close(&ctx.blake, chain + 64 * i);
+        }
+    }
+
+    Stage(ctx.bmw, init.bmw, sph_bmw512, sph_bmw512_close, chain, nLanes);
+    Stage(ctx.groestl, init.groestl, sph_groestl512, sph_groestl512_close, chain, nLanes);
+#if defined(ENABLE_X17_AVX2)
+    if (fVector)
+        x17_avx2::Skein512_4way(chain, chain);
+    else
+#endif
+        Stage(ctx.skein, init.skein, sph_skein512, sph_skein512_close, chain, nLanes);
+    Stage(ctx.jh, init.jh, sph_jh512, sph_jh512_close, chain, nLanes);
+#if defined(ENABLE_X17_AVX2)
+    if (fVector)
+        x17_avx2::Keccak512_4way(chain, chain);
+    else
+#endif
+        Stage(ctx.keccak, init.keccak, sph_keccak512, sph_keccak512_close, chain, nLanes);
+    Stage(ctx.luffa, init.luffa, sph_luffa512, sph_luffa512_close, chain, nLanes);
+    Stage(ctx.cubehash, init.cubehash, sph_cubehash512, sph_cubehash512_close, chain, nLanes);
+    Stage(ctx.shavite, init.shavite, sph_shavite512, sph_shavite512_close, chain, nLanes);
+    Stage(ctx.simd, init.simd, sph_simd512, sph_simd512_close, chain, nLanes);
+    Stage(ctx.echo, init.echo, sph_echo512, sph_echo512_close, chain, nLanes);
+    Stage(ctx.hamsi, init.hamsi, sph_hamsi512, sph_hamsi512_close, chain, nLanes);
+    Stage(ctx.fugue, init.fugue, sph_fugue512, sph_fugue512_close, chain, nLanes);
+    Stage(ctx.shabal, init.shabal, sph_shabal512, sph_shabal512_close, chain, nLanes);
+    Stage(ctx.whirlpool, init.whirlpool, sph_whirlpool, sph_whirlpool_close, chain, nLanes);
+    Stage(ctx.sha2, init.sha2, sph_sha512, sph_sha512_close, chain, nLanes);
+    // HAVAL-256 leaves the 32 bytes of the final hash at the start of each lane
+    Stage(ctx.haval, init.haval, sph_haval256_5, sph_haval256_5_close, chain, nLanes);
+}
+
+uint256 CHashX17::Hash(const void* data, size_t len)
+{
+    HashLanes((const unsigned char*)data, len, 1, false);
+    uint256 hash;
+    memcpy(hash.begin(), vchChain, 32);
+    return hash;
+}
+
+void CHashX17::HashMany(uint256* out, const unsigned char* data, size_t len, size_t n)
+{
+    while (n) {
+        size_t nLanes = std::min(n, LANES);
+        HashLanes(data, len, nLanes, nLanes == LANES && IsVectorized());
+        for (size_t i = 0; i < nLanes; i++)
+            memcpy(out[i].begin(), vchChain + 64 * i, 32);
+        out += nLanes;
+        data += len * nLanes;
+        n -= nLanes;
+    }
+}
@@ -20,167 +20,64 @@
 #include "sph_sha2.h"
 #include "sph_haval.h"
 
-#ifndef QT_NO_DEBUG
-#include <string>
-#endif
-
-#ifdef GLOBALDEFINED
-#define GLOBAL
-#else
-#define GLOBAL extern
-#endif
-
-GLOBAL sph_blake512_context     z_blake;
-GLOBAL sph_bmw512_context       z_bmw;
-GLOBAL sph_groestl512_context   z_groestl;
-GLOBAL sph_jh512_context        z_jh;
-GLOBAL sph_keccak512_context    z_keccak;
-GLOBAL sph_skein512_context     z_skein;
-GLOBAL sph_luffa512_context     z_luffa;
-GLOBAL sph_cubehash512_context  z_cubehash;
-GLOBAL sph_shavite512_context   z_shavite;
-GLOBAL sph_simd512_context      z_simd;
-GLOBAL sph_echo512_context      z_echo;
-GLOBAL sph_hamsi512_context     z_hamsi;
-GLOBAL sph_fugue512_context     z_fugue;
-GLOBAL sph_shabal512_context    z_shabal;
-GLOBAL sph_whirlpool_context    z_whirlpool;
-GLOBAL sph_sha512_context       z_sha2;
-GLOBAL sph_haval256_5_context   z_haval;
-#define fillz() do { \
-    sph_blake512_init(&z_blake); \
-    sph_bmw512_init(&z_bmw); \
-    sph_groestl512_init(&z_groestl); \
-    sph_jh512_init(&z_jh); \
-    sph_keccak512_init(&z_keccak); \
-    sph_skein512_init(&z_skein); \
-    sph_luffa512_init(&z_luffa); \
-    sph_cubehash512_init(&z_cubehash); \
-    sph_shavite512_init(&z_shavite); \
-    sph_simd512_init(&z_simd); \
-    sph_echo512_init(&z_echo); \
-    sph_hamsi512_init(&z_hamsi); \
-    sph_fugue512_init(&z_fugue); \
-    sph_shabal512_init(&z_shabal); \
-    sph_whirlpool_init(&z_whirlpool); \
-    sph_sha512_init(&z_sha2); \
-    sph_haval256_5_init(&z_haval); \
-} while (0) 
-
-
-#define ZBLAKE (memcpy(&ctx_blake, &z_blake, sizeof(z_blake)))
-#define ZBMW (memcpy(&ctx_bmw, &z_bmw, sizeof(z_bmw)))
-#define ZGROESTL (memcpy(&ctx_groestl, &z_groestl, sizeof(z_groestl)))
-#define ZJH (memcpy(&ctx_jh, &z_jh, sizeof(z_jh)))
-#define ZKECCAK (memcpy(&ctx_keccak, &z_keccak, sizeof(z_keccak)))
-#define ZSKEIN (memcpy(&ctx_skein, &z_skein, sizeof(z_skein)))
-#define ZHAMSI (memcpy(&ctx_hamsi, &z_hamsi, sizeof(z_hamsi)))
-#define ZFUGUE (memcpy(&ctx_fugue, &z_fugue, sizeof(z_fugue)))
-#define ZSHABAL (memcpy(&ctx_shabal, &z_shabal, sizeof(z_shabal)))
-#define ZWHIRLPOOL (memcpy(&ctx_whirlpool, &z_whirlpool, sizeof(z_whirlpool)))
-#define ZSHA2 (memcpy(&ctx_sha2, &z_sha2, sizeof(z_sha2)))
-#define ZHAVAL (memcpy(&ctx_haval, &z_haval, sizeof(z_haval)))
-template<typename T1>
-inline uint256 HashX17(const T1 pbegin, const T1 pend)
+/** The X17 chain of seventeen 512-bit hashes, truncated to 256 bits.
+ *
+ * Each object has its own sph contexts and chain buffer, so it can be used
+ * from any number of threads at once (one object per thread) and hashing
+ * does not allocate. Every stage starts from an initial context computed
+ * once per process rather than running the sph init function again.
+ *
+ * HashMany() takes up to LANES equal-length inputs through each stage
+ * together. Where the CPU has AVX2, the BLAKE, Keccak and Skein stages then
+ * hash all the lanes in one vector pass; the other stages go through the
+ * lanes one by one while their tables are hot.
+ */
+class CHashX17
 {
-    sph_blake512_context      ctx_blake;
-    sph_bmw512_context        ctx_bmw;
-    sph_groestl512_context    ctx_groestl;
-    sph_jh512_context         ctx_jh;
-    sph_keccak512_context     ctx_keccak;
-    sph_skein512_context      ctx_skein;
-    sph_luffa512_context      ctx_luffa;
-    sph_cubehash512_context   ctx_cubehash;
-    sph_shavite512_context    ctx_shavite;
-    sph_simd512_context       ctx_simd;
-    sph_echo512_context       ctx_echo;
-    sph_hamsi512_context      ctx_hamsi;
-    sph_fugue512_context      ctx_fugue;
-    sph_shabal512_context     ctx_shabal;
-    sph_whirlpool_context     ctx_whirlpool;
-    sph_sha512_context        ctx_sha2;
-    sph_haval256_5_context    ctx_haval;
-static unsigned char pblank[1];
-
-#ifndef QT_NO_DEBUG
-    //std::string strhash;
-    //strhash = "";
-#endif
-    
-    uint512 hash[17];
-
-    //printf("pend-begin*(size) = %ld\n",(pend - pbegin) * sizeof(pbegin[0]));
-
-    sph_blake512_init(&ctx_blake);
-    sph_blake512 (&ctx_blake, (pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0])), (pend - pbegin) * sizeof(pbegin[0]));
-    sph_blake512_close(&ctx_blake, static_cast<void*>(&hash[0]));
-    
-    sph_bmw512_init(&ctx_bmw);
-    sph_bmw512 (&ctx_bmw, static_cast<const void*>(&hash[0]), 64);
-    sph_bmw512_close(&ctx_bmw, static_cast<void*>(&hash[1]));
-
-    sph_groestl512_init(&ctx_groestl);
-    sph_groestl512 (&ctx_groestl, static_cast<const void*>(&hash[1]), 64);
-    sph_groestl512_close(&ctx_groestl, static_cast<void*>(&hash[2]));
-
-    sph_skein512_init(&ctx_skein);
-    sph_skein512 (&ctx_skein, static_cast<const void*>(&hash[2]), 64);
-    sph_skein512_close(&ctx_skein, static_cast<void*>(&hash[3]));
-    
-    sph_jh512_init(&ctx_jh);
-    sph_jh512 (&ctx_jh, static_cast<const void*>(&hash[3]), 64);
-    sph_jh512_close(&ctx_jh, static_cast<void*>(&hash[4]));
-    
-    sph_keccak512_init(&ctx_keccak);
-    sph_keccak512 (&ctx_keccak, static_cast<const void*>(&hash[4]), 64);
-    sph_keccak512_close(&ctx_keccak, static_cast<void*>(&hash[5]));
-
-    sph_luffa512_init(&ctx_luffa);
-    sph_luffa512 (&ctx_luffa, static_cast<void*>(&hash[5]), 64);
-    sph_luffa512_close(&ctx_luffa, static_cast<void*>(&hash[6]));
-    
-    sph_cubehash512_init(&ctx_cubehash);
-    sph_cubehash512 (&ctx_cubehash, static_cast<const void*>(&hash[6]), 64);
-    sph_cubehash512_close(&ctx_cubehash, static_cast<void*>(&hash[7]));
-    
-    sph_shavite512_init(&ctx_shavite);
-    sph_shavite512(&ctx_shavite, static_cast<const void*>(&hash[7]), 64);
-    sph_shavite512_close(&ctx_shavite, static_cast<void*>(&hash[8]));
-        
-    sph_simd512_init(&ctx_simd);
-    sph_simd512 (&ctx_simd, static_cast<const void*>(&hash[8]), 64);
-    sph_simd512_close(&ctx_simd, static_cast<void*>(&hash[9]));
-
-    sph_echo512_init(&ctx_echo);
-    sph_echo512 (&ctx_echo, static_cast<const void*>(&hash[9]), 64);
-    sph_echo512_close(&ctx_echo, static_cast<void*>(&hash[10]));
-
-    sph_hamsi512_init(&ctx_hamsi);
-    sph_hamsi512 (&ctx_hamsi, static_cast<const void*>(&hash[10]), 64);
-    sph_hamsi512_close(&ctx_hamsi, static_cast<void*>(&hash[11]));
-
-    sph_fugue512_init(&ctx_fugue);
-    sph_fugue512 (&ctx_fugue, static_cast<const void*>(&hash[11]), 64);
-    sph_fugue512_close(&ctx_fugue, static_cast<void*>(&hash[12]));
-
-    sph_shabal512_init(&ctx_shabal);
-    sph_shabal512 (&ctx_shabal, static_cast<const void*>(&hash[12]), 64);
-    sph_shabal512_close(&ctx_shabal, static_cast<void*>(&hash[13]));
-
-    sph_whirlpool_init(&ctx_whirlpool);
-    sph_whirlpool (&ctx_whirlpool, static_cast<const void*>(&hash[13]), 64);
-    sph_whirlpool_close(&ctx_whirlpool, static_cast<void*>(&hash[14]));
-
-    sph_sha512_init(&ctx_sha2);
-    sph_sha512 (&ctx_sha2, static_cast<const void*>(&hash[14]), 64);
-    sph_sha512_close(&ctx_sha2, static_cast<void*>(&hash[15]));
-
-    sph_haval256_5_init(&ctx_haval);
-    sph_haval256_5 (&ctx_haval, static_cast<const void*>(&hash[15]), 64);
-    sph_haval256_5_close(&ctx_haval, static_cast<void*>(&hash[16]));
-
-
-    return hash[16].trim256();
-}
+public:
+    /** Inputs hashed together by HashMany() */
+    static const size_t LANES = 4;
+
+    CHashX17();
+
+    uint256 Hash(const void* data, size_t len);
+    /** Hash n inputs of len bytes each, stored back to back, into out[0..n-1] */
+    void HashMany(uint256* out, const unsigned char* data, size_t len, size_t n);
+
+    /** Whether the AVX2 stages are in use */
+    static bool IsVectorized();
+
+private:
+    struct Contexts
+    {
+        sph_blake512_context     blake;
+        sph_bmw512_context       bmw;
+        sph_groestl512_context   groestl;
+        sph_jh512_context        jh;
+        sph_keccak512_context    keccak;
+        sph_skein512_context     skein;
+        sph_luffa512_context     luffa;
+        sph_cubehash512_context  cubehash;
+        sph_shavite512_context   shavite;
+        sph_simd512_context      simd;
+        sph_echo512_context      echo;
+        sph_hamsi512_context     hamsi;
+        sph_fugue512_context     fugue;
+        sph_shabal512_context    shabal;
+        sph_whirlpool_context    whirlpool;
+        sph_sha512_context       sha2;
+        sph_haval256_5_context   haval;
+
+        Contexts();
+    };
+
+    Contexts ctx;
+    /** The 64-byte chain value of each lane; every stage hashes it in place */
+    unsigned char vchChain[LANES * 64];
+
+    static const Contexts& Initial();
+
+    void HashLanes(const unsigned char* data, size_t len, size_t nLanes, bool fVector);
+};
 
 #endif // HASHX17_H
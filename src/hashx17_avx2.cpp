@@ -0,0 +1,322 @@
+// Copyright (c) 2014 Project Bitmark
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 4-way AVX2 versions of the X17 stages built on 64-bit words (BLAKE-512,
+// Keccak-512 and Skein-512-512), one message per 64-bit lane. They only take
+// the short single-block messages the X17 chain produces, and give the same
+// output as the sph implementations. Built with a per-function target
+// attribute; CHashX17 only calls them once it has checked the CPU.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__))
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#define X17_TARGET __attribute__((target("avx2")))
+
+namespace x17_avx2 {
+namespace {
+
+typedef __m256i V;
+
+X17_TARGET inline V K(uint64_t x) { return _mm256_set1_epi64x(x); }
+X17_TARGET inline V Add(V x, V y) { return _mm256_add_epi64(x, y); }
+X17_TARGET inline V Xor(V x, V y) { return _mm256_xor_si256(x, y); }
+X17_TARGET inline V AndNot(V x, V y) { return _mm256_andnot_si256(x, y); }
+X17_TARGET inline V RotL(V x, int n) { return _mm256_or_si256(_mm256_slli_epi64(x, n), _mm256_srli_epi64(x, 64 - n)); }
+X17_TARGET inline V RotR(V x, int n) { return _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n)); }
+
+inline uint64_t ReadLE64(const unsigned char* p) { uint64_t x; memcpy(&x, p, 8); return x; }
+inline uint64_t ReadBE64(const unsigned char* p) { return __builtin_bswap64(ReadLE64(p)); }
+inline void WriteLE64(unsigned char* p, uint64_t x) { memcpy(p, &x, 8); }
+inline void WriteBE64(unsigned char* p, uint64_t x) { WriteLE64(p, __builtin_bswap64(x)); }
+
+/** Word i of each of the 4 lanes, as read by read from lane j's data at p + j*stride */
+template<uint64_t (*read)(const unsigned char*)>
+X17_TARGET inline V Gather(const unsigned char* p, size_t stride, size_t i)
+{
+    return _mm256_set_epi64x(read(p + 3 * stride + 8 * i), read(p + 2 * stride + 8 * i),
+                             read(p + stride + 8 * i), read(p + 8 * i));
+}
+
+template<void (*write)(unsigned char*, uint64_t)>
+X17_TARGET inline void Scatter(unsigned char* p, size_t i, V x)
+{
+    alignas(32) uint64_t v[4];
+    _mm256_store_si256((V*)v, x);
+    for (int j = 0; j < 4; j++)
+        write(p + 64 * j + 8 * i, v[j]);
+}
+
+//
+// BLAKE-512
+//
+
+const uint64_t BLAKE_IV[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL, 0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL
+};
+
+const uint64_t BLAKE_C[16] = {
+    0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+    0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL, 0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+    0x9216D5D98979FB1BULL, 0xD1310BA698DFB5ACULL, 0x2FFD72DBD01ADFB7ULL, 0xB8E1AFED6A267E96ULL,
+    0xBA7C9045F12C7F99ULL, 0x24A19947B3916CF7ULL, 0x0801F2E2858EFC16ULL, 0x636920D871574E69ULL
+};
+
+const unsigned char BLAKE_SIGMA[10][16] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    {14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3},
+    {11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4},
+    { 7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8},
+    { 9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13},
+    { 2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9},
+    {12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11},
+    {13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10},
+    { 6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5},
+    {10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0}
+};
+
+X17_TARGET inline void BlakeG(const V* m, const unsigned char* s, int i, V& a, V& b, V& c, V& d)
+{
+    a = Add(Add(a, b), Xor(m[s[2 * i]], K(BLAKE_C[s[2 * i + 1]])));
+    d = RotR(Xor(d, a), 32);
+    c = Add(c, d);
+    b = RotR(Xor(b, c), 25);
+    a = Add(Add(a, b), Xor(m[s[2 * i + 1]], K(BLAKE_C[s[2 * i]])));
+    d = RotR(Xor(d, a), 16);
+    c = Add(c, d);
+    b = RotR(Xor(b, c), 11);
+}
+
+//
+// Keccak-512
+//
+
+const uint64_t KECCAK_RC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL, 0x8000000080008000ULL,
+    0x000000000000808BULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008AULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800AULL, 0x800000008000000AULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
+};
+
+/** One round of Keccak-f[1600]: theta, then rho and pi into b, then chi and iota */
+X17_TARGET inline void KeccakRound(V* st, uint64_t rc)
+{
+    V c0 = Xor(Xor(Xor(st[0], st[5]), Xor(st[10], st[15])), st[20]);
+    V c1 = Xor(Xor(Xor(st[1], st[6]), Xor(st[11], st[16])), st[21]);
+    V c2 = Xor(Xor(Xor(st[2], st[7]), Xor(st[12], st[17])), st[22]);
+    V c3 = Xor(Xor(Xor(st[3], st[8]), Xor(st[13], st[18])), st[23]);
+    V c4 = Xor(Xor(Xor(st[4], st[9]), Xor(st[14], st[19])), st[24]);
+    V d0 = Xor(c4, RotL(c1, 1));
+    V d1 = Xor(c0, RotL(c2, 1));
+    V d2 = Xor(c1, RotL(c3, 1));
+    V d3 = Xor(c2, RotL(c4, 1));
+    V d4 = Xor(c3, RotL(c0, 1));
+
+    V b0 = Xor(st[0], d0);
+    V b1 = RotL(Xor(st[6], d1), 44);
+    V b2 = RotL(Xor(st[12], d2), 43);
+    V b3 = RotL(Xor(st[18], d3), 21);
+    V b4 = RotL(Xor(st[24], d4), 14);
+    V b5 = RotL(Xor(st[3], d3), 28);
+    V b6 = RotL(Xor(st[9], d4), 20);
+    V b7 = RotL(Xor(st[10], d0), 3);
+    V b8 = RotL(Xor(st[16], d1), 45);
+    V b9 = RotL(Xor(st[22], d2), 61);
+    V b10 = RotL(Xor(st[1], d1), 1);
+    V b11 = RotL(Xor(st[7], d2), 6);
+    V b12 = RotL(Xor(st[13], d3), 25);
+    V b13 = RotL(Xor(st[19], d4), 8);
+    V b14 = RotL(Xor(st[20], d0), 18);
+    V b15 = RotL(Xor(st[4], d4), 27);
+    V b16 = RotL(Xor(st[5], d0), 36);
+    V b17 = RotL(Xor(st[11], d1), 10);
+    V b18 = RotL(Xor(st[17], d2), 15);
+    V b19 = RotL(Xor(st[23], d3), 56);
+    V b20 = RotL(Xor(st[2], d2), 62);
+    V b21 = RotL(Xor(st[8], d3), 55);
+    V b22 = RotL(Xor(st[14], d4), 39);
+    V b23 = RotL(Xor(st[15], d0), 41);
+    V b24 = RotL(Xor(st[21], d1), 2);
+
+    st[0] = Xor(b0, AndNot(b1, b2));
+    st[1] = Xor(b1, AndNot(b2, b3));
+    st[2] = Xor(b2, AndNot(b3, b4));
+    st[3] = Xor(b3, AndNot(b4, b0));
+    st[4] = Xor(b4, AndNot(b0, b1));
+    st[5] = Xor(b5, AndNot(b6, b7));
+    st[6] = Xor(b6, AndNot(b7, b8));
+    st[7] = Xor(b7, AndNot(b8, b9));
+    st[8] = Xor(b8, AndNot(b9, b5));
+    st[9] = Xor(b9, AndNot(b5, b6));
+    st[10] = Xor(b10, AndNot(b11, b12));
+    st[11] = Xor(b11, AndNot(b12, b13));
+    st[12] = Xor(b12, AndNot(b13, b14));
+    st[13] = Xor(b13, AndNot(b14, b10));
+    st[14] = Xor(b14, AndNot(b10, b11));
+    st[15] = Xor(b15, AndNot(b16, b17));
+    st[16] = Xor(b16, AndNot(b17, b18));
+    st[17] = Xor(b17, AndNot(b18, b19));
+    st[18] = Xor(b18, AndNot(b19, b15));
+    st[19] = Xor(b19, AndNot(b15, b16));
+    st[20] = Xor(b20, AndNot(b21, b22));
+    st[21] = Xor(b21, AndNot(b22, b23));
+    st[22] = Xor(b22, AndNot(b23, b24));
+    st[23] = Xor(b23, AndNot(b24, b20));
+    st[24] = Xor(b24, AndNot(b20, b21));
+    st[0] = Xor(st[0], K(rc));
+}
+
+X17_TARGET void KeccakF(V* st)
+{
+    for (int round = 0; round < 24; round++)
+        KeccakRound(st, KECCAK_RC[round]);
+}
+
+//
+// Skein-512-512
+//
+
+const uint64_t SKEIN_IV[8] = {
+    0x4903ADFF749C51CEULL, 0x0D95DE399746DF03ULL, 0x8FD1934127C79BCEULL, 0x9A255629FF352CB1ULL,
+    0x5DB62599DF6CA7B0ULL, 0xEABE394CA9D5C3F4ULL, 0x991112C71A75B523ULL, 0xAE18A40B660FCC33ULL
+};
+
+X17_TARGET inline void SkeinMix(V& x0, V& x1, int rc)
+{
+    x0 = Add(x0, x1);
+    x1 = Xor(RotL(x1, rc), x0);
+}
+
+X17_TARGET inline void SkeinMix8(V* p, int i0, int i1, int i2, int i3, int i4, int i5, int i6, int i7, int r0, int r1, int r2, int r3)
+{
+    SkeinMix(p[i0], p[i1], r0);
+    SkeinMix(p[i2], p[i3], r1);
+    SkeinMix(p[i4], p[i5], r2);
+    SkeinMix(p[i6], p[i7], r3);
+}
+
+X17_TARGET inline void SkeinAddKey(V* p, const V* k, const uint64_t* t, int s)
+{
+    for (int i = 0; i < 5; i++)
+        p[i] = Add(p[i], k[(s + i) % 9]);
+    p[5] = Add(p[5], Add(k[(s + 5) % 9], K(t[s % 3])));
+    p[6] = Add(p[6], Add(k[(s + 6) % 9], K(t[(s + 1) % 3])));
+    p[7] = Add(p[7], Add(k[(s + 7) % 9], K((uint64_t)s)));
+}
+
+/** One UBI block: h = Threefish-512(key h, tweak t0/t1, m) ^ m */
+X17_TARGET void SkeinUBI(V* h, const V* m, uint64_t t0, uint64_t t1)
+{
+    V k[9], p[8];
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+    k[8] = K(0x1BD11BDAA9FC1A22ULL);
+    for (int i = 0; i < 8; i++) {
+        k[i] = h[i];
+        k[8] = Xor(k[8], h[i]);
+        p[i] = m[i];
+    }
+    for (int s = 0; s < 18; s += 2) {
+        SkeinAddKey(p, k, t, s);
+        SkeinMix8(p, 0, 1, 2, 3, 4, 5, 6, 7, 46, 36, 19, 37);
+        SkeinMix8(p, 2, 1, 4, 7, 6, 5, 0, 3, 33, 27, 14, 42);
+        SkeinMix8(p, 4, 1, 6, 3, 0, 5, 2, 7, 17, 49, 36, 39);
+        SkeinMix8(p, 6, 1, 0, 7, 2, 5, 4, 3, 44,  9, 54, 56);
+        SkeinAddKey(p, k, t, s + 1);
+        SkeinMix8(p, 0, 1, 2, 3, 4, 5, 6, 7, 39, 30, 34, 24);
+        SkeinMix8(p, 2, 1, 4, 7, 6, 5, 0, 3, 13, 50, 10, 17);
+        SkeinMix8(p, 4, 1, 6, 3, 0, 5, 2, 7, 25, 29, 39, 43);
+        SkeinMix8(p, 6, 1, 0, 7, 2, 5, 4, 3,  8, 35, 56, 22);
+    }
+    SkeinAddKey(p, k, t, 18);
+    for (int i = 0; i < 8; i++)
+        h[i] = Xor(m[i], p[i]);
+}
+
+} // namespace
+
+/** BLAKE-512 of four len-byte messages stored back to back at in, len <= 111
+ *  so the message and its padding fit one block. Writes 4*64 bytes to out.
+ */
+X17_TARGET void Blake512_4way(unsigned char* out, const unsigned char* in, size_t len)
+{
+    // Each lane's padded block: message, 0x80, zeros, a final 1 bit and the
+    // 128-bit big-endian bit length
+    alignas(32) unsigned char block[4][128];
+    for (int j = 0; j < 4; j++) {
+        memset(block[j], 0, 128);
+        memcpy(block[j], in + j * len, len);
+        block[j][len] = 0x80;
+        block[j][111] |= 0x01;
+        WriteBE64(block[j] + 120, (uint64_t)len << 3);
+    }
+    V m[16], v[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = Gather<ReadBE64>(block[0], 128, i);
+
+    const uint64_t t0 = (uint64_t)len << 3;
+    for (int i = 0; i < 8; i++)
+        v[i] = K(BLAKE_IV[i]);
+    for (int i = 0; i < 4; i++)
+        v[8 + i] = K(BLAKE_C[i]);
+    v[12] = K(t0 ^ BLAKE_C[4]);
+    v[13] = K(t0 ^ BLAKE_C[5]);
+    v[14] = K(BLAKE_C[6]);
+    v[15] = K(BLAKE_C[7]);
+
+    for (int r = 0; r < 16; r++) {
+        const unsigned char* s = BLAKE_SIGMA[r % 10];
+        BlakeG(m, s, 0, v[0], v[4], v[ 8], v[12]);
+        BlakeG(m, s, 1, v[1], v[5], v[ 9], v[13]);
+        BlakeG(m, s, 2, v[2], v[6], v[10], v[14]);
+        BlakeG(m, s, 3, v[3], v[7], v[11], v[15]);
+        BlakeG(m, s, 4, v[0], v[5], v[10], v[15]);
+        BlakeG(m, s, 5, v[1], v[6], v[11], v[12]);
+        BlakeG(m, s, 6, v[2], v[7], v[ 8], v[13]);
+        BlakeG(m, s, 7, v[3], v[4], v[ 9], v[14]);
+    }
+    for (int i = 0; i < 8; i++)
+        Scatter<WriteBE64>(out, i, Xor(K(BLAKE_IV[i]), Xor(v[i], v[i + 8])));
+}
+
+/** Keccak-512 of four 64-byte messages stored back to back at in. */
+X17_TARGET void Keccak512_4way(unsigned char* out, const unsigned char* in)
+{
+    V st[25];
+    for (int i = 0; i < 8; i++)
+        st[i] = Gather<ReadLE64>(in, 64, i);
+    // The message ends in the 72-byte rate block: Keccak padding 0x01 ... 0x80
+    st[8] = K(0x8000000000000001ULL);
+    for (int i = 9; i < 25; i++)
+        st[i] = _mm256_setzero_si256();
+    KeccakF(st);
+    for (int i = 0; i < 8; i++)
+        Scatter<WriteLE64>(out, i, st[i]);
+}
+
+/** Skein-512-512 of four 64-byte messages stored back to back at in. */
+X17_TARGET void Skein512_4way(unsigned char* out, const unsigned char* in)
+{
+    V h[8], m[8];
+    for (int i = 0; i < 8; i++) {
+        h[i] = K(SKEIN_IV[i]);
+        m[i] = Gather<ReadLE64>(in, 64, i);
+    }
+    // The message, as the first and final block of type 48
+    SkeinUBI(h, m, 64, 0xF000000000000000ULL);
+    // The output block: counter 0, as the first and final block of type 63
+    for (int i = 0; i < 8; i++)
+        m[i] = _mm256_setzero_si256();
+    SkeinUBI(h, m, 8, 0xFF00000000000000ULL);
+    for (int i = 0; i < 8; i++)
+        Scatter<WriteLE64>(out, i, h[i]);
+}
+
+} // namespace x17_avx2
+
+#endif
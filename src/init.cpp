@@ -11,15 +11,19 @@
 #include "init.h"
 
 #include "addrman.h"
+#include "argon2.h"
 #include "checkpoints.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
 #include "net.h"
 #include "rpcserver.h"
+#include "scrypt.h"
+#include "sha256.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
+#include "worknotify.h"
 #ifdef ENABLE_WALLET
 #include "db.h"
 #include "wallet.h"
@@ -212,6 +216,7 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
     strUsage += "  -pid=<file>            " + _("Specify pid file (default: bitmarkd.pid)") + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup") + "\n";
+    strUsage += "  -rebuildssf            " + _("Recompute the subsidy scaling factors stored in the block index") + " " + _("on startup") + "\n";
     strUsage += "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n";
 
     strUsage += "\n" + _("Connection options:") + "\n";
@@ -269,6 +274,8 @@ std::string HelpMessage(HelpMessageMode hmm)
         strUsage += "  -dropmessagestest=<n>  " + _("Randomly drop 1 of every <n> network messages") + "\n";
         strUsage += "  -fuzzmessagestest=<n>  " + _("Randomly fuzz 1 of every <n> network messages") + "\n";
         strUsage += "  -flushwallet           " + _("Run a thread to flush wallet periodically (default: 1)") + "\n";
+        strUsage += "  -verifyblockreads      " + _("Recheck proof of work of every block read from disk, including already validated ones. Without it, the auxpow of merge mined blocks read from disk is not verified again (default: 0)") + "\n";
+        strUsage += "  -mapblockfiles         " + _("Read finished block and undo files through memory mappings (default: 1, except on Windows)") + "\n";
     }
     strUsage += "  -debug=<category>      " + _("Output debugging information (default: 0, supplying <category> is optional)") + "\n";
     strUsage += "                         " + _("If <category> is not supplied, output all debugging information.") + "\n";
@@ -316,6 +323,7 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -rpcport=<port>        " + _("Listen for JSON-RPC connections on <port> (default: 9266 or testnet: 19266)") + "\n";
     strUsage += "  -rpcallowip=<ip>       " + _("Allow JSON-RPC connections from specified IP address") + "\n";
     strUsage += "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n";
+    strUsage += "  -worknotifysocket=<path> " + _("Announce new tips and block templates to miners on a Unix domain socket") + "\n";
 
     strUsage += "\n" + _("RPC SSL options: (see the Bitmark Wiki for SSL setup instructions)") + "\n";
     strUsage += "  -rpcssl                                  " + _("Use OpenSSL (https) for JSON-RPC connections") + "\n";
@@ -540,6 +548,8 @@ bool AppInit2(boost::thread_group& threadGroup)
         InitWarning(_("Warning: Deprecated argument -debugnet ignored, use -debug=net"));
 
     fBenchmark = GetBoolArg("-benchmark", false);
+    fVerifyBlockReads = GetBoolArg("-verifyblockreads", false);
+    fMapBlockFiles = GetBoolArg("-mapblockfiles", fMapBlockFiles);
     mempool.setSanityCheck(GetBoolArg("-checkmempool", RegTest()));
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
 
@@ -609,6 +619,11 @@ bool AppInit2(boost::thread_group& threadGroup)
     strWalletFile = GetArg("-wallet", "wallet.dat");
 #endif
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
+    std::string strSHA256Impl = SHA256AutoDetect();
+    std::string strScryptImpl = scrypt_detect();
+    std::string strArgon2Impl = argon2_select_impl(1);
+    // Argon2 only ever hashes public block headers here, there is nothing to wipe
+    FLAG_clear_internal_memory = 0;
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. Bitmark Core is shutting down."));
 
@@ -631,6 +646,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Bitmark version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using the '%s' SHA256 implementation\n", strSHA256Impl);
+    LogPrintf("Using the '%s' scrypt implementation\n", strScryptImpl);
+    LogPrintf("Using the '%s' Argon2 implementation\n", strArgon2Impl);
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -642,9 +660,11 @@ bool AppInit2(boost::thread_group& threadGroup)
     std::ostringstream strErrors;
 
     if (nScriptCheckThreads) {
-        LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        LogPrintf("Using %u threads for script and proof of work verification\n", nScriptCheckThreads);
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadPoWCheck);
+        }
     }
 
     int64_t nStart;
@@ -879,6 +899,14 @@ bool AppInit2(boost::thread_group& threadGroup)
                     break;
                 }
 
+                if (GetBoolArg("-rebuildssf", false)) {
+                    uiInterface.InitMessage(_("Rebuilding subsidy scaling factors..."));
+                    if (!RebuildSSF()) {
+                        strLoadError = _("Error rebuilding subsidy scaling factors");
+                        break;
+                    }
+                }
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
                 if (!VerifyDB(GetArg("-checklevel", 3),
                               GetArg("-checkblocks", 288))) {
@@ -933,7 +961,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -1116,6 +1144,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     InitRPCMining();
     if (fServer)
         StartRPCThreads();
+    std::string strWorkNotifyError;
+    if (!StartWorkNotify(threadGroup, strWorkNotifyError))
+        return InitError(strWorkNotifyError);
 
 #ifdef ENABLE_WALLET
     // Generate coins in the background
@@ -11,6 +11,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "hashx17.h"
 #include "init.h"
 #include "net.h"
 #include "txdb.h"
@@ -18,8 +19,11 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "pow.h"
+#include "sha256.h"
 #include "util.h"
 
+#include <deque>
+#include <list>
 #include <sstream>
 #include <inttypes.h>
 
@@ -27,6 +31,12 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 using namespace std;
 using namespace boost;
 
@@ -39,9 +49,12 @@ using namespace boost;
 //
 
 CTxMemPool mempool;
+CConditionVariable cvNewWork;
+static CWaitableCriticalSection csNewWork;
+static uint256 hashNewWorkTip = 0; // tip as of the last NotifyNewWork, protected by csNewWork
 
-map<uint256, CBlockIndex*> mapBlockIndex;
-CBlockIndex *pindexBestHeader = NULL;
+BlockMap mapBlockIndex;
+CBlockIndexArena blockIndexArena;
 CChain chainMostWork;
 CCoinsViewCache *pcoinsTip = NULL;
 int64_t nTimeBestReceived = 0;
@@ -50,6 +63,12 @@ bool fImporting = false;
 bool fReindex = false;
 bool fBenchmark = false;
 bool fTxIndex = false;
+bool fVerifyBlockReads = false;
+#ifndef WIN32
+bool fMapBlockFiles = true;
+#else
+bool fMapBlockFiles = false;
+#endif
 unsigned int nCoinCacheSize = 5000;
 static const int64_t v2checkpoint = 230000;
 
@@ -109,8 +128,6 @@ namespace {
 
     // Number of nodes with fSyncStarted.
     int nSyncStarted = 0;
-    // All pairs A->B, where A (or one if its ancestors) misses transactions, but B has transactions.
-    multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 
     CCriticalSection cs_LastBlockFile;
     CBlockFileInfo infoLastBlockFile;
@@ -404,7 +421,7 @@ CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
 CBlockIndex *CChain::FindFork(const CBlockLocator &locator) const {
     // Find the first block the caller has in the main chain
     BOOST_FOREACH(const uint256& hash, locator.vHave) {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -738,7 +755,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -928,8 +945,9 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         int64_t nValueOut = tx.GetValueOut();
         int64_t nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
+        unsigned int nSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, view);
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), nSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -978,6 +996,9 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         pool.addUnchecked(hash, entry);
     }
 
+    if (&pool == &mempool)
+        NotifyNewWork();
+
     g_signals.SyncTransaction(hash, tx, NULL);
 
     return true;
@@ -990,7 +1011,7 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(CBlockIndex* &pindexRet) const
     AssertLockHeld(cs_main);
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1128,43 +1149,119 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW)
 {
 
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (!filein) {
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
-    }
-
     // Read block
     try {
-        filein >> block;
+        boost::shared_ptr<CMappedBlockFile> pmap = MapBlockFile(pos, "blk");
+        if (pmap) {
+            CMappedFileStream filein(pmap, pos.nPos, SER_DISK, CLIENT_VERSION);
+            filein >> block;
+        } else {
+            // Open history file to read
+            CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (!filein) {
+                return error("ReadBlockFromDisk : OpenBlockFile failed");
+            }
+            filein >> block;
+        }
     }
     catch (std::exception &e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
 
     // Check the header
-    if (!CheckAuxPowProofOfWork(block, Params())) {
+    if (fCheckPOW && !CheckAuxPowProofOfWork(block, Params())) {
         return error("ReadBlockFromDisk : Errors in block header");
     }
 
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fCheckPOW)
 {
-  if (!ReadBlockFromDisk(block, pindex->GetBlockPos())) {
+    // The proof of work of a block that reached BLOCK_VALID_TRANSACTIONS was
+    // checked when it was accepted. The hash comparison below ties the header
+    // on disk to that entry, but GetHash() does not cover the auxpow of merge
+    // mined blocks, so a damaged auxpow on disk is only caught with
+    // -verifyblockreads.
+    if (fVerifyBlockReads || !pindex->IsProofOfWorkChecked())
+        fCheckPOW = true;
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), fCheckPOW)) {
         return false;
-  }
+    }
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
     return true;
 }
 
+// Read the message start and size prefix written by WriteBlockToDisk, then the block
+template<typename Stream>
+static bool ReadRawBlock(Stream& filein, std::vector<unsigned char>& vchBlock)
+{
+    MessageStartChars pchMessageStart;
+    unsigned int nSize;
+    filein >> FLATDATA(pchMessageStart) >> nSize;
+    if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) || nSize == 0 || nSize > MAX_SIZE)
+        return false;
+    vchBlock.resize(nSize);
+    filein.read((char*)&vchBlock[0], nSize);
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos)
+{
+    vchBlock.clear();
+
+    // The block is preceded by the message start and its size, as written by WriteBlockToDisk
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk : invalid position %d:%u", pos.nFile, pos.nPos);
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(unsigned int));
+    try {
+        boost::shared_ptr<CMappedBlockFile> pmap = MapBlockFile(posHeader, "blk");
+        if (pmap) {
+            CMappedFileStream filein(pmap, posHeader.nPos, SER_DISK, CLIENT_VERSION);
+            if (!ReadRawBlock(filein, vchBlock))
+                return error("ReadRawBlockFromDisk : no block at %d:%u", pos.nFile, pos.nPos);
+        } else {
+            CAutoFile filein = CAutoFile(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+            if (!filein) {
+                return error("ReadRawBlockFromDisk : OpenBlockFile failed");
+            }
+            if (!ReadRawBlock(filein, vchBlock))
+                return error("ReadRawBlockFromDisk : no block at %d:%u", pos.nFile, pos.nPos);
+        }
+    }
+    catch (std::exception &e) {
+        vchBlock.clear();
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex)
+{
+    if (!ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos()))
+        return false;
+
+    // Only the header is parsed, to tie the bytes on disk to the index entry
+    CPureBlockHeader header;
+    try {
+        CDataStream ss((const char*)&vchBlock[0], (const char*)&vchBlock[0] + vchBlock.size(), SER_DISK, CLIENT_VERSION);
+        ss >> header;
+    }
+    catch (std::exception &e) {
+        return error("%s : Deserialize error - %s", __func__, e.what());
+    }
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("ReadRawBlockFromDisk(std::vector<unsigned char>&, CBlockIndex*) : GetHash() doesn't match index");
+    return true;
+}
+
 uint256 static GetOrphanRoot(const uint256& hash)
 {
     map<uint256, COrphanBlock*>::iterator it = mapOrphanBlocks.find(hash);
@@ -1255,7 +1352,7 @@ int64_t GetBlockValue(CBlockIndex* pindex, int64_t nFees, bool noScale)
     CBigNum scalingFactor = CBigNum(0);
     if (onForkNow && !noScale) {
       scalingFactor = pindex->subsidyScalingFactor;
-      if (!scalingFactor.getuint()) { // find the key block and recalculate
+      if (!(pindex->nStatus & BLOCK_HAVE_SSF) && !scalingFactor.getuint()) { // find the key block and recalculate
 	CBlockIndex * pprev_algo = pindex;
 	do {
 	  if (update_ssf(pprev_algo->nVersion)) {
@@ -1401,6 +1498,7 @@ static const int64_t nTargetTimespan = 24*60*60; // one day
 static const int64_t nTargetSpacing = 2*60; // two minutes
 static const int64_t nInterval = nTargetTimespan / nTargetSpacing;
 static const int64_t DGWtimespan = 960; // 16 min for dark gravity wave
+static const int DGWpastblocks = 25; // same algo blocks averaged by dark gravity wave
 
 //
 // minimum amount of work that could possibly be required nTime after
@@ -1428,6 +1526,22 @@ unsigned int ComputeMinWork(unsigned int nBase, int64_t nTime)
     return bnResult.GetCompact();
 }
 
+/** What the DarkGravityWave walk collects below pindexLast for the retarget of one algo */
+struct CDGWWalk
+{
+  const CBlockIndex * BlockReading; // block the walk stopped at
+  int64_t nActualTimespan;
+  int64_t CountBlocks;
+  CBigNum PastDifficultyAverage;
+  CBigNum LastDifficultyAlgo;
+  int64_t time_since_last_algo;
+  int lastInRow;
+  int nInRow;
+  int pastInRow;
+};
+
+unsigned int static DarkGravityWaveRetarget(const CBlockIndex* pindexLast, int algo, const CDGWWalk& walk);
+
 unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, int algo) {
 
     /* current difficulty formula, DASH - DarkGravity v3, written by Evan Duffield - evan@dashpay.io */
@@ -1435,8 +1549,8 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, int algo) {
     const CBlockIndex *BlockReading = pindexLast;
     int64_t nActualTimespan = 0;
     int64_t LastBlockTime = 0;
-    int64_t PastBlocksMin = 25;
-    int64_t PastBlocksMax = 25; // We have same max and min, just using same variables from old code
+    int64_t PastBlocksMin = DGWpastblocks;
+    int64_t PastBlocksMax = DGWpastblocks; // We have same max and min, just using same variables from old code
     int64_t CountBlocks = 0;
     CBigNum PastDifficultyAverage;
     CBigNum PastDifficultyAveragePrev;
@@ -1538,7 +1652,34 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, int algo) {
       }
       if (!lastInRowDone) lastInRow += pastInRow;
     }
-    
+
+    CDGWWalk walk;
+    walk.BlockReading = BlockReading;
+    walk.nActualTimespan = nActualTimespan;
+    walk.CountBlocks = CountBlocks;
+    walk.PastDifficultyAverage = PastDifficultyAverage;
+    walk.LastDifficultyAlgo = LastDifficultyAlgo;
+    walk.time_since_last_algo = time_since_last_algo;
+    walk.lastInRow = lastInRow;
+    walk.nInRow = nInRow;
+    walk.pastInRow = pastInRow;
+    return DarkGravityWaveRetarget(pindexLast, algo, walk);
+}
+
+unsigned int static DarkGravityWaveRetarget(const CBlockIndex* pindexLast, int algo, const CDGWWalk& walk) {
+
+    const CBlockIndex *BlockReading = walk.BlockReading;
+    int64_t nActualTimespan = walk.nActualTimespan;
+    int64_t PastBlocksMin = DGWpastblocks;
+    int64_t CountBlocks = walk.CountBlocks;
+    CBigNum PastDifficultyAverage = walk.PastDifficultyAverage;
+    CBigNum LastDifficultyAlgo = walk.LastDifficultyAlgo;
+    int64_t time_since_last_algo = walk.time_since_last_algo;
+    unsigned int algoWeight = GetAlgoWeight(algo);
+    int lastInRow = walk.lastInRow;
+    int nInRow = walk.nInRow;
+    int pastInRow = walk.pastInRow;
+
     CBigNum bnNew;
     int lastInRowMod = lastInRow%9;
     if (fDebug) LogPrintf("nInRow = %d lastInRow=%d\n",nInRow,lastInRow);
@@ -1623,13 +1764,207 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, int algo) {
 }
 
 
+/** One block of the algo a CRetargetContext is kept for */
+struct CRetargetEntry
+{
+  const CBlockIndex * pindex;
+  int nHeight;
+  unsigned int nBits;
+  int64_t nMedianTimePast;
+  int nRunBelow; // consecutive blocks of the algo on the fork right below this one
+  bool fOnFork; // this block and the other algo blocks up to the next entry (or the tip) are on the fork
+};
+
+/** Last DGWpastblocks blocks of one algo below the chain tip, with the median time past
+ *  read once per block. The context follows the tip one block at a time, so the retarget
+ *  for getmininginfo, getblocktemplate, the miner and AcceptBlockHeader is a loop over
+ *  these entries instead of a walk through the blocks of every algo. Any other jump of
+ *  the tip rebuilds the entries with one walk.
+ */
+struct CRetargetContext
+{
+  const CBlockIndex * pindexLast; // tip the entries below are kept for
+  CRetargetEntry vEntries[DGWpastblocks];
+  int nFirst; // slot of the newest entry
+  int nCount;
+  bool fHaveBits;
+  unsigned int nBits; // next work required on top of pindexLast
+
+  CRetargetContext () {
+    SetNull();
+  }
+
+  void SetNull () {
+    pindexLast = 0;
+    nFirst = 0;
+    nCount = 0;
+    fHaveBits = false;
+    nBits = 0;
+  }
+
+  // k-th newest entry
+  const CRetargetEntry & Entry (int k) const {
+    return vEntries[(nFirst + k) % DGWpastblocks];
+  }
+
+  static CRetargetEntry MakeEntry (const CBlockIndex * pindex) {
+    CRetargetEntry entry;
+    entry.pindex = pindex;
+    entry.nHeight = pindex->nHeight;
+    entry.nBits = pindex->nBits;
+    entry.nMedianTimePast = pindex->GetMedianTimePast();
+    entry.nRunBelow = 0;
+    entry.fOnFork = pindex->onFork();
+    return entry;
+  }
+
+  // Run of same algo blocks below pindex, as DarkGravityWave counts it past its last block
+  static int CountRunBelow (const CBlockIndex * pindex, int algo) {
+    int nRun = 0;
+    for (const CBlockIndex * pindexPast = pindex->pprev; pindexPast; pindexPast = pindexPast->pprev) {
+      if (GetAlgo(pindexPast->nVersion)!=algo||!onFork(pindexPast))
+        break;
+      nRun++;
+    }
+    return nRun;
+  }
+
+  void Update (const CBlockIndex * pindexNew, int algo) {
+    fHaveBits = false;
+    if (pindexLast && pindexNew->pprev == pindexLast) {
+      pindexLast = pindexNew;
+      if (GetAlgo(pindexNew->nVersion) != algo) {
+        if (nCount) vEntries[nFirst].fOnFork &= pindexNew->onFork();
+        return;
+      }
+      CRetargetEntry entry = MakeEntry(pindexNew);
+      if (nCount && Entry(0).pindex == pindexNew->pprev && Entry(0).pindex->onFork())
+        entry.nRunBelow = Entry(0).nRunBelow + 1;
+      nFirst = (nFirst + DGWpastblocks - 1) % DGWpastblocks;
+      vEntries[nFirst] = entry;
+      if (nCount < DGWpastblocks) nCount++;
+      return;
+    }
+
+    // walk back as DarkGravityWave does, stopping at the first block off the fork
+    pindexLast = pindexNew;
+    nFirst = 0;
+    nCount = 0;
+    bool fOnFork = true;
+    for (const CBlockIndex * pindex = pindexNew; pindex && nCount < DGWpastblocks; pindex = pindex->pprev) {
+      fOnFork &= pindex->onFork();
+      if (GetAlgo(pindex->nVersion) == algo) {
+        vEntries[nCount] = MakeEntry(pindex);
+        vEntries[nCount].fOnFork = fOnFork;
+        nCount++;
+        fOnFork = true;
+      }
+      if (!pindex->onFork())
+        break;
+    }
+    if (!nCount)
+      return;
+    vEntries[nCount - 1].nRunBelow = CountRunBelow(vEntries[nCount - 1].pindex, algo);
+    for (int k = nCount - 2; k >= 0; k--) {
+      const CRetargetEntry & older = vEntries[k + 1];
+      if (older.pindex == vEntries[k].pindex->pprev && older.pindex->onFork())
+        vEntries[k].nRunBelow = older.nRunBelow + 1;
+    }
+  }
+
+  /* The DarkGravityWave walk over the entries. False if the walk would leave the fork or run
+     out of entries before DGWpastblocks blocks of the algo, DarkGravityWave handles those. */
+  bool Walk (CDGWWalk & walk) const {
+    if (nCount < DGWpastblocks || pindexLast->nHeight < DGWpastblocks)
+      return false;
+    for (int k = 0; k < nCount; k++) {
+      if (!Entry(k).fOnFork)
+        return false;
+    }
+    int64_t LastBlockTimeOtherAlgos = pindexLast->GetMedianTimePast();
+    if (!LastBlockTimeOtherAlgos)
+      return false; // DarkGravityWave would take it from a lower block
+    int64_t LastBlockTime = 0;
+    bool lastInRowDone = false;
+    bool nInRowDone = false;
+    CBigNum PastDifficultyAveragePrev;
+    walk.CountBlocks = 0;
+    walk.time_since_last_algo = -1;
+    walk.lastInRow = 0;
+    walk.nInRow = 0;
+    walk.pastInRow = 0;
+    for (int k = 0; k < DGWpastblocks; k++) {
+      const CRetargetEntry & entry = Entry(k);
+      if (k && Entry(k - 1).nHeight != entry.nHeight + 1) { // blocks of other algos in between
+        lastInRowDone = true;
+        if (walk.nInRow<9) {
+          walk.nInRow = 0;
+        }
+        else {
+          nInRowDone = true;
+        }
+      }
+      if (!walk.CountBlocks) walk.LastDifficultyAlgo.SetCompact(entry.nBits);
+
+      walk.CountBlocks++;
+      if (!nInRowDone) walk.nInRow++;
+      if (!lastInRowDone) walk.lastInRow++;
+
+      if (walk.CountBlocks == 1) {
+        walk.PastDifficultyAverage.SetCompact(entry.nBits);
+        if (LastBlockTimeOtherAlgos > 0) walk.time_since_last_algo = LastBlockTimeOtherAlgos - entry.nMedianTimePast;
+        LastBlockTime = entry.nMedianTimePast;
+      }
+      else { walk.PastDifficultyAverage = ((PastDifficultyAveragePrev * (walk.CountBlocks-1)) + (CBigNum().SetCompact(entry.nBits))) / walk.CountBlocks; }
+      PastDifficultyAveragePrev = walk.PastDifficultyAverage;
+    }
+    const CRetargetEntry & last = Entry(DGWpastblocks - 1);
+    walk.BlockReading = last.pindex;
+    walk.nActualTimespan = LastBlockTime > 0 ? LastBlockTime - last.nMedianTimePast : 0;
+    if ((walk.nInRow && !nInRowDone) || (walk.lastInRow && !lastInRowDone)) {
+      walk.pastInRow = last.nRunBelow;
+      if (!lastInRowDone) walk.lastInRow += walk.pastInRow;
+    }
+    return true;
+  }
+};
+
+static CCriticalSection cs_retarget;
+static CRetargetContext retargetContexts[NUM_ALGOS];
+
+void reset_retarget_contexts () {
+  LOCK(cs_retarget);
+  for (int algo=0; algo<NUM_ALGOS; algo++) {
+    retargetContexts[algo].SetNull();
+  }
+}
+
+static unsigned int GetRetargetDGW(const CBlockIndex* pindexLast, int algo)
+{
+  // only entries in mapBlockIndex stay alive and unchanged, template dummies are measured every time
+  if (!pindexLast->phashBlock || algo < 0 || algo >= NUM_ALGOS) {
+    return DarkGravityWave(pindexLast,algo);
+  }
+  LOCK(cs_retarget);
+  CRetargetContext & context = retargetContexts[algo];
+  if (context.pindexLast != pindexLast) {
+    context.Update(pindexLast,algo);
+  }
+  if (!context.fHaveBits) {
+    CDGWWalk walk;
+    context.nBits = context.Walk(walk) ? DarkGravityWaveRetarget(pindexLast,algo,walk) : DarkGravityWave(pindexLast,algo);
+    context.fHaveBits = true;
+  }
+  return context.nBits;
+}
+
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, int algo)
 {
   if (RegTest()) return Params().ProofOfWorkLimit().GetCompact();
     int nHeight = pindexLast->nHeight;
     int workAlgo = pindexLast->nHeight;
 
-    if (nHeight < nForkHeight-1 || !CBlockIndex::IsSuperMajority(4,pindexLast,75,100) || RegTest()) {
+    if (nHeight < nForkHeight-1 || !pindexLast->IsForkMajority() || RegTest()) {
       workAlgo = 0;
     } else {
       workAlgo = 1;
@@ -1701,7 +2036,7 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, int algo)
          return bnNew.GetCompact();
     } else {
       // Post 8mPoW fork
-      return DarkGravityWave(pindexLast,algo);
+      return GetRetargetDGW(pindexLast,algo);
     }
 }
 
@@ -1862,7 +2197,8 @@ void static InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state
     }
     if (!state.CorruptionPossible()) {
         pindex->nStatus |= BLOCK_FAILED_VALID;
-        pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex));
+        if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)))
+            AbortNode(_("Failed to write block index"));
         setBlockIndexValid.erase(pindex);
         InvalidChainFound(pindex);
     }
@@ -2119,6 +2455,56 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CPoWCheck> powcheckqueue(8);
+
+void ThreadPoWCheck() {
+    RenameThread("bitmark-powch");
+    powcheckqueue.Thread();
+}
+
+bool CPoWCheck::operator()() {
+    if (vpblock.size() == 1) {
+        CValidationState state;
+        vpblock[0]->fPoWChecked = CheckBlockProofOfWork(*vpblock[0], state);
+        // a failing block is left unmarked, CheckBlock verifies it again and reports the error
+        return true;
+    }
+
+    unsigned char headers[80 * CHashX17::LANES];
+    uint256 hashes[CHashX17::LANES];
+    assert(vpblock.size() <= CHashX17::LANES);
+    for (unsigned int i = 0; i < vpblock.size(); i++)
+        memcpy(headers + 80 * i, BEGIN(vpblock[i]->nVersion), 80);
+    CPoWHasher::ForThread().X17().HashMany(hashes, headers, 80, vpblock.size());
+    for (unsigned int i = 0; i < vpblock.size(); i++)
+        vpblock[i]->fPoWChecked = CheckProofOfWork(hashes[i], vpblock[i]->nBits, ALGO_X17);
+    return true;
+}
+
+void VerifyBlocksProofOfWork(std::vector<CBlock*>& vpblock)
+{
+    if (!nScriptCheckThreads || vpblock.size() < 2)
+        return;
+    std::vector<CPoWCheck> vChecks;
+    vChecks.reserve(vpblock.size());
+    // X17 headers go through the hash stages a lane group at a time
+    std::vector<CBlock*> vpblockX17;
+    BOOST_FOREACH(CBlock* pblock, vpblock) {
+        if (pblock->IsAuxpow() || pblock->GetAlgo() != ALGO_X17) {
+            vChecks.push_back(CPoWCheck(*pblock));
+            continue;
+        }
+        vpblockX17.push_back(pblock);
+        if (vpblockX17.size() == CHashX17::LANES)
+            vChecks.push_back(CPoWCheck(vpblockX17));
+    }
+    if (!vpblockX17.empty())
+        vChecks.push_back(CPoWCheck(vpblockX17));
+    CCheckQueueControl<CPoWCheck> control(&powcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
 bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
   if (pindex->nHeight > 0) {
@@ -2294,12 +2680,18 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
     CBlockIndex * pprev_algo = 0;
     if (!fJustCheck) pprev_algo = get_pprev_algo(pindex,-1);
     if (!fJustCheck && onForkNow) { // set scaling factor
+      bool fHaveSSF = pindex->nStatus & BLOCK_HAVE_SSF;
       if (update_ssf(pindex->nVersion)) {
 	pindex->subsidyScalingFactor = get_ssf(pindex);
+	pindex->nStatus |= BLOCK_HAVE_SSF;
       }
       else if (pprev_algo) {
 	pindex->subsidyScalingFactor = pprev_algo->subsidyScalingFactor;
+	if (pprev_algo->nStatus & BLOCK_HAVE_SSF) pindex->nStatus |= BLOCK_HAVE_SSF;
       }
+      if (!fHaveSSF && (pindex->nStatus & BLOCK_HAVE_SSF) &&
+          !pblocktree->WriteSubsidyScalingFactor(pindex->GetBlockHash(), pindex->subsidyScalingFactor))
+        return state.Abort(_("Failed to write subsidy scaling factor"));
     }
 
     int64_t block_value_needed = GetBlockValue(pindex, nFees, false);
@@ -2408,6 +2800,36 @@ bool static WriteChainState(CValidationState &state) {
     return true;
 }
 
+void NotifyNewWork()
+{
+    AssertLockHeld(cs_main);
+    {
+        boost::unique_lock<boost::mutex> lock(csNewWork);
+        if (chainActive.Tip())
+            hashNewWorkTip = chainActive.Tip()->GetBlockHash();
+    }
+    cvNewWork.notify_all();
+}
+
+bool WaitForNewWork(const uint256& hashTip, unsigned int nTransactionsUpdated, int64_t nTxTime, int64_t nDeadline)
+{
+    boost::unique_lock<boost::mutex> lock(csNewWork);
+    for (int nWait = 0; ; nWait++)
+    {
+        // Nothing has been notified before the first block since startup
+        if (hashNewWorkTip != 0 && hashNewWorkTip != hashTip)
+            return true;
+        bool fNewTransactions = (mempool.GetTransactionsUpdated() != nTransactionsUpdated);
+        int64_t nNow = GetTime();
+        if (fNewTransactions && nNow >= nTxTime)
+            return true;
+        int64_t nWakeup = fNewTransactions ? std::min(nTxTime, nDeadline) : nDeadline;
+        if (nWait > 0 || nNow >= nWakeup)
+            return false;
+        cvNewWork.timed_wait(lock, boost::get_system_time() + boost::posix_time::seconds(nWakeup - nNow));
+    }
+}
+
 // Update chainActive and related internal data structures.
 void static UpdateTip(CBlockIndex *pindexNew) {
     chainActive.SetTip(pindexNew);
@@ -2421,6 +2843,7 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     // New best block
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
+    NotifyNewWork();
     LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%d progress=%f nbits=%u algo=%d\n",chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx, chainActive.Tip()->GetBlockTime(),Checkpoints::GuessVerificationProgress(chainActive.Tip()), chainActive.Tip()->nBits,GetAlgo(chainActive.Tip()->nVersion));
     //char * blocktime = (char *)malloc(50);
     //sprintf(blocktime,"%d %d\n",chainActive.Tip()->nTime,GetAlgo(chainActive.Tip()->nVersion));
@@ -2653,20 +3076,25 @@ bool AddToBlockIndex(CBlock& block, CValidationState& state, const CDiskBlockPos
         return state.Invalid(error("AddToBlockIndex() : %s already exists", hash.ToString()), 0, "duplicate");
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     assert(pindexNew);
     {
          LOCK(cs_nBlockSequenceId);
          pindexNew->nSequenceId = nBlockSequenceId++;
     }
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+    BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
     }
+    pindexNew->BuildSkip();
+    pindexNew->BuildForkState();
+    pindexNew->BuildAlgoSkip();
+    pindexNew->BuildMedianTimePast();
     pindexNew->nTx = block.vtx.size();
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWork().getuint256();
     if (block.IsAuxpow()) {
@@ -2682,6 +3110,11 @@ bool AddToBlockIndex(CBlock& block, CValidationState& state, const CDiskBlockPos
 
     if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindexNew)))
         return state.Abort(_("Failed to write block index"));
+    if (pindexNew->pauxpow) {
+        // the record now holds the auxpow, keep it in memory only while it is recent
+        CacheBlockIndexAuxPow(hash, pindexNew->pauxpow);
+        pindexNew->pauxpow.reset();
+    }
     
     // New best?
     if (!ActivateBestChain(state))
@@ -2803,27 +3236,34 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
 }
 
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+bool CheckBlockProofOfWork(const CBlockHeader& block, CValidationState& state)
 {
     // Check proof of work matches claimed amount
-    if(fCheckPOW && block.IsAuxpow()) {
+    if(block.IsAuxpow()) {
       if (!CheckAuxPowProofOfWork(block, Params())) {
-    return state.DoS(50, error("CheckBlock() : auxpow proof of work failed"),
-             REJECT_INVALID, "high-hash");
+	return state.DoS(50, error("CheckBlock() : auxpow proof of work failed"),
+			 REJECT_INVALID, "high-hash");
       }
     }
     else {
-          if (fCheckPOW && block.GetAlgo() == ALGO_EQUIHASH && !CheckEquihashSolution(&block, Params())) {
-        return state.DoS(50, error("CheckBlock() : Invalid Equihash Solution"),
-                 REJECT_INVALID, "bad-equihash-solution");      
+      if (block.GetAlgo() == ALGO_EQUIHASH && !CheckEquihashSolution(&block, Params())) {
+	return state.DoS(50, error("CheckBlock() : Invalid Equihash Solution"),
+			 REJECT_INVALID, "bad-equihash-solution");
       }
 
       //LogPrintf("check proof of work of block with algo %d\n",block.GetAlgo());
-      if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(),block.nBits,block.GetAlgo())) {
-        return state.DoS(50, error("CheckBlock() : proof of work failed"),
-                 REJECT_INVALID, "high-hash");
+      if (!CheckProofOfWork(block.GetPoWHash(),block.nBits,block.GetAlgo())) {
+	return state.DoS(50, error("CheckBlock() : proof of work failed"),
+			 REJECT_INVALID, "high-hash");
       }
     }
+    return true;
+}
+
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+{
+    if (fCheckPOW && !CheckBlockProofOfWork(block, state))
+        return false;
 
     // Check timestamp
     int64_t nNow = GetTime();
@@ -2864,32 +3304,16 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     /*
     bool blockOnFork = false;
     if (fCheckPOW && block.GetHash() != Params().HashGenesisBlock()) {
-      map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+      BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
       if (mi == mapBlockIndex.end())
 	return state.DoS(10, error("CheckBlock() : prev block not found"), 0, "bad-prevblk");
       CBlockIndex * pindexPrev = (*mi).second;
       blockOnFork = (pindexPrev->nHeight >= nForkHeight - 1) && (CBlockIndex::IsSuperMajority(4,pindexPrev,75,100));
       }*/
     
-    // Check proof of work matches claimed amount
-    if(fCheckPOW && block.IsAuxpow()) {
-      if (!CheckAuxPowProofOfWork(block, Params())) {
-	return state.DoS(50, error("CheckBlock() : auxpow proof of work failed"),
-			 REJECT_INVALID, "high-hash");
-      }
-    }
-    else {
-          if (fCheckPOW && block.GetAlgo() == ALGO_EQUIHASH && !CheckEquihashSolution(&block, Params())) {
-	    return state.DoS(50, error("CheckBlock() : Invalid Equihash Solution"),
-			     REJECT_INVALID, "bad-equihash-solution");      
-	  }
-
-	  //LogPrintf("check proof of work of block with algo %d\n",block.GetAlgo());
-	  if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(),block.nBits,block.GetAlgo())) {
-	    return state.DoS(50, error("CheckBlock() : proof of work failed"),
-			     REJECT_INVALID, "high-hash");
-	  }
-    }
+    // Check proof of work matches claimed amount, unless the checking threads already did
+    if (fCheckPOW && !block.fPoWChecked && !CheckBlockProofOfWork(block, state))
+        return false;
 
     // Check timestamp
     int64_t nNow = GetTime();
@@ -2963,7 +3387,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     AssertLockHeld(cs_main);
     // Check for duplicate
     uint256 hash = block.GetHash();
-    map<uint256, CBlockIndex*>::iterator miSelf = mapBlockIndex.find(hash);
+    BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
     if (miSelf != mapBlockIndex.end()) {
         // Block header is already known.
@@ -2979,7 +3403,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     CBlockIndex* pindexPrev = NULL;
     int nHeight = 0;
     if (hash != Params().HashGenesisBlock()) {
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
         if (mi == mapBlockIndex.end())
             return state.DoS(10, error("%s : prev block not found", __func__), 0, "bad-prevblk");
         pindexPrev = (*mi).second;
@@ -3009,7 +3433,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
                              REJECT_CHECKPOINT, "checkpoint mismatch");
 
         // Don't accept any forks from the main chain prior to last checkpoint
-        CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+        CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
         if (pcheckpoint && nHeight < pcheckpoint->nHeight)
             return state.DoS(100, error("%s : forked chain older than last checkpoint (height %d)", __func__, nHeight));
 
@@ -3037,7 +3461,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         }
 
         if (block.IsAuxpow() || block.GetAlgo() != ALGO_SCRYPT) {
-            if (pindexPrev->nHeight < nForkHeight-1 || !CBlockIndex::IsSuperMajority(4,pindexPrev,75,100)) {
+            if (pindexPrev->nHeight < nForkHeight-1 || !pindexPrev->IsForkMajority()) {
             return state.DoS(100,error("%s : new block format requires fork activation", __func__),REJECT_INVALID,"bad-version-fork");
             }
         }
@@ -3062,7 +3486,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CDiskBlockPos* dbp)
     CBlockIndex* pindexPrev = NULL;
     int nHeight = 0;
     if (hash != Params().HashGenesisBlock()) {
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
         if (mi == mapBlockIndex.end())
             return state.DoS(10, error("AcceptBlock() : prev block not found"), 0, "bad-prevblk");
         pindexPrev = (*mi).second;
@@ -3094,7 +3518,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CDiskBlockPos* dbp)
                              REJECT_CHECKPOINT, "checkpoint mismatch");
 
         // Don't accept any forks from the main chain prior to last checkpoint
-        CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+        CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
         if (pcheckpoint && nHeight < pcheckpoint->nHeight)
             return state.DoS(100, error("AcceptBlock() : forked chain older than last checkpoint (height %d)", nHeight));
 
@@ -3125,7 +3549,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CDiskBlockPos* dbp)
 	  }
 
 	if (block.IsAuxpow() || block.GetAlgo() != ALGO_SCRYPT) {
-	  if (pindexPrev->nHeight < nForkHeight-1 || !CBlockIndex::IsSuperMajority(4,pindexPrev,75,100)) {
+	  if (pindexPrev->nHeight < nForkHeight-1 || !pindexPrev->IsForkMajority()) {
 	    return state.DoS(100,error("AcceptBlock() : new block format requires fork activation"),REJECT_INVALID,"bad-version-fork");
 	  }
 	}	
@@ -3189,7 +3613,7 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
         return error("ProcessBlock() : CheckBlock FAILED");
 
     if (0) { // skip these extra checks until we have the fork height set
-      CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+      CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
       if (pcheckpoint && pblock->hashPrevBlock != (chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256(0)))
 	{
 	  // Extra checks to prevent "fill up memory by spamming with bogus blocks"
@@ -3319,6 +3743,79 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+void CBlockIndex::BuildForkState()
+{
+    if (pprev && pprev->fForkStateBuilt) {
+        forkWindow = pprev->forkWindow << 1;
+    } else {
+        // parent has no cached window (or this is the genesis block), collect it the slow way
+        forkWindow.reset();
+        const CBlockIndex* pindexWalk = pprev;
+        for (unsigned int i = 1; i < nForkWindow && pindexWalk; i++, pindexWalk = pindexWalk->pprev)
+            forkWindow[i] = GetBlockVersion(pindexWalk->nVersion) >= nForkVersion;
+    }
+    forkWindow[0] = GetBlockVersion(nVersion) >= nForkVersion;
+
+    fForkMajority = forkWindow.count() >= nForkMajority;
+    fOnFork = nHeight >= nForkHeight && pprev && pprev->IsForkMajority();
+    fForkStateBuilt = 1;
+}
+
+CBlockIndex* CBlockIndex::GetAlgoAncestor(int algoHeight)
+{
+    if (algoHeight > nAlgoHeight || algoHeight < 0)
+        return NULL;
+
+    CBlockIndex* pindexWalk = this;
+    int heightWalk = nAlgoHeight;
+    while (heightWalk > algoHeight) {
+        int heightSkip = GetSkipHeight(heightWalk);
+        int heightSkipPrev = GetSkipHeight(heightWalk - 1);
+        if (heightSkip == algoHeight ||
+            (heightSkip > algoHeight && !(heightSkipPrev < heightSkip - 2 &&
+                                          heightSkipPrev >= algoHeight))) {
+            pindexWalk = pindexWalk->pskipAlgo;
+            heightWalk = heightSkip;
+        } else {
+            pindexWalk = pindexWalk->pprevAlgo;
+            heightWalk--;
+        }
+    }
+    return pindexWalk;
+}
+
+const CBlockIndex* CBlockIndex::GetAlgoAncestor(int algoHeight) const
+{
+    return const_cast<CBlockIndex*>(this)->GetAlgoAncestor(algoHeight);
+}
+
+void CBlockIndex::BuildAlgoSkip()
+{
+    pprevAlgo = NULL;
+    pskipAlgo = NULL;
+    nAlgoHeight = 0;
+    if (onFork()) {
+        int algo = GetAlgo();
+        for (CBlockIndex* pindexWalk = pprev; pindexWalk && pindexWalk->onFork(); pindexWalk = pindexWalk->pprev) {
+            if (pindexWalk->GetAlgo() == algo) {
+                pprevAlgo = pindexWalk;
+                break;
+            }
+        }
+    }
+    if (pprevAlgo) {
+        nAlgoHeight = pprevAlgo->nAlgoHeight + 1;
+        pskipAlgo = pprevAlgo->GetAlgoAncestor(GetSkipHeight(nAlgoHeight));
+    }
+    fAlgoSkipBuilt = 1;
+}
+
+void CBlockIndex::BuildMedianTimePast()
+{
+    nMedianTimePast = ComputeMedianTimePast();
+    fMedianTimeBuilt = 1;
+}
+
 CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
 {
     header = block.GetBlockHeader();
@@ -3349,17 +3846,20 @@ uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::ve
     if (height == 0) {
         // hash at height 0 is the txids themself
         return vTxid[pos];
-    } else {
-        // calculate left hash
-        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
-        // calculate right hash if not beyong the end of the array - copy left hash otherwise1
-        if (pos*2+1 < CalcTreeWidth(height-1))
-            right = CalcHash(height-1, pos*2+1, vTxid);
-        else
-            right = left;
-        // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
     }
+    // hash the subtree one level at a time, each level in a single batch;
+    // only the right edge of the tree can have an odd level, whose last
+    // node is then combined with itself
+    unsigned int nBegin = pos << height;
+    unsigned int nEnd = std::min((pos + 1) << height, (unsigned int)vTxid.size());
+    std::vector<uint256> vLevel(vTxid.begin() + nBegin, vTxid.begin() + nEnd);
+    for (int h = 0; h < height; h++) {
+        if (vLevel.size() & 1)
+            vLevel.push_back(vLevel.back());
+        SHA256D64(vLevel[0].begin(), vLevel[0].begin(), vLevel.size() / 2);
+        vLevel.resize(vLevel.size() / 2);
+    }
+    return vLevel[0];
 }
 
 void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) {
@@ -3482,20 +3982,218 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    munmap((void*)pbegin, nSize);
+#endif
+}
+
+/** Recently read blk and rev files, mapped read-only */
+class CBlockFileMaps
+{
+private:
+  typedef std::pair<std::string, int> key_type;
+  typedef std::list<std::pair<key_type, boost::shared_ptr<CMappedBlockFile> > > list_type;
+  unsigned int nMaxSize;
+  list_type listRecent; // most recently used first
+  std::map<key_type, list_type::iterator> mapEntries;
+
+  void Erase (const key_type & key) {
+    std::map<key_type, list_type::iterator>::iterator it = mapEntries.find(key);
+    if (it != mapEntries.end()) {
+      listRecent.erase(it->second);
+      mapEntries.erase(it);
+    }
+  }
+
+  static boost::shared_ptr<CMappedBlockFile> Map (const CDiskBlockPos & pos, const char * prefix) {
+    boost::shared_ptr<CMappedBlockFile> pmap;
+#ifndef WIN32
+    boost::filesystem::path path = GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+      return pmap;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED)
+        pmap.reset(new CMappedBlockFile((const char*)p, st.st_size));
+    }
+    close(fd);
+#endif
+    return pmap;
+  }
+
+public:
+  CBlockFileMaps (unsigned int nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+  boost::shared_ptr<CMappedBlockFile> Get (const CDiskBlockPos & pos, const char * prefix) {
+    key_type key(prefix, pos.nFile);
+    std::map<key_type, list_type::iterator>::iterator it = mapEntries.find(key);
+    if (it != mapEntries.end()) {
+      if (pos.nPos < it->second->second->nSize) {
+        listRecent.splice(listRecent.begin(), listRecent, it->second);
+        return it->second->second;
+      }
+      // the file grew since it was mapped (undo data of an older block file)
+      Erase(key);
+    }
+    boost::shared_ptr<CMappedBlockFile> pmap = Map(pos, prefix);
+    if (!pmap || pos.nPos >= pmap->nSize)
+      return boost::shared_ptr<CMappedBlockFile>();
+    listRecent.push_front(std::make_pair(key, pmap));
+    mapEntries[key] = listRecent.begin();
+    if (listRecent.size() > nMaxSize) {
+      mapEntries.erase(listRecent.back().first);
+      listRecent.pop_back();
+    }
+    return pmap;
+  }
+
+  void Drop (const CDiskBlockPos & pos, const char * prefix) {
+    Erase(key_type(prefix, pos.nFile));
+  }
+
+  void Clear () {
+    listRecent.clear();
+    mapEntries.clear();
+  }
+};
+
+static CCriticalSection cs_blockfilemaps;
+static CBlockFileMaps blockFileMaps(MAX_MAPPED_BLOCK_FILES);
+
+boost::shared_ptr<CMappedBlockFile> MapBlockFile(const CDiskBlockPos &pos, const char *prefix)
+{
+    if (!fMapBlockFiles || pos.IsNull())
+        return boost::shared_ptr<CMappedBlockFile>();
+    {
+        // The file being appended is still preallocated and written through stdio
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile == nLastBlockFile)
+            return boost::shared_ptr<CMappedBlockFile>();
+    }
+    LOCK(cs_blockfilemaps);
+    return blockFileMaps.Get(pos, prefix);
+}
+
+void UnmapBlockFile(const CDiskBlockPos &pos, const char *prefix)
+{
+    LOCK(cs_blockfilemaps);
+    blockFileMaps.Drop(pos, prefix);
+}
+
+void ClearBlockFileMaps()
+{
+    LOCK(cs_blockfilemaps);
+    blockFileMaps.Clear();
+}
+
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    if (nUsed == nChunkSize) {
+        vChunks.push_back(new CBlockIndex[nChunkSize]);
+        nUsed = 0;
+    }
+    return &vChunks.back()[nUsed++];
+}
+
+void CBlockIndexArena::Clear()
+{
+    BOOST_FOREACH(CBlockIndex* pchunk, vChunks)
+        delete[] pchunk;
+    vChunks.clear();
+    nUsed = nChunkSize;
+}
+
+/** Recently used auxpows of block index entries, the rest stay in the block tree DB */
+class CAuxPowCache
+{
+private:
+  typedef std::list<std::pair<uint256, boost::shared_ptr<CAuxPow> > > list_type;
+  unsigned int nMaxSize;
+  list_type listRecent; // most recently used first
+  std::map<uint256, list_type::iterator> mapEntries;
+
+public:
+  CAuxPowCache (unsigned int nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+  bool Get (const uint256 & hash, boost::shared_ptr<CAuxPow> & pauxpow) {
+    std::map<uint256, list_type::iterator>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end()) return false;
+    listRecent.splice(listRecent.begin(), listRecent, it->second);
+    pauxpow = it->second->second;
+    return true;
+  }
+
+  void Put (const uint256 & hash, const boost::shared_ptr<CAuxPow> & pauxpow) {
+    std::map<uint256, list_type::iterator>::iterator it = mapEntries.find(hash);
+    if (it != mapEntries.end()) {
+      listRecent.erase(it->second);
+      mapEntries.erase(it);
+    }
+    listRecent.push_front(std::make_pair(hash, pauxpow));
+    mapEntries[hash] = listRecent.begin();
+    if (listRecent.size() > nMaxSize) {
+      mapEntries.erase(listRecent.back().first);
+      listRecent.pop_back();
+    }
+  }
+
+  void Clear () {
+    listRecent.clear();
+    mapEntries.clear();
+  }
+};
+
+static CCriticalSection cs_auxpowcache;
+static CAuxPowCache auxpowCache(1000);
+
+void CacheBlockIndexAuxPow(const uint256 & hash, const boost::shared_ptr<CAuxPow> & pauxpow)
+{
+    LOCK(cs_auxpowcache);
+    auxpowCache.Put(hash, pauxpow);
+}
+
+boost::shared_ptr<CAuxPow> GetBlockIndexAuxPow(const CBlockIndex* pindex)
+{
+    if (pindex->pauxpow || !pindex->IsAuxpow() || !pindex->phashBlock)
+        return pindex->pauxpow;
+
+    const uint256 hash = pindex->GetBlockHash();
+    boost::shared_ptr<CAuxPow> pauxpow;
+    LOCK(cs_auxpowcache);
+    if (auxpowCache.Get(hash, pauxpow))
+        return pauxpow;
+    CDiskBlockIndex diskindex;
+    if (!pblocktree->ReadBlockIndex(hash, diskindex) || !diskindex.pauxpow) {
+        LogPrintf("GetBlockIndexAuxPow() : no auxpow stored for %s\n", hash.ToString());
+        return pauxpow;
+    }
+    pauxpow = diskindex.pauxpow;
+    auxpowCache.Put(hash, pauxpow);
+    return pauxpow;
+}
+
+void ClearBlockIndexAuxPowCache()
+{
+    LOCK(cs_auxpowcache);
+    auxpowCache.Clear();
+}
+
 CBlockIndex * InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     //LogPrintf("insert to mapBlockIndex hash %s\n",hash.GetHex().c_str());
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
@@ -3522,6 +4220,10 @@ bool static LoadBlockIndexDB()
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
+        pindex->BuildSkip();
+        pindex->BuildForkState();
+        pindex->BuildAlgoSkip();
+        pindex->BuildMedianTimePast();
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork().getuint256();
         pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK)) {
@@ -3549,7 +4251,7 @@ bool static LoadBlockIndexDB()
 
     // Load pointer to end of best chain
     //LogPrintf("load pcoinstip bestblock %s\n",pcoinsTip->GetBestBlock().GetHex().c_str());
-    std::map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
+    BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
@@ -3561,6 +4263,41 @@ bool static LoadBlockIndexDB()
     return true;
 }
 
+bool RebuildSSF()
+{
+    LOCK(cs_main);
+    int64_t nStart = GetTimeMillis();
+    int nUpdated = 0;
+    reset_ssf_accumulators();
+    // forward order lets get_ssf advance its rolling windows instead of measuring a year of them per update block
+    for (CBlockIndex* pindex = chainActive.Genesis(); pindex; pindex = chainActive.Next(pindex))
+    {
+        boost::this_thread::interruption_point();
+        if (!onFork(pindex))
+            continue;
+        CBigNum scalingFactor = pindex->subsidyScalingFactor;
+        unsigned int nStatus = pindex->nStatus;
+        CBlockIndex* pprev_algo = get_pprev_algo(pindex,-1);
+        if (update_ssf(pindex->nVersion)) {
+            pindex->subsidyScalingFactor = get_ssf(pindex);
+            pindex->nStatus |= BLOCK_HAVE_SSF;
+        } else if (pprev_algo && (pprev_algo->nStatus & BLOCK_HAVE_SSF)) {
+            pindex->subsidyScalingFactor = pprev_algo->subsidyScalingFactor;
+            pindex->nStatus |= BLOCK_HAVE_SSF;
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_SSF) ||
+            (pindex->nStatus == nStatus && pindex->subsidyScalingFactor == scalingFactor))
+            continue;
+        if (!pblocktree->WriteSubsidyScalingFactor(pindex->GetBlockHash(), pindex->subsidyScalingFactor))
+            return error("RebuildSSF() : failed to write subsidy scaling factor");
+        nUpdated++;
+    }
+    if (!pblocktree->Flush())
+        return error("RebuildSSF() : failed to sync block index");
+    LogPrintf("RebuildSSF(): updated %d block index entries in %dms\n", nUpdated, GetTimeMillis() - nStart);
+    return true;
+}
+
 bool VerifyDB(int nCheckLevel, int nCheckDepth)
 {
     LOCK(cs_main);
@@ -3638,9 +4375,17 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
 void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
     setBlockIndexValid.clear();
     chainActive.SetTip(NULL);
+    chainMostWork.SetTip(NULL);
     pindexBestInvalid = NULL;
+    pindexBestForkTip = NULL;
+    pindexBestForkBase = NULL;
+    reset_ssf_accumulators();
+    reset_retarget_contexts();
+    ClearBlockIndexAuxPowCache();
+    ClearBlockFileMaps();
 }
 
 bool LoadBlockIndex()
@@ -3709,7 +4454,7 @@ void PrintBlockTree()
     AssertLockHeld(cs_main);
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -3773,11 +4518,46 @@ void PrintBlockTree()
     }
 }
 
+/** Process blocks read from a block file in file order, after verifying their proof of work in parallel */
+static bool ProcessBlockBatch(std::vector<CBlock>& vBlocks, std::vector<uint64_t>& vBlockPos, CDiskBlockPos *dbp, int& nLoaded)
+{
+    std::vector<CBlock*> vpblock;
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+        vpblock.push_back(&vBlocks[i]);
+    VerifyBlocksProofOfWork(vpblock);
+
+    bool fContinue = true;
+    for (unsigned int i = 0; i < vBlocks.size() && fContinue; i++) {
+        boost::this_thread::interruption_point();
+        try {
+            LOCK(cs_main);
+            if (dbp)
+                dbp->nPos = vBlockPos[i];
+            CValidationState state;
+            if (ProcessBlock(state, NULL, &vBlocks[i], dbp))
+                nLoaded++;
+            if (state.IsError())
+                fContinue = false;
+        } catch (std::exception &e) {
+            LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    vBlocks.clear();
+    vBlockPos.clear();
+    return fContinue;
+}
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
 {
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
+    // read ahead enough blocks to keep the proof of work checking threads busy
+    const unsigned int nBatchSize = nScriptCheckThreads ? 4 * nScriptCheckThreads : 1;
+    std::vector<CBlock> vBlocks;
+    std::vector<uint64_t> vBlockPos;
+    vBlocks.reserve(nBatchSize);
+    vBlockPos.reserve(nBatchSize);
     try {
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nStartByte = 0;
@@ -3821,21 +4601,19 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                // process block
+                // queue block for processing
                 if (nBlockPos >= nStartByte) {
-                    LOCK(cs_main);
-                    if (dbp)
-                        dbp->nPos = nBlockPos;
-                    CValidationState state;
-                    if (ProcessBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
+                    vBlocks.push_back(block);
+                    vBlockPos.push_back(nBlockPos);
                 }
             } catch (std::exception &e) {
                 LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
+            if (vBlocks.size() >= nBatchSize && !ProcessBlockBatch(vBlocks, vBlockPos, dbp, nLoaded))
+                break;
         }
+        if (!vBlocks.empty())
+            ProcessBlockBatch(vBlocks, vBlockPos, dbp, nLoaded);
         fclose(fileIn);
     } catch(std::runtime_error &e) {
         AbortNode(_("Error: system error: ") + e.what());
@@ -3953,13 +4731,13 @@ void static ProcessGetData(CNode* pfrom)
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
             {
                 bool send = false;
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     // If the requested block is at a height below our last
                     // checkpoint, only serve it if it's in the checkpointed chain
                     int nHeight = mi->second->nHeight;
-                    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+                    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
                     if (pcheckpoint && nHeight < pcheckpoint->nHeight) {
                         if (!chainActive.Contains(mi->second))
                         {
@@ -3974,12 +4752,18 @@ void static ProcessGetData(CNode* pfrom)
                 if (send)
                 {
                     // Send block from disk
-                    CBlock block;
-                    ReadBlockFromDisk(block, (*mi).second);
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        // The disk and network encodings of a block are the same,
+                        // so plain blocks go out as stored without being parsed
+                        std::vector<unsigned char> vchBlock;
+                        if (ReadRawBlockFromDisk(vchBlock, (*mi).second))
+                            pfrom->PushMessage("block", CFlatData(&vchBlock[0], &vchBlock[0] + vchBlock.size()));
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        ReadBlockFromDisk(block, (*mi).second);
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -4373,7 +5157,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -5129,10 +5913,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        std::map<uint256, CBlockIndex*>::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan blocks
         std::map<uint256, COrphanBlock*>::iterator it2 = mapOrphanBlocks.begin();
@@ -5208,6 +5990,9 @@ CBlockIndex * get_pprev_algo (const CBlockIndex * p, int use_algo) {
   else {
     algo = GetAlgo(p->nVersion);
   }
+  if (p->fAlgoSkipBuilt && algo == p->GetAlgo()) {
+    return p->pprevAlgo;
+  }
   CBlockIndex * pprev = p->pprev;
   while (pprev && onFork(pprev)) {
     int cur_algo = GetAlgo(pprev->nVersion);
@@ -5220,6 +6005,20 @@ CBlockIndex * get_pprev_algo (const CBlockIndex * p, int use_algo) {
   return 0;
 }
 
+/* Get the n-th previous CBlockIndex pointer with the given algo */
+CBlockIndex * get_pprev_algo_n (const CBlockIndex * p, int n, int use_algo) {
+  if (n < 1) return 0;
+  CBlockIndex * pprev_algo = get_pprev_algo(p,use_algo);
+  if (!pprev_algo || n == 1) return pprev_algo;
+  if (pprev_algo->fAlgoSkipBuilt) {
+    return pprev_algo->GetAlgoAncestor(pprev_algo->nAlgoHeight - (n - 1));
+  }
+  for (int i=1; i<n && pprev_algo; i++) {
+    pprev_algo = get_pprev_algo(pprev_algo,-1);
+  }
+  return pprev_algo;
+}
+
 int64_t get_mpow_ms_correction (CBlockIndex * p) {
   CBlockIndex * pprev = p->pprev;
   while (pprev) {
@@ -5239,52 +6038,188 @@ bool update_ssf (int nVersion) {
   return nVersion & BLOCK_VERSION_UPDATE_SSF;
 }
 
-CBigNum get_ssf (CBlockIndex * pindex) {
-  CBigNum scalingFactor = CBigNum(0); // ensures that it has no effect
-  CBlockIndex * pprev_algo = pindex;
-  CBigNum hashes_peak = CBigNum(0);
-  CBigNum hashes_cur = CBigNum(0);
-  for (int i=0; i<365; i++) { // use at most a year's worth of history
-    //LogPrintf("i=%d\n",i);
+/* One nSSF block (24 hour) hashrate window of get_ssf, made of the same-algo predecessors of pindex */
+struct CSSFWindow {
+  bool fExists; // pindex has a same-algo predecessor to start the window with
+  bool fValid; // median time past increased over the window
+  CBigNum hashes; // work per second, times 100000000
+  const CBlockIndex * pindexEnd; // oldest block of the window, the next window starts with its predecessor
+};
+
+static CSSFWindow get_ssf_window (const CBlockIndex * pindex) {
+  CSSFWindow window;
+  window.fExists = false;
+  window.fValid = true;
+  window.pindexEnd = 0;
+  const CBlockIndex * pprev_algo = get_pprev_algo(pindex,-1);
+  if (!pprev_algo) {
+    return window;
+  }
+  window.fExists = true;
+  CBigNum hashes = pprev_algo->GetBlockWork();
+  unsigned int time_f = pprev_algo->GetMedianTimePast();
+  unsigned int time_i = 0;
+  for (int j=0; j<nSSF-1; j++) {  // nSSF blocks = 24 hours, using only blocks from the same algo as the target block
     pprev_algo = get_pprev_algo(pprev_algo,-1);
     if (!pprev_algo) {
+      hashes = CBigNum(0);
       break;
     }
-    CBigNum hashes = pprev_algo->GetBlockWork();
-    unsigned int time_f = pprev_algo->GetMedianTimePast();
-    unsigned int time_i = 0;
-    for (int j=0; j<nSSF-1; j++) {  // nSSF blocks = 24 hours, using only blocks from the same algo as the target block
-      pprev_algo = get_pprev_algo(pprev_algo,-1);
-      if (!pprev_algo) {
-	hashes = CBigNum(0);
-	break;
-      }
-      hashes += pprev_algo->GetBlockWork();
-      time_i = pprev_algo->GetMedianTimePast();
+    hashes += pprev_algo->GetBlockWork();
+    time_i = pprev_algo->GetMedianTimePast();
+  }
+  window.pindexEnd = pprev_algo;
+  CBlockIndex * pprev_algo_time = get_pprev_algo(pprev_algo,-1);
+  if (pprev_algo_time) {
+    time_i = pprev_algo_time->GetMedianTimePast();
+  }
+  else { // get prefork block time
+    const CBlockIndex * blockindex = pprev_algo;
+    while (blockindex && onFork(blockindex)) {
+      blockindex = blockindex->pprev;
     }
-    CBlockIndex * pprev_algo_time = get_pprev_algo(pprev_algo,-1);
-    if (pprev_algo_time) {
-      time_i = pprev_algo_time->GetMedianTimePast();
+    if (blockindex) time_i = blockindex->GetBlockTime();
+  }
+  if (time_f>time_i) {
+    time_f -= time_i;
+  }
+  else {
+    window.fValid = false;
+    return window;
+  }
+  window.hashes = (hashes*100000000)/time_f;
+  return window;
+}
+
+/** Rolling record of the hashrate windows of one algo, as of the last block get_ssf was
+ *  computed for. The next update block, nSSF same-algo blocks later, shares all but its
+ *  newest window with it, so only that one has to be measured. The peak of the last 365
+ *  windows is kept in a monotonic deque.
+ */
+class CSSFAccumulator
+{
+private:
+  const CBlockIndex * pindexLast; // block the windows below belong to
+  int nWindows; // number of windows pushed so far, the newest has sequence number nWindows-1
+  int nLastInvalid; // sequence number of the newest window without increasing time, -1 if none
+  std::deque<std::pair<int, CBigNum> > dequePeak; // decreasing hashrates with their sequence number
+
+  void Push (const CSSFWindow & window) {
+    int nSeq = nWindows++;
+    if (!window.fValid) {
+      nLastInvalid = nSeq;
+      return;
+    }
+    while (!dequePeak.empty() && dequePeak.back().second <= window.hashes) {
+      dequePeak.pop_back();
+    }
+    dequePeak.push_back(std::make_pair(nSeq, window.hashes));
+  }
+
+  void Rebuild (const CBlockIndex * pindex) {
+    SetNull();
+    std::vector<CSSFWindow> vWindows;
+    const CBlockIndex * pstart = pindex;
+    for (int i=0; i<365 && pstart; i++) { // use at most a year's worth of history
+      CSSFWindow window = get_ssf_window(pstart);
+      if (!window.fExists) break;
+      vWindows.push_back(window);
+      pstart = window.pindexEnd;
     }
-    else { // get prefork block time
-      CBlockIndex * blockindex = pprev_algo;
-      while (blockindex && onFork(blockindex)) {
-	blockindex = blockindex->pprev;
-      }
-      if (blockindex) time_i = blockindex->GetBlockTime();
+    for (int i=vWindows.size()-1; i>=0; i--) {
+      Push(vWindows[i]);
     }
-    if (time_f>time_i) {
-      time_f -= time_i;
+  }
+
+public:
+  CSSFAccumulator () {
+    SetNull();
+  }
+
+  void SetNull () {
+    pindexLast = 0;
+    nWindows = 0;
+    nLastInvalid = -1;
+    dequePeak.clear();
+  }
+
+  const CBlockIndex * GetLast () const {
+    return pindexLast;
+  }
+
+  /* True if moving to pindex only has to measure its newest window */
+  bool Precedes (const CBlockIndex * pindex) const {
+    return pindexLast && pindexLast == get_pprev_algo_n(pindex,nSSF,-1);
+  }
+
+  /* Move to pindex and return false if one of its windows has no increasing time, as get_ssf used to */
+  bool Update (const CBlockIndex * pindex, CBigNum & hashes_cur, CBigNum & hashes_peak) {
+    if (Precedes(pindex)) {
+      CSSFWindow window = get_ssf_window(pindex);
+      if (window.fExists) Push(window);
     }
     else {
-      //LogPrintf("time_f = %d while time_i = %d\n",time_f,time_i);
-      return scalingFactor;
-    }
-    //LogPrintf("hashes = %lu, time = %u\n",hashes.getulong(),time_f);
-    hashes = (hashes*100000000)/time_f;
-    //LogPrintf("hashes per sec = %f\n",hashes);
-    if (hashes>hashes_peak) hashes_peak = hashes;
-    if (i==0) hashes_cur = hashes;
+      Rebuild(pindex);
+    }
+    pindexLast = pindex;
+
+    while (!dequePeak.empty() && dequePeak.front().first <= nWindows-1-365) {
+      dequePeak.pop_front();
+    }
+    return Get(hashes_cur,hashes_peak);
+  }
+
+  /* Read the hashrates of the block the windows belong to, without moving */
+  bool Get (CBigNum & hashes_cur, CBigNum & hashes_peak) const {
+    if (nLastInvalid >= 0 && nLastInvalid > nWindows-1-365) {
+      return false;
+    }
+    hashes_cur = CBigNum(0);
+    hashes_peak = CBigNum(0);
+    if (!dequePeak.empty()) {
+      hashes_peak = dequePeak.front().second;
+      if (dequePeak.back().first == nWindows-1) hashes_cur = dequePeak.back().second;
+    }
+    return true;
+  }
+};
+
+static CCriticalSection cs_ssf;
+static CSSFAccumulator ssfAccumulators[NUM_ALGOS];
+
+void reset_ssf_accumulators () {
+  LOCK(cs_ssf);
+  for (int algo=0; algo<NUM_ALGOS; algo++) {
+    ssfAccumulators[algo].SetNull();
+  }
+}
+
+/* Measure pindex without moving the accumulator of its algo, copying it only if that saves a rebuild */
+static bool peek_ssf_accumulator (const CBlockIndex * pindex, CBigNum & hashes_cur, CBigNum & hashes_peak) {
+  AssertLockHeld(cs_ssf);
+  const CSSFAccumulator & cached = ssfAccumulators[pindex->GetAlgo()];
+  if (cached.GetLast() == pindex) {
+    return cached.Get(hashes_cur,hashes_peak);
+  }
+  CSSFAccumulator accumulator;
+  if (cached.Precedes(pindex)) accumulator = cached;
+  return accumulator.Update(pindex,hashes_cur,hashes_peak);
+}
+
+CBigNum get_ssf (CBlockIndex * pindex) {
+  CBigNum scalingFactor = CBigNum(0); // ensures that it has no effect
+  CBigNum hashes_peak = CBigNum(0);
+  CBigNum hashes_cur = CBigNum(0);
+  {
+    LOCK(cs_ssf);
+    bool fValid;
+    if (pindex->phashBlock) {
+      fValid = ssfAccumulators[pindex->GetAlgo()].Update(pindex,hashes_cur,hashes_peak);
+    }
+    else { // template blocks are not in mapBlockIndex, measure them without moving the accumulator
+      fValid = peek_ssf_accumulator(pindex,hashes_cur,hashes_peak);
+    }
+    if (!fValid) return scalingFactor;
   }
   if (hashes_peak > CBigNum(0) && hashes_cur != hashes_peak) {
     if (onFork2(pindex)) {
@@ -5298,6 +6233,19 @@ CBigNum get_ssf (CBlockIndex * pindex) {
   return scalingFactor;
 }
 
+bool get_ssf_window_hashrate (const CBlockIndex * pindex, CBigNum & hashes) {
+  CSSFWindow window = get_ssf_window(pindex);
+  hashes = window.fExists && window.fValid ? window.hashes : CBigNum(0);
+  return !window.fExists || window.fValid;
+}
+
+bool get_ssf_hashrates (const CBlockIndex * pindex, CBigNum & hashes_cur, CBigNum & hashes_peak) {
+  hashes_cur = CBigNum(0);
+  hashes_peak = CBigNum(0);
+  LOCK(cs_ssf);
+  return peek_ssf_accumulator(pindex,hashes_cur,hashes_peak);
+}
+
 int get_ssf_height (const CBlockIndex * pindex) {
   const CBlockIndex * pprev_algo = pindex;
   for (int i=0; i<nSSF; i++) {
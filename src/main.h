@@ -29,6 +29,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+
 class CBlockIndex;
 class CBloomFilter;
 class CInv;
@@ -54,6 +56,8 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Number of blk?????.dat and rev?????.dat files kept mapped for reading; bounded by address space on 32-bit */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = sizeof(void*) == 4 ? 4 : 64;
 /** Coinbase transaction outputs can only be spent after this number of new blocks (network rule) */
 static const int COINBASE_MATURITY = 720;
 /** Maximum number of script-checking threads allowed */
@@ -87,7 +91,15 @@ static const unsigned char REJECT_CHECKPOINT = 0x43;
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+extern CConditionVariable cvNewWork;
+struct BlockHasher
+{
+    size_t operator()(const uint256& hash) const { return hash.GetLow64(); }
+};
+
+typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+extern BlockMap mapBlockIndex;
+extern CBlockIndexArena blockIndexArena;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -97,6 +109,8 @@ extern bool fReindex;
 extern bool fBenchmark;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fVerifyBlockReads;
+extern bool fMapBlockFiles;
 extern unsigned int nCoinCacheSize;
 
 // Minimum disk space required - used in CheckDiskSpace()
@@ -136,6 +150,63 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 //FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+
+/** Read-only mapping of a blk?????.dat or rev?????.dat file */
+class CMappedBlockFile
+{
+public:
+    const char* pbegin;
+    size_t nSize;
+
+    CMappedBlockFile(const char* pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+    ~CMappedBlockFile();
+
+private:
+    CMappedBlockFile(const CMappedBlockFile&);
+    CMappedBlockFile& operator=(const CMappedBlockFile&);
+};
+
+/** Deserializes straight from a mapped block file, like CAutoFile does from a FILE* */
+class CMappedFileStream
+{
+private:
+    boost::shared_ptr<CMappedBlockFile> pfile; // keeps the mapping alive while reading
+    size_t nReadPos;
+    int nType;
+    int nVersion;
+
+public:
+    CMappedFileStream(const boost::shared_ptr<CMappedBlockFile>& pfileIn, size_t nPosIn, int nTypeIn, int nVersionIn) :
+        pfile(pfileIn), nReadPos(nPosIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType()    { return nType; }
+    int GetVersion() { return nVersion; }
+
+    CMappedFileStream& read(char* pch, size_t nSize)
+    {
+        if (nReadPos > pfile->nSize || nSize > pfile->nSize - nReadPos)
+            throw std::ios_base::failure("CMappedFileStream::read : end of file");
+        memcpy(pch, pfile->pbegin + nReadPos, nSize);
+        nReadPos += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CMappedFileStream& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/** Map the blk or rev file holding pos. Returns NULL when it has to be read with
+ *  stdio: mapping is off, the file is the one being appended, or pos lies past the
+ *  end of the file as it was mapped. */
+boost::shared_ptr<CMappedBlockFile> MapBlockFile(const CDiskBlockPos &pos, const char *prefix);
+/** Drop the cached mapping of the blk or rev file holding pos */
+void UnmapBlockFile(const CDiskBlockPos &pos, const char *prefix);
+/** Drop all cached block file mappings */
+void ClearBlockFileMaps();
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
 /** Initialize a new block tree database + block data on disk */
@@ -144,6 +215,8 @@ bool InitBlockIndex();
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Recompute and store the subsidy scaling factors of the active chain in one forward pass */
+bool RebuildSSF();
 /** Verify consistency of the block and coin databases */
 bool VerifyDB(int nCheckLevel, int nCheckDepth);
 /** Print the loaded block tree */
@@ -154,6 +227,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the proof of work checking thread */
+void ThreadPoWCheck();
+/** Verify the proof of work of a batch of blocks on the checking threads, marking the valid ones */
+void VerifyBlocksProofOfWork(std::vector<CBlock*>& vpblock);
 /** Calculate the minimum amount of work a received block needs, without knowing its direct parent */
 unsigned int ComputeMinWork(unsigned int nBase, int64_t nTime);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -164,15 +241,27 @@ std::string GetWarnings(std::string strFor);
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState &state);
+/** Wake up whatever waits for new work to mine on. Requires cs_main. */
+void NotifyNewWork();
+/** Wait for one wake-up from NotifyNewWork, or until nDeadline. Returns whether there is new
+ *  work: the best block is no longer hashTip, or it is past nTxTime and the memory pool moved
+ *  on from nTransactionsUpdated. Must not be called with cs_main held. */
+bool WaitForNewWork(const uint256& hashTip, unsigned int nTransactionsUpdated, int64_t nTxTime, int64_t nDeadline);
 bool onFork(const CBlockIndex* pindex);
 int64_t GetBlockValue(CBlockIndex* pindexPrev, int64_t nFees, bool noScale = false);
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast);
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, int algo);
+/** Forget the per-algo retarget results kept between GetNextWorkRequired calls */
+void reset_retarget_contexts();
 
 void UpdateTime(CBlockHeader& block, const CBlockIndex* pindexPrev);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
+/** Keep the auxpow of a block index entry among the recently used ones */
+void CacheBlockIndexAuxPow(const uint256 &hash, const boost::shared_ptr<CAuxPow> &pauxpow);
+/** Drop the recently used auxpows of block index entries */
+void ClearBlockIndexAuxPowCache();
 /** Verify a signature */
 bool VerifySignature(const CCoins& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
 /** Abort with a message */
@@ -323,16 +412,31 @@ public:
 
     bool ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock)
     {
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
-
         // Read block
         uint256 hashChecksum;
         try {
-            filein >> *this;
-            filein >> hashChecksum;
+            boost::shared_ptr<CMappedBlockFile> pmap = MapBlockFile(pos, "rev");
+            if (pmap) {
+                try {
+                    CMappedFileStream filein(pmap, pos.nPos, SER_DISK, CLIENT_VERSION);
+                    filein >> *this;
+                    filein >> hashChecksum;
+                }
+                catch (std::ios_base::failure &e) {
+                    // undo data of an older block file can be appended after it was mapped,
+                    // a record running past the end of the mapping is read through stdio
+                    UnmapBlockFile(pos, "rev");
+                    pmap.reset();
+                }
+            }
+            if (!pmap) {
+                // Open history file to read
+                CAutoFile filein = CAutoFile(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+                if (!filein)
+                    return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
+                filein >> *this;
+                filein >> hashChecksum;
+            }
         }
         catch (std::exception &e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -377,6 +481,27 @@ public:
     }
 };
 
+/** Closure representing the proof of work verification of one block, or of
+ *  a group of X17 blocks hashed together by the multi-buffer CHashX17
+ *  Note that this stores references to the blocks, which are marked if they pass */
+class CPoWCheck
+{
+private:
+    std::vector<CBlock*> vpblock;
+
+public:
+    CPoWCheck() {}
+    CPoWCheck(CBlock& blockIn) : vpblock(1, &blockIn) {}
+    /** Takes the blocks out of vpblockIn, all non-auxpow X17 */
+    explicit CPoWCheck(std::vector<CBlock*>& vpblockIn) { vpblock.swap(vpblockIn); }
+
+    bool operator()();
+
+    void swap(CPoWCheck &check) {
+        vpblock.swap(check.vpblock);
+    }
+};
+
 /** Data structure that represents a partial merkle tree.
  *
  * It respresents a subset of the txid's of a known block, in a way that
@@ -475,8 +600,15 @@ public:
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW = true);
+/** Read the block of an index entry. Proof of work is only rechecked when fCheckPOW
+ *  or -verifyblockreads is set, or the entry is not yet BLOCK_VALID_TRANSACTIONS.
+ *  Otherwise the auxpow of a merge mined block is read as is, since the header
+ *  hash that is compared against the entry does not cover it. */
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fCheckPOW = false);
+/** Read the serialized bytes of a block without parsing its transactions or auxpow */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -492,6 +624,9 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
 // Add this block to the block index, and if necessary, switch the active block chain to this
 bool AddToBlockIndex(CBlock& block, CValidationState& state, const CDiskBlockPos& pos);
 
+// Check the (aux)pow and equihash solution of a block header
+bool CheckBlockProofOfWork(const CBlockHeader& block, CValidationState& state);
+
 // Context-independent validity checks
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
@@ -630,6 +765,7 @@ struct CBlockTemplate
     CBlock block;
     std::vector<int64_t> vTxFees;
     std::vector<int64_t> vTxSigOps;
+    std::vector<uint256> vCoinbaseMerkleBranch; // same for every coinbase, and so every algo
 };
 
 /** Used to relay blocks as header + vector<merkle branch>
@@ -681,6 +817,9 @@ const char * GetAlgoName (int algo);
 /* Get previous CBlockIndex pointer that has the same POW algo as p */
 CBlockIndex * get_pprev_algo (const CBlockIndex * p, int use_algo = 0);
 
+/* Get the n-th previous CBlockIndex pointer with the given algo, n=1 being get_pprev_algo (O(log n) via the algo skiplist) */
+CBlockIndex * get_pprev_algo_n (const CBlockIndex * p, int n, int use_algo = -1);
+
 /* Get correction to money supply for multi POW blocks (1/5 of money supply before fork) */
 int64_t get_mpow_ms_correction (CBlockIndex * p);
 
@@ -690,6 +829,17 @@ bool update_ssf (int nVersion);
 /* Calculate the subsidy scaling factor for the CBlockIndex pointer */
 CBigNum get_ssf (CBlockIndex * pindex);
 
+/* Forget the per-algo hashrate windows kept between get_ssf calls */
+void reset_ssf_accumulators ();
+
+/* Get the hashrate (work per second, times 100000000) of the newest window get_ssf measures
+   for the CBlockIndex pointer; false if it has no increasing time */
+bool get_ssf_window_hashrate (const CBlockIndex * pindex, CBigNum & hashes);
+
+/* Get the current and peak hashrate (work per second, times 100000000) get_ssf measures for
+   the CBlockIndex pointer, without moving its windows; false if one has no increasing time */
+bool get_ssf_hashrates (const CBlockIndex * pindex, CBigNum & hashes_cur, CBigNum & hashes_peak);
+
 /* Get the number of blocks since the last update of the subsidy scaling factor */
 int get_ssf_height (const CBlockIndex * pindex);
 
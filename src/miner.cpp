@@ -12,8 +12,19 @@
 #ifdef ENABLE_WALLET
 #include "wallet.h"
 #endif
+// The solver runs are shared by several threads
+#define EQUIHASH_TROMP_ATOMIC
 #include "tromp/equi_miner.h"
 #include "equihash.h"
+#include "hash.h"
+#include "hashx17.h"
+#include "scrypt.h"
+#include "sha256.h"
+
+#include <atomic>
+
+#include <boost/scoped_ptr.hpp>
+#include <openssl/sha.h>
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -56,305 +67,382 @@ void SHA256Transform(void* pstate, void* pinput, const void* pinit)
         ((uint32_t*)pstate)[i] = ctx.h[i];
 }
 
-// Some explaining would be appreciated
-class COrphan
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
+typedef std::map<uint256, CTxMemPoolEntry>::const_iterator txiter;
+
+// Heap entries for block assembly, ordered on their score (priority or fee per kB)
+typedef std::pair<double, txiter> TxScore;
+class TxScoreCompare
 {
 public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    double dPriority;
-    double dFeePerKb;
+    bool operator()(const TxScore& a, const TxScore& b) const
+    {
+        return a.first < b.first;
+    }
+};
 
-    COrphan(const CTransaction* ptxIn)
+// Transactions picked for the last template. While the tip stays the same and
+// nothing in the pool was left out, the next template starts from these and
+// only has to look at the transactions that entered the pool since.
+class CTemplateSelection
+{
+public:
+    uint256 hashPrevBlock;
+    int nHeight;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    uint64_t nMempoolSequence;
+    std::vector<uint256> vHash;
+
+    CTemplateSelection()
     {
-        ptx = ptxIn;
-        dPriority = dFeePerKb = 0;
+        SetNull();
     }
 
-    void print() const
+    void SetNull()
     {
-        LogPrintf("COrphan(hash=%s, dPriority=%.1f, dFeePerKb=%.1f)\n",
-               ptx->GetHash().ToString(), dPriority, dFeePerKb);
-        BOOST_FOREACH(uint256 hash, setDependsOn)
-            LogPrintf("   setDependsOn %s\n", hash.ToString());
+        hashPrevBlock = 0;
+        nHeight = -1;
+        nBlockMaxSize = nBlockPrioritySize = nBlockMinSize = 0;
+        nMempoolSequence = 0;
+        vHash.clear();
     }
 };
 
+static CTemplateSelection lastSelection; // protected by cs_main and mempool.cs
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-
-// We want to sort transactions by priority and fee, so:
-typedef boost::tuple<double, double, const CTransaction*> TxPriority;
-class TxPriorityCompare
+// Collects memory pool transactions into a block template: by priority until
+// the priority area is full, then by walking the pool's fee index from the top.
+// A transaction whose memory pool parents are not in the block yet waits until
+// they are. Fees and sigops come from the pool entries, so nothing has to be
+// looked up in the coins; with fCheckInputs every transaction is connected to
+// a coins view as it is added instead, the way blocks used to be assembled.
+class CTxSelector
 {
-    bool byFee;
+private:
+    CBlockTemplate* pblocktemplate;
+    CBlockIndex* pindexPrev;
+    bool fCheckInputs;
+    bool fPrintPriority;
+    CCoinsViewCache view;
+    std::set<uint256> setAdded;
+    std::map<uint256, unsigned int> mapWaiting; // parents each waiting transaction still needs
+    std::map<uint256, std::vector<txiter> > mapDependers;
+
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    int64_t nFees;
+    bool fComplete; // no candidate was left out for limits, finality or inputs
+    std::vector<uint256> vAdded;
+
+    CTxSelector(CBlockTemplate* pblocktemplateIn, CBlockIndex* pindexPrevIn, bool fCheckInputsIn) :
+        pblocktemplate(pblocktemplateIn), pindexPrev(pindexPrevIn), fCheckInputs(fCheckInputsIn),
+        view(*pcoinsTip, true)
     {
-        if (byFee)
-        {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
+        fPrintPriority = GetBoolArg("-printpriority", false);
+
+        // Largest block you're willing to create:
+        nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+        // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+        nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+
+        // How much of the block should be dedicated to high-priority transactions,
+        // included regardless of the fees they pay
+        nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+        nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+
+        // Minimum block size you want to create; block will be filled with free transactions
+        // until there are no more or the block reaches this size:
+        nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+        nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+
+        nBlockSize = 1000;
+        nBlockTx = 0;
+        nBlockSigOps = 100;
+        nFees = 0;
+        fComplete = true;
     }
-};
 
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
-{
-    // Create new block
-    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-    CBlockIndex* pindexPrev = chainActive.Tip();
-    if (!confAlgoIsSet) {
-      miningAlgo = GetArg("-miningalgo", miningAlgo);
-      confAlgoIsSet = true;
-    }
-    // To simulate v3 blocks occuring after nForkHeight
-    if (TestNet() && pindexPrev->nHeight < 300 && miningAlgo==0) {
-      pblock->nVersion = 3;
+    bool Matches(const CTemplateSelection& selection) const
+    {
+        return selection.hashPrevBlock == pindexPrev->GetBlockHash() &&
+               selection.nHeight == pindexPrev->nHeight &&
+               selection.nBlockMaxSize == nBlockMaxSize &&
+               selection.nBlockPrioritySize == nBlockPrioritySize &&
+               selection.nBlockMinSize == nBlockMinSize;
     }
 
-    //LogPrintf("pindexPrev nHeight = %d while nForkHeight = %d\n",pindexPrev->nHeight,nForkHeight);
-    if (pindexPrev->nHeight >= nForkHeight - 1 && CBlockIndex::IsSuperMajority(4,pindexPrev,75,100)) {
-      //LogPrintf("algo set to %d\n",miningAlgo);
-      //pblock->nVersion = 3;
-      //LogPrintf("pblock nVersion is %d\n",pblock->nVersion);
-      pblock->SetAlgo(miningAlgo);
-      //pblock->SetVariant2(true);
-      //pblock->SetChainId(Params().GetAuxpowChainId());
-      //LogPrintf("after setting algo to %d, it is %d\n",miningAlgo,pblock->nVersion);
+    void Save(CTemplateSelection& selection, uint64_t nMempoolSequence) const
+    {
+        selection.hashPrevBlock = pindexPrev->GetBlockHash();
+        selection.nHeight = pindexPrev->nHeight;
+        selection.nBlockMaxSize = nBlockMaxSize;
+        selection.nBlockPrioritySize = nBlockPrioritySize;
+        selection.nBlockMinSize = nBlockMinSize;
+        selection.nMempoolSequence = nMempoolSequence;
+        selection.vHash = vAdded;
     }
 
-	// Q? <<< How does this affect functioning of TestNet
-    if (TestNet() && pindexPrev->nHeight < 1725) {
-      pblock->SetVariant(false);
+    bool IsCandidate(txiter it)
+    {
+        const CTransaction& tx = it->second.GetTx();
+        if (tx.IsCoinBase())
+            return false;
+        if (!IsFinalTx(tx, pindexPrev->nHeight + 1))
+        {
+            fComplete = false;
+            return false;
+        }
+        return !setAdded.count(it->first);
     }
 
-    // Create coinbase tx
-    CTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
-    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
-
-    // Add our coinbase tx as first transaction
-    pblock->vtx.push_back(txNew);
-    pblocktemplate->vTxFees.push_back(-1); // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
-
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
-
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
-
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
-
-    // Collect memory pool transactions into the block
-    int64_t nFees = 0;
+    // False if some memory pool parents are not in the block yet; the
+    // transaction is then released by Add once they are.
+    bool IsReady(txiter it)
     {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        CCoinsViewCache view(*pcoinsTip, true);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
+        if (mapWaiting.count(it->first))
+            return false;
+        unsigned int nMissing = 0;
+        BOOST_FOREACH(const CTxIn& txin, it->second.GetTx().vin)
         {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || !IsFinalTx(tx, pindexPrev->nHeight + 1))
+            if (setAdded.count(txin.prevout.hash) || !mempool.mapTx.count(txin.prevout.hash))
                 continue;
+            mapDependers[txin.prevout.hash].push_back(it);
+            nMissing++;
+        }
+        if (nMissing == 0)
+            return true;
+        mapWaiting[it->first] = nMissing;
+        return false;
+    }
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            int64_t nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins &coins = view.GetCoins(txin.prevout.hash);
-
-                int64_t nValueIn = coins.vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
+    // Add a ready transaction if it fits. Transactions that were waiting for it
+    // are appended to vReleased.
+    bool Add(txiter it, bool fSortedByFee, std::vector<txiter>& vReleased)
+    {
+        const CTxMemPoolEntry& entry = it->second;
+        const CTransaction& tx = entry.GetTx();
+        unsigned int nTxSize = entry.GetTxSize();
+        double dPriority = entry.GetPriority(pindexPrev->nHeight + 1);
+        double dFeePerKb = entry.GetFeePerKb();
+
+        // Size limits
+        if (nBlockSize + nTxSize >= nBlockMaxSize)
+        {
+            fComplete = false;
+            return false;
+        }
 
-                int nConf = pindexPrev->nHeight - coins.nHeight + 1;
+        // Skip free transactions if we're past the minimum block size, unless
+        // they would have made it into the high-priority area:
+        if (fSortedByFee && (dFeePerKb < CTransaction::nMinRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize) &&
+            !(nBlockSize + nTxSize < nBlockPrioritySize && AllowFree(dPriority)))
+            return false;
 
-                dPriority += (double)nValueIn * nConf;
+        int64_t nTxFees = entry.GetFee();
+        unsigned int nTxSigOps = entry.GetSigOps();
+        CValidationState state;
+        if (fCheckInputs)
+        {
+            if (!view.HaveInputs(tx))
+            {
+                fComplete = false;
+                return false;
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
+            nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+            nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, view);
+        }
+        if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        {
+            fComplete = false;
+            return false;
+        }
+        if (fCheckInputs)
+        {
+            if (!CheckInputs(tx, state, view, true, SCRIPT_VERIFY_P2SH))
+            {
+                fComplete = false;
+                return false;
+            }
+            CTxUndo txundo;
+            UpdateCoins(tx, state, view, txundo, pindexPrev->nHeight+1, it->first);
+        }
 
-            // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-            // client code rounds up the size to the nearest 1K. That's good, because it gives an
-            // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
+        // Added
+        pblocktemplate->block.vtx.push_back(tx);
+        pblocktemplate->vTxFees.push_back(nTxFees);
+        pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += nTxSize;
+        ++nBlockTx;
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
+        setAdded.insert(it->first);
+        vAdded.push_back(it->first);
+
+        if (fPrintPriority)
+        {
+            LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
+                   dPriority, dFeePerKb, it->first.ToString());
+        }
 
-            if (porphan)
+        // Release transactions that were waiting for this one
+        std::map<uint256, std::vector<txiter> >::iterator mi = mapDependers.find(it->first);
+        if (mi != mapDependers.end())
+        {
+            BOOST_FOREACH(txiter itChild, mi->second)
             {
-                porphan->dPriority = dPriority;
-                porphan->dFeePerKb = dFeePerKb;
+                std::map<uint256, unsigned int>::iterator mw = mapWaiting.find(itChild->first);
+                if (mw != mapWaiting.end() && --mw->second == 0)
+                {
+                    mapWaiting.erase(mw);
+                    vReleased.push_back(itChild);
+                }
             }
-            else
-                vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &mi->second.GetTx()));
+            mapDependers.erase(mi);
         }
+        return true;
+    }
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
+    // Put back the transactions of a previous selection, in their order
+    bool Replay(const std::vector<uint256>& vHash)
+    {
+        std::vector<txiter> vReleased;
+        BOOST_FOREACH(const uint256& hash, vHash)
+        {
+            txiter it = mempool.mapTx.find(hash);
+            if (it == mempool.mapTx.end() || !Add(it, false, vReleased))
+                return false;
+        }
+        return true;
+    }
 
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+    // Fill the block from the pool, only looking at entries added after
+    // nSequenceBase; those before are already in from Replay.
+    void Select(uint64_t nSequenceBase)
+    {
+        std::vector<txiter> vReleased;
+        bool fSortedByFee = (nBlockPrioritySize <= 0) || nSequenceBase > 0;
 
-        while (!vecPriority.empty())
+        if (!fSortedByFee)
         {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            double dFeePerKb = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+            // Priority grows with height, so this ordering can't be kept in the
+            // pool, but the entries hold all that is needed to work it out
+            std::vector<TxScore> vecPriority;
+            vecPriority.reserve(mempool.mapTx.size());
+            for (txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+                if (IsCandidate(it))
+                    vecPriority.push_back(TxScore(it->second.GetPriority(pindexPrev->nHeight + 1), it));
+
+            TxScoreCompare comparer;
+            std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+            while (!vecPriority.empty())
+            {
+                // Take highest priority transaction off the priority queue:
+                double dPriority = vecPriority.front().first;
+                txiter it = vecPriority.front().second;
+                std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                vecPriority.pop_back();
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+                if (setAdded.count(it->first))
+                    continue;
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+                // Prioritize by fee once past the priority size or we run out of high-priority
+                // transactions:
+                if ((nBlockSize + it->second.GetTxSize() >= nBlockPrioritySize) || !AllowFree(dPriority))
+                    break;
 
-            // Skip free transactions if we're past the minimum block size:
-            if (fSortedByFee && (dFeePerKb < CTransaction::nMinRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+                if (!IsReady(it))
+                    continue;
+                vReleased.clear();
+                Add(it, false, vReleased);
+                BOOST_FOREACH(txiter itChild, vReleased)
+                {
+                    vecPriority.push_back(TxScore(itChild->second.GetPriority(pindexPrev->nHeight + 1), itChild));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                }
+            }
+        }
 
-            // Prioritize by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
+        // The rest goes by fee: walk the fee index from the top, merging in the
+        // transactions whose parents have made it into the block
+        std::vector<TxScore> vecReady;
+        TxScoreCompare comparer;
+        CTxMemPool::FeeIndex::const_reverse_iterator ri = mempool.setTxByFee.rbegin();
+        while (true)
+        {
+            txiter it;
+            if (!vecReady.empty() && (ri == mempool.setTxByFee.rend() || vecReady.front().first >= ri->first))
             {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                it = vecReady.front().second;
+                std::pop_heap(vecReady.begin(), vecReady.end(), comparer);
+                vecReady.pop_back();
+                if (setAdded.count(it->first))
+                    continue;
             }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            int64_t nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, SCRIPT_VERIFY_P2SH))
-                continue;
-
-            CTxUndo txundo;
-            uint256 hash = tx.GetHash();
-            UpdateCoins(tx, state, view, txundo, pindexPrev->nHeight+1, hash);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority)
+            else if (ri != mempool.setTxByFee.rend())
             {
-                LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
-                       dPriority, dFeePerKb, tx.GetHash().ToString());
+                it = mempool.mapTx.find(ri->second);
+                ++ri;
+                if (it->second.GetSequence() <= nSequenceBase || !IsCandidate(it) || !IsReady(it))
+                    continue;
             }
+            else
+                break;
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
+            vReleased.clear();
+            if (!Add(it, true, vReleased))
+                continue;
+            BOOST_FOREACH(txiter itChild, vReleased)
             {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
+                vecReady.push_back(TxScore(itChild->second.GetFeePerKb(), itChild));
+                std::push_heap(vecReady.begin(), vecReady.end(), comparer);
             }
         }
+    }
+};
+
+// Fill in the fields of a template that depend on the algo: version bits, target
+// and coinbase value. The transaction set and the merkle branch of the coinbase
+// stay as they are, so one selection of transactions serves every algo.
+static void SetBlockTemplateAlgo(CBlockTemplate* pblocktemplate, CBlockIndex* pindexPrev, int algo)
+{
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+    pblock->nVersion = CPureBlockHeader::CURRENT_VERSION;
+
+    // To simulate v3 blocks occuring after nForkHeight
+    if (TestNet() && pindexPrev->nHeight < 300 && algo==0) {
+      pblock->nVersion = 3;
+    }
+
+    //LogPrintf("pindexPrev nHeight = %d while nForkHeight = %d\n",pindexPrev->nHeight,nForkHeight);
+    if (pindexPrev->nHeight >= nForkHeight - 1 && pindexPrev->IsForkMajority()) {
+      //LogPrintf("algo set to %d\n",algo);
+      //pblock->nVersion = 3;
+      //LogPrintf("pblock nVersion is %d\n",pblock->nVersion);
+      pblock->SetAlgo(algo);
+      //pblock->SetVariant2(true);
+      //pblock->SetChainId(Params().GetAuxpowChainId());
+      //LogPrintf("after setting algo to %d, it is %d\n",algo,pblock->nVersion);
+    }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        //LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+	// Q? <<< How does this affect functioning of TestNet
+    if (TestNet() && pindexPrev->nHeight < 1725) {
+      pblock->SetVariant(false);
+    }
 
-	if (pindexPrev->nHeight>=nForkHeight-1 && CBlockIndex::IsSuperMajority(4,pindexPrev,75,100)) {
+	if (pindexPrev->nHeight>=nForkHeight-1 && pindexPrev->IsForkMajority()) {
 	  //LogPrintf("miner on fork\n");
 	  CBlockIndex * pprev_algo = pindexPrev;
-	  if (GetAlgo(pprev_algo->nVersion)!=miningAlgo) {
-	    pprev_algo = get_pprev_algo(pindexPrev,miningAlgo);
+	  if (GetAlgo(pprev_algo->nVersion)!=algo) {
+	    pprev_algo = get_pprev_algo(pindexPrev,algo);
 	  }
 	  if (!pprev_algo) {
 	    //LogPrintf("miner set update ssf\n");
@@ -378,42 +466,153 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 	  }
 	}
 
-	//pblock->vtx[0].vout[0].nValue = GetBlockValue(pindexPrev, nFees);
-	pblocktemplate->vTxFees[0] = -nFees;
-
 	// Fill in header
 	pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
 	//printf("create new block with hash prev = %s (height %d)\n",pblock->hashPrevBlock.GetHex().c_str(),pindexPrev->nHeight);
 
 	UpdateTime(*pblock, pindexPrev);
-	pblock->nBits          = GetNextWorkRequired(pindexPrev, miningAlgo);
+	pblock->nBits          = GetNextWorkRequired(pindexPrev, algo);
 	//LogPrintf("create block nBits = %s\n",CBigNum().SetCompact(pblock->nBits).getuint256().GetHex().c_str());
 	pblock->nNonce         = 0;
-	if (miningAlgo==ALGO_EQUIHASH) {
-	  pblock->nNonce256.SetNull();
-	  pblock->nSolution.clear();
-	}
-	pblock->vtx[0].vin[0].scriptSig = CScript() << OP_0 << OP_0;
-	pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
-	
+	pblock->nNonce256.SetNull();
+	pblock->nSolution.clear();
+
         CBlockIndex indexDummy(*pblock);
         indexDummy.pprev = pindexPrev;
         indexDummy.nHeight = pindexPrev->nHeight + 1;
+        indexDummy.BuildForkState();
+        indexDummy.BuildAlgoSkip();
 
-	pblock->vtx[0].vout[0].nValue = GetBlockValue(&indexDummy, nFees, false);
+	int64_t nFees = -pblocktemplate->vTxFees[0];
+	CMutableTransaction txCoinbase(pblock->vtx[0]);
+	txCoinbase.vout[0].nValue = GetBlockValue(&indexDummy, nFees, false);
+	pblock->vtx[0] = txCoinbase;
 
-        CCoinsViewCache viewNew(*pcoinsTip, true);
+	pblock->vMerkleTree.clear();
+	pblock->hashMerkleRoot = CBlock::CheckMerkleBranch(pblock->vtx[0].GetHash(), pblocktemplate->vCoinbaseMerkleBranch, 0);
+}
 
-        CValidationState state;	
-	
-        if (!ConnectBlock(*pblock, state, &indexDummy, viewNew, true))
-            throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    if (!confAlgoIsSet) {
+      miningAlgo = GetArg("-miningalgo", miningAlgo);
+      confAlgoIsSet = true;
+    }
+    return CreateNewBlock(scriptPubKeyIn, miningAlgo);
+}
+
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, int algo)
+{
+    // Create new block
+    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if(!pblocktemplate.get())
+        return NULL;
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Create coinbase tx
+    CMutableTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+
+    // Add our coinbase tx as first transaction
+    pblock->vtx.push_back(txNew);
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+
+    // Collect memory pool transactions into the block
+    {
+        LOCK2(cs_main, mempool.cs);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        uint64_t nMempoolSequence = mempool.GetSequence();
+
+        // Transactions are first taken on the word of their pool entries and
+        // only checked by ConnectBlock at the end. Should that fail, the block
+        // is assembled again with every transaction checked as it goes in.
+        bool fCheckInputs = false;
+        while (true)
+        {
+            pblock->vtx.resize(1);
+            pblocktemplate->vTxFees.resize(1);
+            pblocktemplate->vTxSigOps.resize(1);
+
+            CTxSelector selector(pblocktemplate.get(), pindexPrev, fCheckInputs);
+            uint64_t nSequenceBase = 0;
+            if (!fCheckInputs && selector.Matches(lastSelection))
+            {
+                if (!selector.Replay(lastSelection.vHash))
+                {
+                    lastSelection.SetNull();
+                    continue;
+                }
+                nSequenceBase = lastSelection.nMempoolSequence;
+            }
+            selector.Select(nSequenceBase);
+
+            nLastBlockTx = selector.nBlockTx;
+            nLastBlockSize = selector.nBlockSize;
+            //LogPrintf("CreateNewBlock(): total size %u\n", selector.nBlockSize);
+
+            //pblock->vtx[0].vout[0].nValue = GetBlockValue(pindexPrev, nFees);
+            pblocktemplate->vTxFees[0] = -selector.nFees;
+            CMutableTransaction txCoinbase(pblock->vtx[0]);
+            txCoinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+            pblock->vtx[0] = txCoinbase;
+            pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+
+            // The branch does not depend on the coinbase, only the root does
+            pblock->BuildMerkleTree();
+            pblocktemplate->vCoinbaseMerkleBranch = pblock->GetMerkleBranch(0);
+
+            SetBlockTemplateAlgo(pblocktemplate.get(), pindexPrev, algo);
+
+            CBlockIndex indexDummy(*pblock);
+            indexDummy.pprev = pindexPrev;
+            indexDummy.nHeight = pindexPrev->nHeight + 1;
+            indexDummy.BuildForkState();
+            indexDummy.BuildAlgoSkip();
+
+            CCoinsViewCache viewNew(*pcoinsTip, true);
+
+            CValidationState state;
+
+            if (ConnectBlock(*pblock, state, &indexDummy, viewNew, true))
+            {
+                // Later templates on this tip can start from this one if
+                // nothing in the pool was left out
+                if (!fCheckInputs && selector.fComplete)
+                    selector.Save(lastSelection, nMempoolSequence);
+                else
+                    lastSelection.SetNull();
+                break;
+            }
+            if (fCheckInputs)
+                throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
+
+            LogPrintf("CreateNewBlock() : %s, assembling again with input checks\n", state.GetRejectReason());
+            lastSelection.SetNull();
+            fCheckInputs = true;
+        }
     }
 
     return pblocktemplate.release();
 }
 
-void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+CBlockTemplate* CopyBlockTemplateForAlgo(const CBlockTemplate& blocktemplate, CBlockIndex* pindexPrev, int algo)
+{
+    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate(blocktemplate));
+    if(!pblocktemplate.get())
+        return NULL;
+    pblocktemplate->block.auxpow.reset();
+    CMutableTransaction txCoinbase(pblocktemplate->block.vtx[0]);
+    txCoinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    pblocktemplate->block.vtx[0] = txCoinbase;
+    SetBlockTemplateAlgo(pblocktemplate.get(), pindexPrev, algo);
+    return pblocktemplate.release();
+}
+
+static void SetExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
     static uint256 hashPrevBlock;
@@ -424,12 +623,26 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     }
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    pblock->vtx[0].vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
-    assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
+    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
+    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+    pblock->vtx[0] = txCoinbase;
+}
 
+void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+{
+    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
+void IncrementExtraNonce(CBlockTemplate* pblocktemplate, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+{
+    CBlock *pblock = &pblocktemplate->block;
+    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
+    pblock->vMerkleTree.clear();
+    pblock->hashMerkleRoot = CBlock::CheckMerkleBranch(pblock->vtx[0].GetHash(), pblocktemplate->vCoinbaseMerkleBranch, 0);
+}
+
 
 void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash1)
 {
@@ -476,12 +689,99 @@ void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash
     memcpy(phash1, &tmp.hash1, 64);
 }
 
+CMinerHasher::CMinerHasher() : algo(ALGO_SHA256D)
+{
+}
+
+void CMinerHasher::SetHeader(const CBlockHeader& header, int algoIn)
+{
+    algo = algoIn;
+    switch (algo)
+    {
+    case ALGO_SCRYPT:
+        if (vScratchpad.empty())
+            vScratchpad.resize(SCRYPT_MANY_SCRATCHPAD_SIZE);
+        break;
+    }
+}
+
+uint256 CMinerHasher::GetPoWHash(const CBlockHeader& header)
+{
+    switch (algo)
+    {
+    case ALGO_SHA256D:
+        {
+            uint256 hash;
+            SHA256D80Nonces(hash.begin(), (const unsigned char*)BEGIN(header.nVersion), 1);
+            return hash;
+        }
+    case ALGO_SCRYPT:
+        {
+            uint256 thash;
+            scrypt_1024_1_1_256_sp(BEGIN(header.nVersion), BEGIN(thash), &vScratchpad[0]);
+            return thash;
+        }
+    }
+    // Argon2d and CryptoNight keep their memory in the thread's CPoWHasher
+    return header.GetPoWHash(algo);
+}
+
+bool CMinerHasher::FindHash(CBlockHeader& header, const uint256& hashTarget, const unsigned char* hashes, unsigned int nTried)
+{
+    unsigned int nFirst = header.nNonce;
+    for (unsigned int i = 0; i < nTried; i++)
+    {
+        uint256 hash;
+        memcpy(hash.begin(), hashes + 32 * i, 32);
+        if (hash <= hashTarget)
+        {
+            header.nNonce = nFirst + i;
+            return true;
+        }
+    }
+    header.nNonce = nFirst + nTried - 1;
+    return false;
+}
+
+bool CMinerHasher::ScanSHA256D(CBlockHeader& header, const uint256& hashTarget, unsigned int& nTried)
+{
+    unsigned char hashes[32 * SHA256D_BATCH];
+    nTried = (unsigned int)std::min<uint64_t>(SHA256D_BATCH, 0x100000000ULL - header.nNonce);
+    SHA256D80Nonces(hashes, (const unsigned char*)BEGIN(header.nVersion), nTried);
+    return FindHash(header, hashTarget, hashes, nTried);
+}
+
+bool CMinerHasher::ScanX17(CBlockHeader& header, const uint256& hashTarget, unsigned int& nTried)
+{
+    unsigned char headers[80 * X17_BATCH];
+    uint256 hashes[X17_BATCH];
+    nTried = (unsigned int)std::min<uint64_t>(X17_BATCH, 0x100000000ULL - header.nNonce);
+    CBlockHeader tmp(header);
+    for (unsigned int i = 0; i < nTried; i++, tmp.nNonce++)
+        memcpy(headers + 80 * i, BEGIN(tmp.nVersion), 80);
+    CPoWHasher::ForThread().X17().HashMany(hashes, headers, 80, nTried);
+    return FindHash(header, hashTarget, hashes[0].begin(), nTried);
+}
+
+bool CMinerHasher::ScanScrypt(CBlockHeader& header, const uint256& hashTarget, unsigned int& nTried)
+{
+    unsigned char headers[80 * SCRYPT_BATCH];
+    uint256 hashes[SCRYPT_BATCH];
+    nTried = (unsigned int)std::min<uint64_t>(SCRYPT_BATCH, 0x100000000ULL - header.nNonce);
+    CBlockHeader tmp(header);
+    for (unsigned int i = 0; i < nTried; i++, tmp.nNonce++)
+        memcpy(headers + 80 * i, BEGIN(tmp.nVersion), 80);
+    scrypt_1024_1_1_256_sp_many((const char*)headers, BEGIN(hashes[0]), nTried, &vScratchpad[0]);
+    return FindHash(header, hashTarget, hashes[0].begin(), nTried);
+}
+
 #ifdef ENABLE_WALLET
 //////////////////////////////////////////////////////////////////////////////
 //
 // Internal miner
 //
 double dHashesPerSec = 0.0;
+double dSolutionsPerSec = 0.0;
 int64_t nHPSTimerStart = 0;
 
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey)
@@ -494,6 +794,16 @@ CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey)
     return CreateNewBlock(scriptPubKey);
 }
 
+CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, int algo)
+{
+    CPubKey pubkey;
+    if (!reservekey.GetReservedKey(pubkey))
+        return NULL;
+
+    CScript scriptPubKey = CScript() << pubkey << OP_CHECKSIG;
+    return CreateNewBlock(scriptPubKey, algo);
+}
+
 bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
 {
     uint256 hash;
@@ -538,21 +848,345 @@ bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
     return true;
 }
 
-void static BitmarkMiner(CWallet *pwallet)
+// Equihash solver that keeps its memory and its threads for as long as the
+// miner worker that owns it. Each run is shared by nThreads threads using the
+// solver's own barrier: the caller takes part as thread 0 and the helpers wait
+// on the barrier between runs.
+class CEquihashSolver
+{
+private:
+    equi eq;
+    crypto_generichash_blake2b_state stateHeader;
+    boost::thread_group helperThreads;
+    bool fStop;
+
+    CEquihashSolver(const CEquihashSolver&);
+    CEquihashSolver& operator=(const CEquihashSolver&);
+
+    void Run(u32 id)
+    {
+        eq.digit0(id);
+        barrier(&eq.barry);
+        if (id == 0) {
+            eq.xfull = eq.bfull = eq.hfull = 0;
+            eq.showbsizes(0);
+        }
+        barrier(&eq.barry);
+        for (u32 r = 1; r < WK; r++) {
+            (r&1) ? eq.digitodd(r, id) : eq.digiteven(r, id);
+            barrier(&eq.barry);
+            if (id == 0) {
+                eq.xfull = eq.bfull = eq.hfull = 0;
+                eq.showbsizes(r);
+            }
+            barrier(&eq.barry);
+        }
+        eq.digitK(id);
+        barrier(&eq.barry);
+    }
+
+    void Helper(u32 id)
+    {
+        while (true) {
+            barrier(&eq.barry);
+            if (fStop)
+                return;
+            Run(id);
+        }
+    }
+
+public:
+    CEquihashSolver(u32 nThreads) : eq(nThreads), fStop(false)
+    {
+        for (u32 id = 1; id < nThreads; id++)
+            helperThreads.create_thread(boost::bind(&CEquihashSolver::Helper, this, id));
+    }
+
+    ~CEquihashSolver()
+    {
+        fStop = true;
+        barrier(&eq.barry);
+        helperThreads.join_all();
+    }
+
+    // Hash the header up to nNonce256; again whenever any of it changes
+    void SetHeader(const CBlockHeader& header)
+    {
+        EhInitialiseState(Params().EquihashN(), Params().EquihashK(), stateHeader);
+        CEquihashInput I{header};
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << I;
+        crypto_generichash_blake2b_update(&stateHeader, (unsigned char*)&ss[0], ss.size());
+    }
+
+    // Run the solver on the header with its current nNonce256 and leave the
+    // first solution that meets hashTarget in block.nSolution
+    bool Solve(CBlock& block, const uint256& hashTarget, unsigned int& nSolutions)
+    {
+        crypto_generichash_blake2b_state state = stateHeader;
+        crypto_generichash_blake2b_update(&state, block.nNonce256.begin(), block.nNonce256.size());
+        eq.setstate(&state);
+        barrier(&eq.barry);
+        Run(0);
+
+        nSolutions = std::min((u32)eq.nsols, MAXSOLS);
+        std::vector<eh_index> index_vector(PROOFSIZE);
+        for (size_t s = 0; s < nSolutions; s++) {
+            for (size_t i = 0; i < PROOFSIZE; i++) {
+                index_vector[i] = eq.sols[s][i];
+            }
+            block.nSolution = GetMinimalFromIndices(index_vector, DIGITBITS);
+            if (block.GetPoWHash(ALGO_EQUIHASH) <= hashTarget)
+                return true;
+        }
+        return false;
+    }
+};
+
+// Hashes (Equihash solver runs) and Equihash solutions of one worker, on a
+// cache line of their own so that the workers never write to the same line
+// and the coordinator can read them without a lock
+struct CHashCounter
+{
+    std::atomic<uint64_t> nHashes;
+    std::atomic<uint64_t> nSolutions;
+    char pchPadding[64 - 2 * sizeof(std::atomic<uint64_t>)];
+
+    CHashCounter() : nHashes(0), nSolutions(0) {}
+};
+
+// State shared by the coordinator and the workers of one run of the miner.
+//
+// The coordinator builds one template per tip and publishes it as a new
+// generation. Each worker takes a copy and searches its own extranonces, so
+// the threads never hash the same header. A worker that finds a block hands
+// it back to the coordinator, which owns the key and submits the block.
+class CMinerContext
+{
+private:
+    CWaitableCriticalSection cs;
+    CConditionVariable cvWork;
+    CConditionVariable cvFound;
+    boost::shared_ptr<CBlockTemplate> pblocktemplate;
+    CBlockIndex* pindexPrev;
+    boost::shared_ptr<CBlock> pblockFound;
+
+    // Hash meter, only used by the coordinator
+    int64_t nMeterStart;
+    uint64_t nMeterHashes;
+    uint64_t nMeterSolutions;
+
+public:
+    const int nThreads;
+    const int nSolverThreads; // threads per Equihash solver run
+    std::atomic<unsigned int> nGeneration;
+    std::vector<CHashCounter> vCounters;
+
+    CMinerContext(int nThreadsIn, int nSolverThreadsIn) : pindexPrev(NULL), nMeterStart(0), nMeterHashes(0), nMeterSolutions(0),
+                                                          nThreads(nThreadsIn), nSolverThreads(nSolverThreadsIn),
+                                                          nGeneration(0), vCounters(nThreadsIn)
+    {
+    }
+
+    void SetWork(const boost::shared_ptr<CBlockTemplate>& pblocktemplateIn, CBlockIndex* pindexPrevIn)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            pblocktemplate = pblocktemplateIn;
+            pindexPrev = pindexPrevIn;
+            pblockFound.reset();
+            nGeneration++;
+        }
+        cvWork.notify_all();
+    }
+
+    // Wait for a generation after nLast; returns it with its template
+    unsigned int WaitForWork(unsigned int nLast, boost::shared_ptr<CBlockTemplate>& pblocktemplateOut, CBlockIndex*& pindexPrevOut)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nGeneration == nLast || !pblocktemplate)
+            cvWork.wait(lock);
+        pblocktemplateOut = pblocktemplate;
+        pindexPrevOut = pindexPrev;
+        return nGeneration;
+    }
+
+    // Only the first block found on a generation is kept
+    void SubmitBlock(const CBlock& block, unsigned int nBlockGeneration)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (nBlockGeneration != nGeneration || pblockFound)
+                return;
+            pblockFound.reset(new CBlock(block));
+        }
+        cvFound.notify_one();
+    }
+
+    boost::shared_ptr<CBlock> WaitForBlock(int64_t nMillis)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!pblockFound)
+            cvFound.timed_wait(lock, boost::posix_time::milliseconds(nMillis));
+        boost::shared_ptr<CBlock> pblock = pblockFound;
+        pblockFound.reset();
+        return pblock;
+    }
+
+    void UpdateHashMeter()
+    {
+        uint64_t nTotal = 0;
+        uint64_t nTotalSolutions = 0;
+        for (int i = 0; i < nThreads; i++)
+        {
+            nTotal += vCounters[i].nHashes.load(std::memory_order_relaxed);
+            nTotalSolutions += vCounters[i].nSolutions.load(std::memory_order_relaxed);
+        }
+        int64_t nNow = GetTimeMillis();
+        if (nMeterStart == 0)
+        {
+            nMeterStart = nNow;
+            nMeterHashes = nTotal;
+            nMeterSolutions = nTotalSolutions;
+        }
+        else if (nNow - nMeterStart > 4000)
+        {
+            dHashesPerSec = 1000.0 * (nTotal - nMeterHashes) / (nNow - nMeterStart);
+            dSolutionsPerSec = 1000.0 * (nTotalSolutions - nMeterSolutions) / (nNow - nMeterStart);
+            nHPSTimerStart = nNow;
+            nMeterStart = nNow;
+            nMeterHashes = nTotal;
+            nMeterSolutions = nTotalSolutions;
+        }
+    }
+};
+
+void static BitmarkMinerWorker(CMinerContext* pcontext, int nThread)
 {
-    LogPrintf("BitmarkMiner started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("bitmark-minerw");
+
+    CMinerHasher hasher;
+    boost::scoped_ptr<CEquihashSolver> psolver; // allocated on the first Equihash work
+    std::atomic<uint64_t>& nHashes = pcontext->vCounters[nThread].nHashes;
+    std::atomic<uint64_t>& nSolutions = pcontext->vCounters[nThread].nSolutions;
+    unsigned int nGeneration = 0;
+
+    while (true)
+    {
+        boost::shared_ptr<CBlockTemplate> pblocktemplate;
+        CBlockIndex* pindexPrev;
+        nGeneration = pcontext->WaitForWork(nGeneration, pblocktemplate, pindexPrev);
+
+        CBlock block = pblocktemplate->block;
+        unsigned int nHeight = pindexPrev->nHeight + 1;
+        int algo = block.nVersion <= 3 ? ALGO_SCRYPT : miningAlgo;
+        uint256 hashTarget = CBigNum().SetCompact(block.nBits).getuint256();
+        bool fFound = false;
+
+        // Extranonces nThread+1, nThread+1+nThreads, ... keep the workers apart
+        for (unsigned int nExtraNonce = nThread + 1; !fFound; nExtraNonce += pcontext->nThreads)
+        {
+            CMutableTransaction txCoinbase(block.vtx[0]);
+            txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
+            assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+            block.vtx[0] = txCoinbase;
+            block.vMerkleTree.clear();
+            block.hashMerkleRoot = CBlock::CheckMerkleBranch(block.vtx[0].GetHash(), pblocktemplate->vCoinbaseMerkleBranch, 0);
+            UpdateTime(block, pindexPrev);
+            block.nNonce = 0;
+            block.nNonce256.SetNull();
+            if (algo == ALGO_EQUIHASH) {
+                if (!psolver)
+                    psolver.reset(new CEquihashSolver(pcontext->nSolverThreads));
+                psolver->SetHeader(block);
+            } else {
+                hasher.SetHeader(block, algo);
+            }
+
+            unsigned int nHashesDone = 0;
+            while (true)
+            {
+                if (algo == ALGO_EQUIHASH) {
+                    unsigned int nRunSolutions = 0;
+                    fFound = psolver->Solve(block, hashTarget, nRunSolutions);
+                    nSolutions.fetch_add(nRunSolutions, std::memory_order_relaxed);
+                } else if (algo == ALGO_SHA256D) {
+                    unsigned int nTried;
+                    fFound = hasher.ScanSHA256D(block, hashTarget, nTried);
+                    nHashesDone += nTried - 1;
+                } else if (algo == ALGO_X17) {
+                    unsigned int nTried;
+                    fFound = hasher.ScanX17(block, hashTarget, nTried);
+                    nHashesDone += nTried - 1;
+                } else if (algo == ALGO_SCRYPT) {
+                    unsigned int nTried;
+                    fFound = hasher.ScanScrypt(block, hashTarget, nTried);
+                    nHashesDone += nTried - 1;
+                } else {
+                    fFound = (hasher.GetPoWHash(block) <= hashTarget);
+                }
+                nHashesDone++;
+                if (fFound)
+                    break;
+                if (pcontext->nGeneration.load(std::memory_order_relaxed) != nGeneration)
+                    break;
+
+                if (algo == ALGO_EQUIHASH) {
+                    block.nNonce256 = (CBigNum(block.nNonce256) + 1).getuint256();
+                } else if (++block.nNonce == 0) {
+                    break; // nonce range done, move on to the next extranonce
+                }
+                if (algo == ALGO_EQUIHASH || nHashesDone >= 0x100)
+                {
+                    nHashes.fetch_add(nHashesDone, std::memory_order_relaxed);
+                    nHashesDone = 0;
+                    boost::this_thread::interruption_point();
+                    // nTime comes after the sha256d midstate, but is part
+                    // of the Equihash header state
+                    unsigned int nTimeLast = block.nTime;
+                    UpdateTime(block, pindexPrev);
+                    if (algo == ALGO_EQUIHASH && block.nTime != nTimeLast)
+                        psolver->SetHeader(block);
+                }
+            }
+            nHashes.fetch_add(nHashesDone, std::memory_order_relaxed);
+            boost::this_thread::interruption_point();
+            if (pcontext->nGeneration.load(std::memory_order_relaxed) != nGeneration)
+                break;
+        }
+
+        if (fFound)
+            pcontext->SubmitBlock(block, nGeneration);
+    }
+}
+
+void static BitmarkMiner(CWallet *pwallet, int nThreads)
+{
+    LogPrintf("BitmarkMiner started with %d threads\n", nThreads);
     RenameThread("bitmark-miner");
 
-    // Each thread has its own key and counter
+    // Equihash runs are spread over all the threads by a single worker, so
+    // the solver memory (~144MB for 200,9) is only allocated once
+    int nWorkers = nThreads;
+    int nSolverThreads = 1;
+    if (miningAlgo == ALGO_EQUIHASH)
+    {
+        nWorkers = 1;
+        nSolverThreads = nThreads;
+    }
+
+    // One key and one template for all the workers
     CReserveKey reservekey(pwallet);
-    unsigned int nExtraNonce = 0;
+    CMinerContext context(nWorkers, nSolverThreads);
+
+    // In regtest mode the processor limit is the number of blocks to generate
+    int nBlocksLeft = nThreads;
 
-    int n_blocks_created = 0;
+    boost::thread_group workerThreads;
+    for (int i = 0; i < nWorkers; i++)
+        workerThreads.create_thread(boost::bind(&BitmarkMinerWorker, &context, i));
 
-    uint256 best_hash;
-    bool first_hash = true;
-    
     try { while (true) {
         if (Params().NetworkID() != CChainParams::REGTEST) {
             // Busy-wait for the network to come online so we don't waste time mining
@@ -561,232 +1195,55 @@ void static BitmarkMiner(CWallet *pwallet)
                 MilliSleep(1000);
         }
 
-	if (Params().NetworkID() == CChainParams::REGTEST) {
-	  if (n_blocks_created>0) return;
-	}
-
         //
         // Create new block
         //
         unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrev = chainActive.Tip();
 
-        auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
-	n_blocks_created++;
-        if (!pblocktemplate.get())
-            return;
-        CBlock *pblock = &pblocktemplate->block;
-        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
-	//printf("Running BitmarkMiner with %lu transactions in block (%u bytes)\n", pblock->vtx.size(),
-	//::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
-
-        //
-        // Pre-build hash buffers
-        //
-        char pmidstatebuf[32+16]; char* pmidstate = alignup<16>(pmidstatebuf);
-        char pdatabuf[128+16];    char* pdata     = alignup<16>(pdatabuf);
-        char phash1buf[64+16];    char* phash1    = alignup<16>(phash1buf);
-
-        FormatHashBuffers(pblock, pmidstate, pdata, phash1);
-
-        unsigned int& nBlockTime = *(unsigned int*)(pdata + 64 + 4);
-        unsigned int& nBlockBits = *(unsigned int*)(pdata + 64 + 8);
-        unsigned int& nBlockNonce = *(unsigned int*)(pdata + 64 + 12);
-
+        boost::shared_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
+        if (!pblocktemplate)
+            break;
+        context.SetWork(pblocktemplate, pindexPrev);
+        int64_t nStart = GetTime();
 
         //
-        // Search
+        // Wait for the workers, and rebuild the block when it goes stale
         //
-        int64_t nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
-	//LogPrintf("miner hashTarget: %s\n",hashTarget.GetHex().c_str());
-
+        bool fDone = false;
         while (true)
         {
-	  unsigned int nHashesDone = 0;
-	  uint256 thash;
-	  //char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-	  //LogPrintf("starting best hash: %s\n",best_hash.GetHex().c_str());
-	  //LogPrintf("hash target = %s\n",hashTarget.GetHex().c_str());
-
-	  if (miningAlgo==ALGO_EQUIHASH) {
-	    unsigned int n = Params().EquihashN();
-	    unsigned int k = Params().EquihashK();
-	    bool cancelSolver = false;
-	    crypto_generichash_blake2b_state state;
-	    EhInitialiseState(n, k, state);
-	    CEquihashInput I{*pblock};
-	    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-	    ss << I;
-	    /*LogPrintf("ss (%lu) = ",ss.size());
-	    for (int i=0; i<ss.size(); i++) {
-	      LogPrintf("%02x",*((unsigned char *)&ss[0]+i));
-	    }
-	    LogPrintf("\n");*/
-	    crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
-	    crypto_generichash_blake2b_state curr_state;
-	    curr_state = state;
-	    unsigned char * nonce256 = pblock->nNonce256.begin();
-	    /*LogPrintf("nonce (%lu) = ",pblock->nNonce256.size());
-	    for (int i=0; i<pblock->nNonce256.size(); i++) {
-	      LogPrintf("%02x",nonce256[i]);
-	    }
-	    LogPrintf("\n");*/
-	    
-	    crypto_generichash_blake2b_update(&curr_state,
-					      pblock->nNonce256.begin(),
-					      pblock->nNonce256.size());
-	    std::function<bool(std::vector<unsigned char>)> validBlock =
-	      [&pblock, &hashTarget, &pwallet, &reservekey, &cancelSolver] (std::vector<unsigned char> soln) {
-	      pblock->nSolution = soln;
-	      //solutionTargetChecks.increment();
-
-	      if (pblock->GetPoWHash(miningAlgo) > hashTarget) {
-		return false;
-	      }
-
-	      SetThreadPriority(THREAD_PRIORITY_NORMAL);
-	      LogPrintf("ZcashMiner:\n");
-	      LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", pblock->GetHash().GetHex(), hashTarget.GetHex());
-	      CValidationState state;
-	      if (ProcessBlock(state,NULL,pblock)) {
-		//std::lock_guard<std::mutex> lock{m_cs};
-		LOCK(cs_main);
-		cancelSolver = false;
-	      }
-
-	      SetThreadPriority(THREAD_PRIORITY_LOWEST);
-
-	      if (Params().MineBlocksOnDemand()) {
-		//ehSolverRuns.increment();
-		throw boost::thread_interrupted();
-	      }
-
-	      return true;
-	    };
-
-	    std::function<bool(EhSolverCancelCheck)> cancelled = [&cancelSolver](EhSolverCancelCheck pos) {
-	      LOCK(cs_main);
-	      return cancelSolver;
-	    };
-
-	    //tromp solver
-	    equi eq(1);
-	    eq.setstate(&curr_state);
-	    eq.digit0(0);
-	    eq.xfull = eq.bfull = eq.hfull = 0;
-	    eq.showbsizes(0);
-	    for (u32 r = 1; r < WK; r++) {
-	      (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-	      eq.xfull = eq.bfull = eq.hfull = 0;
-	      eq.showbsizes(r);
-	    }
-	    eq.digitK(0);
-	    //ehSolverRuns.increment();
-	    //LogPrintf("PROOFSIZE = %d DIGITBITS = %d\n",PROOFSIZE,DIGITBITS);
-	    for (size_t s = 0; s < eq.nsols; s++) {
-	      //LogPrint("pow", "Checking solution %d\n", s+1);
-	      std::vector<eh_index> index_vector(PROOFSIZE);
-	      for (size_t i = 0; i < PROOFSIZE; i++) {
-		index_vector[i] = eq.sols[s][i];
-	      }
-	      std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
-	      if (validBlock(sol_char)) {
-		break;
-	      }
-	    }
-
-	    pblock->nNonce256 = (CBigNum(pblock->nNonce256) + 1).getuint256();
-	    nHashesDone += 1;
-	    
-	  }
-	  else while(true) {
-	    
-	    uint256 thash;
-	    if (pblock->nVersion<=3) {
-	      thash = pblock->GetPoWHash(ALGO_SCRYPT);
-	    }
-	    else {
-	      thash = pblock->GetPoWHash(miningAlgo);
-	    }
-	    if (thash < best_hash || first_hash) {
-	      first_hash = false;
-	      best_hash = thash;
-	      //LogPrintf("best hash: %s\n",best_hash.GetHex().c_str());
-	    }
-	      
-	    if (thash <= hashTarget)
-	      {
-		SetThreadPriority(THREAD_PRIORITY_NORMAL);
-		CheckWork(pblock, *pwallet, reservekey);
-		SetThreadPriority(THREAD_PRIORITY_LOWEST);
-		break;
-	      }
-	    pblock->nNonce += 1;
-	    nHashesDone += 1;
-	    if ((pblock->nNonce & 0xFF) == 0) {
-	      //LogPrintf("break 0xff\n");
-	      break;
-	    }
-	  }
-
-	  //LogPrintf("Calc hash per sec\n");
-	  
-	  // Meter hashes/sec
-	  static int64_t nHashCounter;
-	  if (nHPSTimerStart == 0)
-            {
-	      nHPSTimerStart = GetTimeMillis();
-	      nHashCounter = 0;
-            }
-	  else
-	    nHashCounter += nHashesDone;
-	  if (GetTimeMillis() - nHPSTimerStart > 4000)
+            boost::shared_ptr<CBlock> pblock = context.WaitForBlock(100);
+            context.UpdateHashMeter();
+            if (pblock)
             {
-	      static CCriticalSection cs;
-	      {
-		LOCK(cs);
-		if (GetTimeMillis() - nHPSTimerStart > 4000)
-		  {
-		    dHashesPerSec = 1000.0 * nHashCounter / (GetTimeMillis() - nHPSTimerStart);
-		    nHPSTimerStart = GetTimeMillis();
-		    nHashCounter = 0;
-		    static int64_t nLogTime;
-		    if (GetTime() - nLogTime > 30 * 60)
-		      {
-			nLogTime = GetTime();
-			//if (!RegTest()) LogPrintf("hashmeter %6.0f khash/s\n", dHashesPerSec/1000.0);
-		      }
-		  }
-	      }
+                if (CheckWork(pblock.get(), *pwallet, reservekey) &&
+                    Params().NetworkID() == CChainParams::REGTEST && --nBlocksLeft == 0)
+                    fDone = true;
+                break;
             }
 
-	  // Check for stop or if block needs to be rebuilt
-	  boost::this_thread::interruption_point();
-	  if (vNodes.empty() && Params().NetworkID() != CChainParams::REGTEST)
-	    break;
-	  if (nBlockNonce >= 0xffff0000)
-	    break;
-	  if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-	    break;
-	  if (pindexPrev != chainActive.Tip())
-	    break;
-
-	  // Update nTime every few seconds
-	  UpdateTime(*pblock, pindexPrev);
-	  nBlockTime = ByteReverse(pblock->nTime);
-	  if (TestNet())
-            {
-	      // Changing pblock->nTime can change work required on testnet:
-	      nBlockBits = ByteReverse(pblock->nBits);
-	      hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
-            }
+            // Check for stop or if block needs to be rebuilt
+            boost::this_thread::interruption_point();
+            if (vNodes.empty() && Params().NetworkID() != CChainParams::REGTEST)
+                break;
+            if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > NEW_WORK_TX_DELAY)
+                break;
+            if (pindexPrev != chainActive.Tip())
+                break;
         }
-      } }
-    catch (boost::thread_interrupted)
-      {
+        if (fDone)
+            break;
+    } }
+    catch (...)
+    {
+        // The workers use the context on this stack
+        workerThreads.interrupt_all();
+        workerThreads.join_all();
         throw;
-      }
+    }
+    workerThreads.interrupt_all();
+    workerThreads.join_all();
 }
 
 void GenerateBitmarks(bool fGenerate, CWallet* pwallet, int nThreads)
@@ -812,8 +1269,7 @@ void GenerateBitmarks(bool fGenerate, CWallet* pwallet, int nThreads)
         return;
 
     minerThreads = new boost::thread_group();
-    for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitmarkMiner, pwallet));
+    minerThreads->create_thread(boost::bind(&BitmarkMiner, pwallet, nThreads));
 }
 
 #endif
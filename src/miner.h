@@ -8,21 +8,33 @@
 #define BITMARK_MINER_H
 
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
+class CBlockHeader;
 class CBlockIndex;
 struct CBlockTemplate;
 class CReserveKey;
 class CScript;
 class CWallet;
+class uint256;
+
+/** Seconds that longpolls and -worknotifysocket hold back new work which only
+ *  differs from the last in its transactions */
+static const int64_t NEW_WORK_TX_DELAY = 60;
 
 /** Run the miner threads */
 void GenerateBitmarks(bool fGenerate, CWallet* pwallet, int nThreads);
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, int algo);
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey);
+CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, int algo);
+/** Copy a template built on pindexPrev, with the header and coinbase value of another algo */
+CBlockTemplate* CopyBlockTemplateForAlgo(const CBlockTemplate& blocktemplate, CBlockIndex* pindexPrev, int algo);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+void IncrementExtraNonce(CBlockTemplate* pblocktemplate, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Do mining precalculation */
 void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash1);
 /** Check mined block */
@@ -30,7 +42,49 @@ bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey);
 /** Base sha256 mining transform */
 void SHA256Transform(void* pstate, void* pinput, const void* pinit);
 
+/** Proof-of-work hashing for one miner thread.
+ *
+ * Keeps what can be reused from one nonce to the next, the scrypt
+ * scratchpad. sha256d nonces are scanned in batches by the multi-lane
+ * SHA256D80Nonces, which compresses the first 64 bytes of the header once
+ * per batch, X17 nonces in batches through the stages of the thread's
+ * multi-buffer CHashX17, and scrypt nonces in batches through the widest
+ * multi-lane scrypt kernel. The other algos hash the whole header.
+ */
+class CMinerHasher
+{
+private:
+    int algo;
+    std::vector<char> vScratchpad;
+
+    bool FindHash(CBlockHeader& header, const uint256& hashTarget, const unsigned char* hashes, unsigned int nTried);
+
+public:
+    /** Nonces hashed per ScanSHA256D call */
+    static const unsigned int SHA256D_BATCH = 64;
+    /** Nonces hashed per ScanX17 call, a whole number of CHashX17 lane groups */
+    static const unsigned int X17_BATCH = 8;
+    /** Nonces hashed per ScanScrypt call */
+    static const unsigned int SCRYPT_BATCH = 8;
+
+    CMinerHasher();
+
+    /** Start on a header; again whenever anything before nTime changes */
+    void SetHeader(const CBlockHeader& header, int algo);
+    uint256 GetPoWHash(const CBlockHeader& header);
+    /** Hash up to SHA256D_BATCH sha256d nonces from header.nNonce on, without
+     *  wrapping past 0xffffffff. Leaves header.nNonce at the first one that
+     *  meets hashTarget and returns true, or at the last one tried.
+     */
+    bool ScanSHA256D(CBlockHeader& header, const uint256& hashTarget, unsigned int& nTried);
+    /** The same for up to X17_BATCH X17 nonces */
+    bool ScanX17(CBlockHeader& header, const uint256& hashTarget, unsigned int& nTried);
+    /** The same for up to SCRYPT_BATCH scrypt nonces */
+    bool ScanScrypt(CBlockHeader& header, const uint256& hashTarget, unsigned int& nTried);
+};
+
 extern double dHashesPerSec;
+extern double dSolutionsPerSec;
 extern int64_t nHPSTimerStart;
 
 extern int miningAlgo;
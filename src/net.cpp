@@ -19,6 +19,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -590,6 +591,8 @@ void CNode::copyStats(CNodeStats &stats)
     X(fInbound);
     X(nStartingHeight);
     X(nSendBytes);
+    X(nSendSyscalls);
+    X(nSendMessages);
     X(nRecvBytes);
     stats.fSyncNode = (this == pnodeSync);
 
@@ -694,25 +697,116 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 // requires LOCK(cs_vSend)
+CSendBufferPool sendBufferPool;
+
+// Size class k holds buffers with a capacity of at least 2^k bytes
+static unsigned int SendBufferClass(size_t nSize)
+{
+    unsigned int k = CSendBufferPool::MIN_CLASS;
+    while (k <= CSendBufferPool::MAX_CLASS && ((size_t)1 << k) < nSize)
+        k++;
+    return k;
+}
+
+void CSendBufferPool::Acquire(size_t nSize, CSerializeData& data)
+{
+    assert(data.empty());
+    unsigned int k = SendBufferClass(nSize);
+    if (k > MAX_CLASS) {
+        data.reserve(nSize);
+        return;
+    }
+    {
+        LOCK(cs);
+        if (!vFree[k].empty()) {
+            data.swap(vFree[k].back());
+            vFree[k].pop_back();
+            nPooledBytes -= data.capacity();
+            return;
+        }
+    }
+    data.reserve((size_t)1 << k);
+}
+
+void CSendBufferPool::Release(CSerializeData& data)
+{
+    size_t nCapacity = data.capacity();
+    if (nCapacity < ((size_t)1 << MIN_CLASS))
+        return;
+    unsigned int k = MIN_CLASS;
+    while (k < MAX_CLASS && ((size_t)1 << (k + 1)) <= nCapacity)
+        k++;
+    if (nCapacity >= ((size_t)1 << (MAX_CLASS + 1)))
+        return;
+
+    LOCK(cs);
+    if (vFree[k].size() >= MAX_BUFFERS_PER_CLASS || nPooledBytes + nCapacity > MAX_POOLED_BYTES)
+        return;
+    data.clear();
+    vFree[k].push_back(CSerializeData());
+    vFree[k].back().swap(data);
+    nPooledBytes += nCapacity;
+}
+
+size_t CSendBufferPool::GetPooledBytes()
+{
+    LOCK(cs);
+    return nPooledBytes;
+}
+
+// Maximum number of queued messages handed to a single sendmsg() call
+static const unsigned int MAX_SEND_IOV = 64;
+
 void SocketSendData(CNode *pnode)
 {
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert(it->size() > pnode->nSendOffset);
+#ifdef WIN32
+        size_t nBatchSize = it->size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &(*it)[pnode->nSendOffset], nBatchSize, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Gather as many queued messages as fit in one iovec array, so a burst
+        // of small messages (inv, ping, headers) costs one syscall instead of many
+        struct iovec iov[MAX_SEND_IOV];
+        unsigned int nIov = 0;
+        size_t nBatchSize = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (std::deque<CSerializeData>::iterator jt = it; jt != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; ++jt) {
+            iov[nIov].iov_base = &(*jt)[nOffset];
+            iov[nIov].iov_len = jt->size() - nOffset;
+            nBatchSize += iov[nIov].iov_len;
+            nOffset = 0;
+            nIov++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        int nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
+            pnode->nSendSyscalls++;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = it->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= it->size();
+                pnode->nSendMessages++;
+                sendBufferPool.Release(*it);
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nBatchSize) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
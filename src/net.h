@@ -143,6 +143,8 @@ public:
     bool fInbound;
     int nStartingHeight;
     uint64_t nSendBytes;
+    uint64_t nSendSyscalls;
+    uint64_t nSendMessages;
     uint64_t nRecvBytes;
     bool fSyncNode;
     double dPingTime;
@@ -192,6 +194,36 @@ public:
 
 
 
+/** Size-classed free lists of message buffers. Queueing a message for a peer
+ *  reuses the storage of one that has already been written to a socket, so a
+ *  busy relay node does not hit malloc once per message per peer. */
+class CSendBufferPool
+{
+public:
+    static const unsigned int MIN_CLASS = 9;  // 512 bytes
+    static const unsigned int MAX_CLASS = 22; // 4 MiB
+    static const size_t MAX_BUFFERS_PER_CLASS = 64;
+    static const size_t MAX_POOLED_BYTES = 16 * 1024 * 1024;
+
+    CSendBufferPool() : nPooledBytes(0) {}
+
+    // Replace data (which must be empty) with a buffer that can hold nSize bytes without reallocating
+    void Acquire(size_t nSize, CSerializeData& data);
+    // Hand the storage of data back to the pool; data is left empty
+    void Release(CSerializeData& data);
+    size_t GetPooledBytes();
+
+private:
+    CCriticalSection cs;
+    std::vector<CSerializeData> vFree[MAX_CLASS + 1];
+    size_t nPooledBytes;
+};
+
+extern CSendBufferPool sendBufferPool;
+
+
+
+
 /** Information about a peer */
 class CNode
 {
@@ -203,6 +235,8 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
+    uint64_t nSendSyscalls; // number of send()/sendmsg() calls that wrote data
+    uint64_t nSendMessages; // number of messages fully written to the socket
     std::deque<CSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
 
@@ -284,6 +318,8 @@ public:
         nLastSend = 0;
         nLastRecv = 0;
         nSendBytes = 0;
+        nSendSyscalls = 0;
+        nSendMessages = 0;
         nRecvBytes = 0;
         nLastSendEmpty = GetTime();
         nTimeConnected = GetTime();
@@ -513,6 +549,7 @@ public:
         LogPrint("net", "(%d bytes)\n", nSize);
 
         std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
+        sendBufferPool.Acquire(ssSend.size(), *it);
         ssSend.GetAndClear(*it);
         nSendSize += (*it).size();
 
@@ -35,35 +35,19 @@ bool CheckEquihashSolution(const CPureBlockHeader *pblock, const CChainParams& p
     unsigned int n = params.EquihashN();
     unsigned int k = params.EquihashK();
 
-    // Hash state
-    crypto_generichash_blake2b_state state;
-    EhInitialiseState(n, k, state);
-
-    // I = the block header minus nonce and solution.
-    CEquihashInput I{*pblock};
-    // I||V
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << I;
-    ss << pblock->nNonce256;
-
-    /*LogPrintf("checkES ss (%lu) = ",ss.size());
-    for (int i=0; i<ss.size(); i++) {
-      LogPrintf("%02x",*((unsigned char *)&ss[0]+i));
-    }
-
-    LogPrintf("\n");
-    LogPrintf("checkES nSolution (%lu) = ",(pblock->nSolution).size());
-    for (int i=0; i<(pblock->nSolution).size(); i++) {
-      LogPrintf("%02x",*((unsigned char *)&(pblock->nSolution)[0]+i));
-    }
-    LogPrintf("\n");*/
-    
-    // H(I||V||...
-    crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
-
-    bool isValid;
-    EhIsValidSolution(n, k, state, pblock->nSolution, isValid);
-    if (!isValid)
+    // I||V = the block header minus solution, as serialized by CEquihashInput
+    // followed by the nonce
+    unsigned char input[140];
+    memcpy(input,BEGIN(pblock->nVersion),4);
+    memcpy(input+4,BEGIN(pblock->hashPrevBlock),32);
+    memcpy(input+36,BEGIN(pblock->hashMerkleRoot),32);
+    memcpy(input+68,BEGIN(pblock->hashReserved),32);
+    memcpy(input+100,BEGIN(pblock->nTime),4);
+    memcpy(input+104,BEGIN(pblock->nBits),4);
+    memcpy(input+108,BEGIN(pblock->nNonce256),32);
+    EhHeaderHasher hasher(n, k, input, sizeof(input));
+
+    if (!EhIsValidHeaderSolution(n, k, hasher, pblock->nSolution))
         return error("CheckEquihashSolution(): invalid solution");
     
     return true;
@@ -2,6 +2,18 @@
 #include "util.h"
 #include "hash.h"
 #include "core.h"
+#include "sha256.h"
+
+/* Double SHA256 of the serialized header, 80 byte headers go through the multi-lane engine */
+static uint256 HashHeader(const unsigned char* pbegin, const unsigned char* pend)
+{
+  uint256 hash;
+  if (pend - pbegin == 80)
+    SHA256D80Nonces(hash.begin(), pbegin, 1);
+  else
+    hash = Hash(pbegin, pend);
+  return hash;
+}
 
 uint256 CPureBlockHeader::GetHash() const
 {
@@ -9,9 +21,9 @@ uint256 CPureBlockHeader::GetHash() const
     return GetHashE();
   }
   else if (GetAlgo()==ALGO_CRYPTONIGHT && this->vector_format) {
-    return Hash(BEGIN(vector_rep[0]),END(vector_rep[vector_rep.size()-1]));
+    return HashHeader((unsigned char *)BEGIN(vector_rep[0]),(unsigned char *)END(vector_rep[vector_rep.size()-1]));
   }
-  return Hash(BEGIN(nVersion), END(nNonce));
+  return HashHeader((unsigned char *)BEGIN(nVersion),(unsigned char *)END(nNonce));
 }
 
 uint256 CPureBlockHeader::GetHashE() const
@@ -33,7 +45,7 @@ uint256 CPureBlockHeader::GetHashE() const
   else {
     //LogPrintf("nSolution size %lu/n",nSolution.size());
     input[140] = 0x00;
-    return Hash((unsigned char *)input,(unsigned char *)input+141);
+    return HashHeader(input,input+141);
   }
-  return Hash((unsigned char *)input,(unsigned char *)input+1487);
+  return HashHeader(input,input+1487);
 }
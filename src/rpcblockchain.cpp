@@ -88,62 +88,14 @@ double GetPeakHashrate (const CBlockIndex* blockindex, int algo) {
     blockindex = get_pprev_algo(blockindex,algo);
   }
   if (!blockindex) return 0.;
-  do {
-    if (update_ssf(blockindex->nVersion)) {
-      double hashes_peak = 0.;
-      const CBlockIndex * pprev_algo = get_pprev_algo(blockindex,-1);
-      for (int i=0; i<365; i++) {
-	if (!pprev_algo) break;
-	int time_f = pprev_algo->GetMedianTimePast();
-	CBigNum hashes_bn = pprev_algo->GetBlockWork();
-	int time_i = 0;
-	
-	for (int j=0; j<nSSF-1; j++) {
-	 
-	  pprev_algo = get_pprev_algo(pprev_algo,-1);
-
-	  if (pprev_algo) {
-	    time_i = pprev_algo->GetMedianTimePast();
-	  }
-	  else {
-	    hashes_bn = CBigNum(0);
-	    break;
-	  }
-	  //LogPrintf("j=%d add block work of block %lu\n",j,pprev_algo->nHeight);
-	  hashes_bn += pprev_algo->GetBlockWork();	  
-	}
-	CBlockIndex * pprev_algo_time = get_pprev_algo(pprev_algo,-1);
-	if (pprev_algo_time) {
-	  time_i = pprev_algo_time->GetMedianTimePast();
-	}
-	else {
-	  const CBlockIndex * blockindex_time = pprev_algo;
-	  while (blockindex_time && onFork(blockindex_time)) {
-	    blockindex_time = blockindex_time->pprev;
-	  }
-	  if (blockindex_time) {
-	    time_i = blockindex_time->GetBlockTime();
-	  }
-	}
-	pprev_algo = pprev_algo_time;
-	
-	if (time_f>time_i) {
-	  time_f -= time_i;
-	}
-	else {
-	  return std::numeric_limits<double>::max();
-	}
-	//LogPrintf("hashes = %f, time = %f\n",(double)hashes_bn.getulong(),(double)time_f);
-	double hashes = (((hashes_bn/time_f)/1000000)/1000).getulong();
-	//LogPrintf("hashes per sec = %f\n",hashes);
-	if (hashes>hashes_peak) hashes_peak = hashes;
-      }
-      return hashes_peak;
-      break;
-    }
-    blockindex = get_pprev_algo(blockindex,-1);
-  } while (blockindex);
-  return 0.;
+  int nSinceUpdate = get_ssf_height(blockindex);
+  if (nSinceUpdate < 0) return 0.;
+  if (nSinceUpdate > 0) blockindex = get_pprev_algo_n(blockindex,nSinceUpdate,-1);
+  CBigNum hashes_cur, hashes_peak;
+  if (!get_ssf_hashrates(blockindex,hashes_cur,hashes_peak)) {
+    return std::numeric_limits<double>::max();
+  }
+  return ((hashes_peak/100000000)/1000000000).getulong();
 }
 
 double GetCurrentHashrate (const CBlockIndex* blockindex, int algo) { //as used for the scaling factor calc
@@ -161,49 +113,15 @@ double GetCurrentHashrate (const CBlockIndex* blockindex, int algo) { //as used
   if (!blockindex) {
     return 0.;
   }
-  do {
-    if (update_ssf(blockindex->nVersion)) {
-      const CBlockIndex * pcur_algo = get_pprev_algo(blockindex,-1);
-      if (!pcur_algo) return 0.;
-      int time_f = pcur_algo->GetMedianTimePast();
-      CBigNum hashes_bn = pcur_algo->GetBlockWork();
-      int time_i = 0;
-      const CBlockIndex * pprev_algo = pcur_algo;
-      for (int j=0; j<nSSF-1; j++) {
-	pprev_algo = get_pprev_algo(pprev_algo,-1);
-	if (pprev_algo) {
-	  time_i = pprev_algo->GetMedianTimePast();
-	}
-	else {
-	  return 0.;
-	}
-	hashes_bn += pprev_algo->GetBlockWork();
-      }
-      CBlockIndex * pprev_algo_time = get_pprev_algo(pprev_algo,-1);
-      if (pprev_algo_time) {
-	time_i = pprev_algo_time->GetMedianTimePast();
-      }
-      else {
-	const CBlockIndex * blockindex_time = pprev_algo;
-	while (blockindex_time && onFork(blockindex_time)) {
-	  blockindex_time = blockindex_time->pprev;
-	}
-	if (blockindex_time) time_i = blockindex_time->GetBlockTime();
-      }
-
-      if (time_f>time_i) {
-	time_f -= time_i;
-      }
-      else {
-	return std::numeric_limits<double>::max();
-      }
-      //LogPrintf("return %lu / %f\n",(double)hashes_bn.getulong(),(double)time_f);
-      return (((hashes_bn/time_f)/1000000)/1000).getulong();
-    }
-    blockindex = get_pprev_algo(blockindex,-1);
-  } while (blockindex);
-  return 0.;
-}  
+  int nSinceUpdate = get_ssf_height(blockindex);
+  if (nSinceUpdate < 0) return 0.;
+  if (nSinceUpdate > 0) blockindex = get_pprev_algo_n(blockindex,nSinceUpdate,-1);
+  CBigNum hashes;
+  if (!get_ssf_window_hashrate(blockindex,hashes)) {
+    return std::numeric_limits<double>::max();
+  }
+  return ((hashes/100000000)/1000000000).getulong();
+}
 
 double GetMoneySupply (const CBlockIndex* blockindex, int algo) {
   if (blockindex == NULL)
@@ -262,6 +180,8 @@ double GetBlockReward (CBlockIndex * blockindex, int algo, bool noScale) {
   CBlockIndex indexDummy(*pblock);
   indexDummy.pprev = blockindex;
   indexDummy.nHeight = blockindex->nHeight + 1;
+  indexDummy.BuildForkState();
+  indexDummy.BuildAlgoSkip();
   return ((double)GetBlockValue(&indexDummy,0,noScale))/100000000.;
   
 }
@@ -686,7 +606,7 @@ Value gettxout(const Array& params, bool fHelp)
     if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
         return Value::null;
 
-    std::map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
+    BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
     if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
@@ -159,6 +159,7 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "listaccounts"           && n > 1) ConvertTo<int64_t>(params[1]);
     if (strMethod == "walletpassphrase"       && n > 1) ConvertTo<int64_t>(params[1]);
     if (strMethod == "getblocktemplate"       && n > 0) ConvertTo<Object>(params[0]);
+    if (strMethod == "getauxblock"            && (n == 1 || (n == 2 && strParams[0].size() < 64))) ConvertTo<int64_t>(params[0]);
     if (strMethod == "listsinceblock"         && n > 1) ConvertTo<int64_t>(params[1]);
     if (strMethod == "listsinceblock"         && n > 2) ConvertTo<int64_t>(params[2]);
     if (strMethod == "sendmany"               && n > 1) ConvertTo<Object>(params[1]);
@@ -55,10 +55,143 @@ void ShutdownRPCMining()
 
 /* Set mining algo here for rpc mining */
 int miningAlgo = ALGO_SCRYPT;
-int miningAlgoGBT = miningAlgo;
-int miningAlgoGAB = miningAlgo;
 bool confAlgoIsSet = false;
 
+// The algo asked for by an optional RPC argument, or else the configured mining algo
+static int ParseMiningAlgo(const Value& value)
+{
+    if (value.type() == null_type) {
+        if (!confAlgoIsSet) {
+            miningAlgo = GetArg("-miningalgo", miningAlgo);
+            confAlgoIsSet = true;
+        }
+        return miningAlgo;
+    }
+    int algo = value.get_int();
+    if (algo < 0 || algo >= NUM_ALGOS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid algo");
+    return algo;
+}
+
+/** Block templates on the current tip for each algo. The first template built for
+ *  a transaction set is the base; templates for other algos copy its transactions
+ *  and only redo the header and coinbase value. */
+class CAlgoTemplateCache
+{
+private:
+    CBlockIndex* pindexPrev;
+    unsigned int nTransactionsUpdatedLast;
+    int64_t nStart;
+    CBlockTemplate* pbase;
+    CBlockTemplate* vpAlgoTemplate[NUM_ALGOS];
+    std::vector<CBlockTemplate*> vTemplates; // owned, kept until they are obsolete
+
+    void DeleteTemplates()
+    {
+        BOOST_FOREACH(CBlockTemplate* pblocktemplate, vTemplates)
+            delete pblocktemplate;
+        vTemplates.clear();
+    }
+
+public:
+    CAlgoTemplateCache() : pindexPrev(NULL), nTransactionsUpdatedLast(0), nStart(0), pbase(NULL)
+    {
+        std::fill(vpAlgoTemplate, vpAlgoTemplate + NUM_ALGOS, (CBlockTemplate*)NULL);
+    }
+
+    ~CAlgoTemplateCache()
+    {
+        DeleteTemplates();
+    }
+
+    CBlockIndex* Tip() const { return pindexPrev; }
+
+    // BIP22 longpollid of the current transaction set: the tip it was built on
+    // and the memory pool state it saw
+    std::string GetLongPollId() const
+    {
+        return pindexPrev->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast);
+    }
+
+    // Whether a new transaction set is due: the tip moved, or the mempool changed
+    // more than nMaxAge seconds after the last one was taken. Requires cs_main.
+    bool IsStale(int64_t nMaxAge) const
+    {
+        return !pbase || pindexPrev != chainActive.Tip() ||
+            (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > nMaxAge);
+    }
+
+    // Start over from a template made by CreateNewBlock for algo on the current tip.
+    // Older templates are freed unless fKeepOld is set and the tip is the same.
+    // Returns whether the tip changed. Requires cs_main.
+    bool SetBase(CBlockTemplate* pblocktemplate, int algo, unsigned int nTransactionsUpdated, bool fKeepOld)
+    {
+        bool fNewTip = pindexPrev != chainActive.Tip();
+        if (fNewTip || !fKeepOld)
+            DeleteTemplates();
+        pindexPrev = chainActive.Tip();
+        nTransactionsUpdatedLast = nTransactionsUpdated;
+        nStart = GetTime();
+        pbase = pblocktemplate;
+        std::fill(vpAlgoTemplate, vpAlgoTemplate + NUM_ALGOS, (CBlockTemplate*)NULL);
+        vpAlgoTemplate[algo] = pblocktemplate;
+        vTemplates.push_back(pblocktemplate);
+        return fNewTip;
+    }
+
+    // The template for algo, copied from the base the first time it is asked for.
+    // fNew tells whether it was just made. Requires cs_main.
+    CBlockTemplate* Get(int algo, bool& fNew)
+    {
+        fNew = false;
+        if (!vpAlgoTemplate[algo]) {
+            CBlockTemplate* pblocktemplate = CopyBlockTemplateForAlgo(*pbase, pindexPrev, algo);
+            if (!pblocktemplate)
+                throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+            vpAlgoTemplate[algo] = pblocktemplate;
+            vTemplates.push_back(pblocktemplate);
+            fNew = true;
+        }
+        return vpAlgoTemplate[algo];
+    }
+};
+
+// Wait until there is new work for the longpollid a client got with its last
+// template. Without cs_main, so the wait holds up nobody else.
+static void WaitForLongPoll(const Value& lpval)
+{
+    uint256 hashWatchedChain;
+    unsigned int nTransactionsUpdatedLastLP;
+    {
+        LOCK(cs_main);
+        hashWatchedChain = chainActive.Tip()->GetBlockHash();
+        nTransactionsUpdatedLastLP = mempool.GetTransactionsUpdated();
+    }
+
+    if (lpval.type() == str_type)
+    {
+        // Format: <hashBestChain><nTransactionsUpdatedLast>
+        std::string lpstr = lpval.get_str();
+        if (lpstr.size() < 64)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
+        uint256 hashLP;
+        hashLP.SetHex(lpstr.substr(0, 64));
+        if (hashLP != hashWatchedChain)
+            return;
+        nTransactionsUpdatedLastLP = atoi64(lpstr.substr(64));
+    }
+    // NOTE: Spec does not specify behaviour for non-string longpollid, but waiting
+    // for the next change from now makes testing easier
+
+    // New transactions alone are only worth new work once in a while
+    int64_t nTxTime = GetTime() + NEW_WORK_TX_DELAY;
+    while (!WaitForNewWork(hashWatchedChain, nTransactionsUpdatedLastLP, nTxTime, GetTime() + 10))
+    {
+        if (!IsRPCRunning())
+            throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+    }
+}
+
 // Return average network hashes per second based on the last 'lookup' blocks,
 // or from the last difficulty change if 'lookup' is nonpositive.
 // If 'height' is nonnegative, compute the estimate at the time when a given block was found.
@@ -319,6 +452,7 @@ Value getmininginfo(const Array& params, bool fHelp)
             "  \"generate\": true|false     (boolean) If the generation is on or off (see getgenerate or setgenerate calls)\n"
             "  \"genproclimit\": n          (numeric) The processor limit for generation. -1 if no generation. (see getgenerate or setgenerate calls)\n"
             "  \"hashespersec\": n          (numeric) The hashes per second of the generation, or 0 if no generation.\n"
+            "  \"solutionspersec\": x.xxx  (numeric) The Equihash solutions per second of the generation, or 0 if no generation.\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "}\n"
@@ -357,6 +491,7 @@ Value getmininginfo(const Array& params, bool fHelp)
 #ifdef ENABLE_WALLET
     obj.push_back(Pair("generate",         getgenerate(params, false)));
     obj.push_back(Pair("hashespersec",     gethashespersec(params, false)));
+    obj.push_back(Pair("solutionspersec",  GetTimeMillis() - nHPSTimerStart > 8000 ? 0.0 : dSolutionsPerSec));
 #endif
     return obj;
 }
@@ -434,7 +569,7 @@ Value getwork(const Array& params, bool fHelp)
         }
         CBlock* pblock = &pblocktemplate->block; // pointer for convenience
 
-	if ((pindexPrev->nHeight >= nForkHeight - 1 && CBlockIndex::IsSuperMajority(4,pindexPrev,75,100))) {
+	if ((pindexPrev->nHeight >= nForkHeight - 1 && pindexPrev->IsForkMajority())) {
 	  pblock->SetAlgo(miningAlgo);
 	}
 
@@ -492,7 +627,9 @@ Value getwork(const Array& params, bool fHelp)
 
         pblock->nTime = pdata->nTime;
         pblock->nNonce = pdata->nNonce;
-        pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+        CMutableTransaction txCoinbase(pblock->vtx[0]);
+        txCoinbase.vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+        pblock->vtx[0] = txCoinbase;
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 
         assert(pwalletMain != NULL);
@@ -514,6 +651,8 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "1. \"jsonrequestobject\"       (string, optional) A json object in the following spec\n"
             "     {\n"
             "       \"mode\":\"template\"    (string, optional) This must be set to \"template\" or omitted\n"
+            "       \"algo\":n               (numeric, optional) The algo to build the block for, default the mining algo\n"
+            "       \"longpollid\":\"id\"       (string, optional) Wait until there is newer work than the template with this longpollid\n"
             "       \"capabilities\":[       (array, optional) A list of strings\n"
             "           \"support\"           (string) client side supported feature, 'longpoll', 'coinbasetxn', 'coinbasevalue', 'proposal', 'serverlist', 'workid'\n"
             "           ,...\n"
@@ -556,6 +695,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "  \"curtime\" : ttt,                  (numeric) current timestamp in seconds since epoch (Jan 1 1970 GMT)\n"
             "  \"bits\" : \"xxx\",                 (string) compressed target of next block\n"
             "  \"height\" : n                      (numeric) The height of the next block\n"
+            "  \"longpollid\" : \"xxxx\"           (string) Pass this back to wait for newer work\n"
             "}\n"
 
             "\nExamples:\n"
@@ -564,6 +704,8 @@ Value getblocktemplate(const Array& params, bool fHelp)
          );
 
     std::string strMode = "template";
+    Value algoval;
+    Value lpval;
     if (params.size() > 0)
     {
         const Object& oparam = params[0].get_obj();
@@ -576,7 +718,10 @@ Value getblocktemplate(const Array& params, bool fHelp)
         }
         else
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
+        algoval = find_value(oparam, "algo");
+        lpval = find_value(oparam, "longpollid");
     }
+    int algo = ParseMiningAlgo(algoval);
 
     if (strMode != "template")
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
@@ -587,41 +732,41 @@ Value getblocktemplate(const Array& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Bitmark is downloading blocks...");
 
+    if (lpval.type() != null_type)
+        WaitForLongPoll(lpval);
+
     // Update block
-    static unsigned int nTransactionsUpdatedLast;
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() || miningAlgo != miningAlgoGBT ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+    static CCriticalSection cs_blocktemplates;
+    static CAlgoTemplateCache blocktemplates;
+    LOCK(cs_blocktemplates);
+    CBlockTemplate* pblocktemplate;
+    CBlockIndex* pindexPrev;
+    int64_t nMinTime;
+    std::string strLongPollId;
     {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
+        LOCK(cs_main);
+        if (blocktemplates.IsStale(5))
         {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
+            // Store the transactions updated count before CreateNewBlock, to avoid races
+            unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+
+            // Create new block
+            CScript scriptDummy = CScript() << OP_TRUE;
+            pblocktemplate = CreateNewBlock(scriptDummy, algo);
+            if (!pblocktemplate)
+                throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+            blocktemplates.SetBase(pblocktemplate, algo, nTransactionsUpdated, false);
         }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-	miningAlgoGBT = miningAlgo;
+        bool fNew;
+        pblocktemplate = blocktemplates.Get(algo, fNew);
+        pindexPrev = blocktemplates.Tip();
+        strLongPollId = blocktemplates.GetLongPollId();
+
+        // Update nTime
+        UpdateTime(pblocktemplate->block, pindexPrev);
+        nMinTime = pindexPrev->GetMedianTimePast()+1;
     }
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
-
-    // Update nTime
-    UpdateTime(*pblock, pindexPrev);
     pblock->nNonce = 0;
 
     Array transactions;
@@ -678,7 +823,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
     result.push_back(Pair("coinbaseaux", aux));
     result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
     result.push_back(Pair("target", hashTarget.GetHex()));
-    result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
+    result.push_back(Pair("mintime", nMinTime));
     result.push_back(Pair("mutable", aMutable));
     result.push_back(Pair("noncerange", "00000000ffffffff"));
     result.push_back(Pair("sigoplimit", (int64_t)MAX_BLOCK_SIGOPS));
@@ -686,6 +831,9 @@ Value getblocktemplate(const Array& params, bool fHelp)
     result.push_back(Pair("curtime", (int64_t)pblock->nTime));
     result.push_back(Pair("bits", HexBits(pblock->nBits)));
     result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+    result.push_back(Pair("pow_algo_id", algo));
+    result.push_back(Pair("pow_algo", GetAlgoName(algo)));
+    result.push_back(Pair("longpollid", strLongPollId));
 
     return result;
 }
@@ -735,14 +883,17 @@ Value submitblock(const Array& params, bool fHelp)
 #ifdef ENABLE_WALLET
 Value getauxblock(const Array& params, bool fHelp)
 {
-  if (fHelp || (params.size() != 0 && params.size() != 2))
+  if (fHelp || params.size() > 2)
     throw runtime_error(
-			"getauxblock (hash auxpow)\n"
+			"getauxblock (algo ( \"longpollid\" ) | \"hash\" \"auxpow\")\n"
 	                "\nCreate or submit a merge-mined block.\n"
-	                "\nWithout arguments, create a new block and return information\n"
-	                "required to merge-mine it.  With arguments, submit a solved\n"
-	                "auxpow for a previously returned block.\n"
+	                "\nWithout arguments or with an algo, create a new block and return\n"
+	                "information required to merge-mine it.  With two arguments, submit\n"
+	                "a solved auxpow for a previously returned block.\n"
 	                "\nArguments:\n"
+	                "1. algo      (numeric, optional) algo to create the block for, default the mining algo\n"
+	                "2. \"longpollid\" (string, optional) wait until there is newer work than the block with this longpollid\n"
+	                "\nor\n"
 	                "1. \"hash\"    (string, optional) hash of the block to submit\n"
 	                "2. \"auxpow\"  (string, optional) serialised auxpow found\n"
 	                "\nResult (without arguments):\n"
@@ -754,6 +905,7 @@ Value getauxblock(const Array& params, bool fHelp)
 	                "  \"bits\"               (string) compressed target of the block\n"
 	                "  \"height\"             (numeric) height of the block\n"
 	                "  \"target\"             (string) target in reversed byte order\n"
+	                "  \"longpollid\"         (string) pass this back to wait for newer work\n"
 			"{\n"
 			"  \"hash\"               (string) hash of the created block\n"
 			"  \"chainid\"            (numeric) chain ID for this block\n"
@@ -767,6 +919,7 @@ Value getauxblock(const Array& params, bool fHelp)
 			"xxxxx        (boolean) whether the submitted block was correct\n"
 			"\nExamples:\n"
 			+ HelpExampleCli("getauxblock", "")
+			+ HelpExampleCli("getauxblock", "1")
 			+ HelpExampleCli("getauxblock", "\"hash\" \"serialised auxpow\"")
 			+ HelpExampleRpc("getauxblock", "")
 			);
@@ -774,50 +927,52 @@ Value getauxblock(const Array& params, bool fHelp)
     throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found (disabled)");
   if (vNodes.empty())
     throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Bitmark is not connected!");
-  if (IsInitialBlockDownload())
-    throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Bitmark is downloading blocks...");
+  {
+    LOCK(cs_main);
+    if (IsInitialBlockDownload())
+      throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Bitmark is downloading blocks...");
+  }
+  // A block hash comes as a string, an algo as a number
+  bool fCreate = params.size() < 2 || params[0].type() != str_type;
+  if (fCreate && params.size() > 1)
+    WaitForLongPoll(params[1]);
   static CCriticalSection cs_auxblockCache;
   LOCK(cs_auxblockCache);
   static std::map<uint256, CBlock*> mapNewBlock;
-  static std::vector<CBlockTemplate*> vNewBlockTemplate;
-  if (params.size() == 0) {
-    static unsigned nTransactionsUpdatedLast;
-    static CBlockIndex* pindexPrev = NULL;
-    static uint64_t nStart;
-    static CBlockTemplate* pblocktemplate;
+  static CAlgoTemplateCache auxblocktemplates;
+  if (fCreate) {
+    int algo = ParseMiningAlgo(params.size() > 0 ? params[0] : Value());
     static unsigned int nExtraNonce = 0;
-    CReserveKey reservekey(pwalletMain);
+    CBlockTemplate* pblocktemplate;
+    CBlockIndex* pindexPrev;
+    std::string strLongPollId;
 
     {
       LOCK(cs_main);
-      if (pindexPrev != chainActive.Tip() || miningAlgo != miningAlgoGAB
-	  || (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast
-	      && GetTime() - nStart > 60)) {
-	if (pindexPrev != chainActive.Tip()) {
-	  mapNewBlock.clear();
-	  BOOST_FOREACH(CBlockTemplate* pbt, vNewBlockTemplate)
-	    delete pbt;
-	  vNewBlockTemplate.clear();
-	}
-
-	pblocktemplate = CreateNewBlockWithKey(reservekey);
+      if (auxblocktemplates.IsStale(60)) {
+	unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+	CReserveKey reservekey(pwalletMain);
+	pblocktemplate = CreateNewBlockWithKey(reservekey, algo);
 	if (!pblocktemplate)
 	  throw JSONRPCError(RPC_OUT_OF_MEMORY, "out of memory");
 
-	nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-	pindexPrev = chainActive.Tip();
-	nStart = GetTime();
+	// Templates of the old tip can no longer be submitted
+	if (auxblocktemplates.SetBase(pblocktemplate, algo, nTransactionsUpdated, true))
+	  mapNewBlock.clear();
+      }
 
+      bool fNew;
+      pblocktemplate = auxblocktemplates.Get(algo, fNew);
+      pindexPrev = auxblocktemplates.Tip();
+      strLongPollId = auxblocktemplates.GetLongPollId();
+      if (fNew || mapNewBlock.count(pblocktemplate->block.GetHash()) == 0) {
 	CBlock* pblock = &pblocktemplate->block;
-	IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+	IncrementExtraNonce(pblocktemplate, pindexPrev, nExtraNonce);
 	pblock->SetAuxpow(true);
 	pblock->SetChainId(Params().GetAuxpowChainId());
-	pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 
 	mapNewBlock[pblock->GetHash()] = pblock;
-	vNewBlockTemplate.push_back(pblocktemplate);
-	miningAlgoGAB = miningAlgo;
-      }	    	  
+      }
     }
 
     const CBlock& block = pblocktemplate->block;
@@ -846,6 +1001,7 @@ Value getauxblock(const Array& params, bool fHelp)
     result.push_back(Pair("version",block.nVersion));
     result.push_back(Pair("curtime", (int64_t)block.nTime));
     result.push_back(Pair("scriptsig",HexStr(block.vtx[0].vin[0].scriptSig)));
+    result.push_back(Pair("longpollid", strLongPollId));
 
     return result;
   }
@@ -878,7 +1034,12 @@ Value getauxblock(const Array& params, bool fHelp)
     assert(block.GetHash() == hash);
   }
   CValidationState state;
-  bool fAccepted = ProcessBlock(state, NULL, &block);
+  bool fAccepted;
+  {
+    // Lock order is cs_auxblockCache -> cs_main, as in the create branch
+    LOCK(cs_main);
+    fAccepted = ProcessBlock(state, NULL, &block);
+  }
   if (!fAccepted)
     return "rejected";
   return Value::null;
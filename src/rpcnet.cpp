@@ -86,6 +86,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"sendcalls\": n,            (numeric) The number of socket writes made to this peer\n"
+            "    \"sendmsgs\": n,             (numeric) The number of messages fully written to this peer\n"
+            "    \"bytespersendcall\": n,     (numeric) Average bytes written per socket write\n"
+            "    \"sendcallspermsg\": n,      (numeric) Average socket writes per message sent\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
@@ -121,6 +125,12 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        obj.push_back(Pair("sendcalls", stats.nSendSyscalls));
+        obj.push_back(Pair("sendmsgs", stats.nSendMessages));
+        if (stats.nSendSyscalls > 0)
+            obj.push_back(Pair("bytespersendcall", (double)stats.nSendBytes / stats.nSendSyscalls));
+        if (stats.nSendMessages > 0)
+            obj.push_back(Pair("sendcallspermsg", (double)stats.nSendSyscalls / stats.nSendMessages));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("pingtime", stats.dPingTime));
         if (stats.dPingWait > 0.0)
@@ -33,6 +33,7 @@ using namespace json_spirit;
 
 static std::string strRPCUserColonPass;
 
+static bool fRPCRunning = false;
 // These are created by StartRPCThreads, destroyed in StopRPCThreads
 static asio::io_service* rpc_io_service = NULL;
 static map<string, boost::shared_ptr<deadline_timer> > deadlineTimers;
@@ -279,8 +280,8 @@ static const CRPCCommand vRPCCommands[] =
     { "gd",                     &getdifficulty,          true,      false,      false },
 
     /* Mining */
-    { "getblocktemplate",       &getblocktemplate,       true,      false,      false },
-    { "gbt",                    &getblocktemplate,       true,      false,      false },
+    { "getblocktemplate",       &getblocktemplate,       true,      true,       false },
+    { "gbt",                    &getblocktemplate,       true,      true,       false },
     { "getmininginfo",          &getmininginfo,          true,      false,      false },
     { "gmi",                    &getmininginfo,          true,      false,      false },
     { "getnetworkhashps",       &getnetworkhashps,       true,      false,      false },
@@ -401,8 +402,8 @@ static const CRPCCommand vRPCCommands[] =
     { "getminingalgo",            &getminingalgo,            true,      true,       false },
     { "setgenerate",            &setgenerate,            true,      true,       false },
     { "sg",                     &setgenerate,            true,      true,       false },
-    { "getauxblock",            &getauxblock,            true,     false,      false },
-    { "gab",                    &getauxblock,            true,     false,      false },
+    { "getauxblock",            &getauxblock,            true,     true,       false },
+    { "gab",                    &getauxblock,            true,     true,       false },
 #endif // ENABLE_WALLET
 };
 
@@ -706,6 +707,7 @@ void StartRPCThreads()
     rpc_worker_group = new boost::thread_group();
     for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
         rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    fRPCRunning = true;
 }
 
 void StartDummyRPCThread()
@@ -718,12 +720,15 @@ void StartDummyRPCThread()
         rpc_dummy_work = new asio::io_service::work(*rpc_io_service);
         rpc_worker_group = new boost::thread_group();
         rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+        fRPCRunning = true;
     }
 }
 
 void StopRPCThreads()
 {
     if (rpc_io_service == NULL) return;
+    // Set this to false first, so that longpolling loops will exit when woken up
+    fRPCRunning = false;
 
     // First, cancel all timers and acceptors
     // This is not done automatically by ->stop(), and in some cases the destructor of
@@ -745,6 +750,7 @@ void StopRPCThreads()
     deadlineTimers.clear();
 
     rpc_io_service->stop();
+    cvNewWork.notify_all();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
     delete rpc_dummy_work; rpc_dummy_work = NULL;
@@ -753,6 +759,11 @@ void StopRPCThreads()
     delete rpc_io_service; rpc_io_service = NULL;
 }
 
+bool IsRPCRunning()
+{
+    return fRPCRunning;
+}
+
 void RPCRunHandler(const boost::system::error_code& err, boost::function<void(void)> func)
 {
     if (!err)
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+// 8-way AVX2 scrypt(1024,1,1) ROMix, one independent hash per 32-bit lane.
+// Built with a per-function target attribute so the rest of the tree needs
+// no extra compiler flags; only called after scrypt_detect() has checked the
+// CPU.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+
+#include "scrypt.h"
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#define SCRYPT_AVX2_TARGET __attribute__((target("avx2")))
+
+SCRYPT_AVX2_TARGET static inline __m256i rotl_8way(__m256i x, int n)
+{
+	return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+#define SALSA_8WAY(a, b, c, n) x##a = _mm256_xor_si256(x##a, rotl_8way(_mm256_add_epi32(x##b, x##c), n))
+
+/* xor_salsa8 on eight interleaved lanes, word k of every lane in B[k] */
+SCRYPT_AVX2_TARGET static inline void xor_salsa8_8way(__m256i B[16], const __m256i Bx[16])
+{
+	__m256i x00, x01, x02, x03, x04, x05, x06, x07, x08, x09, x10, x11, x12, x13, x14, x15;
+	int i;
+
+	x00 = (B[ 0] = _mm256_xor_si256(B[ 0], Bx[ 0]));
+	x01 = (B[ 1] = _mm256_xor_si256(B[ 1], Bx[ 1]));
+	x02 = (B[ 2] = _mm256_xor_si256(B[ 2], Bx[ 2]));
+	x03 = (B[ 3] = _mm256_xor_si256(B[ 3], Bx[ 3]));
+	x04 = (B[ 4] = _mm256_xor_si256(B[ 4], Bx[ 4]));
+	x05 = (B[ 5] = _mm256_xor_si256(B[ 5], Bx[ 5]));
+	x06 = (B[ 6] = _mm256_xor_si256(B[ 6], Bx[ 6]));
+	x07 = (B[ 7] = _mm256_xor_si256(B[ 7], Bx[ 7]));
+	x08 = (B[ 8] = _mm256_xor_si256(B[ 8], Bx[ 8]));
+	x09 = (B[ 9] = _mm256_xor_si256(B[ 9], Bx[ 9]));
+	x10 = (B[10] = _mm256_xor_si256(B[10], Bx[10]));
+	x11 = (B[11] = _mm256_xor_si256(B[11], Bx[11]));
+	x12 = (B[12] = _mm256_xor_si256(B[12], Bx[12]));
+	x13 = (B[13] = _mm256_xor_si256(B[13], Bx[13]));
+	x14 = (B[14] = _mm256_xor_si256(B[14], Bx[14]));
+	x15 = (B[15] = _mm256_xor_si256(B[15], Bx[15]));
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		SALSA_8WAY(04, 00, 12,  7);  SALSA_8WAY(09, 05, 01,  7);
+		SALSA_8WAY(14, 10, 06,  7);  SALSA_8WAY(03, 15, 11,  7);
+
+		SALSA_8WAY(08, 04, 00,  9);  SALSA_8WAY(13, 09, 05,  9);
+		SALSA_8WAY(02, 14, 10,  9);  SALSA_8WAY(07, 03, 15,  9);
+
+		SALSA_8WAY(12, 08, 04, 13);  SALSA_8WAY(01, 13, 09, 13);
+		SALSA_8WAY(06, 02, 14, 13);  SALSA_8WAY(11, 07, 03, 13);
+
+		SALSA_8WAY(00, 12, 08, 18);  SALSA_8WAY(05, 01, 13, 18);
+		SALSA_8WAY(10, 06, 02, 18);  SALSA_8WAY(15, 11, 07, 18);
+
+		/* Operate on rows. */
+		SALSA_8WAY(01, 00, 03,  7);  SALSA_8WAY(06, 05, 04,  7);
+		SALSA_8WAY(11, 10, 09,  7);  SALSA_8WAY(12, 15, 14,  7);
+
+		SALSA_8WAY(02, 01, 00,  9);  SALSA_8WAY(07, 06, 05,  9);
+		SALSA_8WAY(08, 11, 10,  9);  SALSA_8WAY(13, 12, 15,  9);
+
+		SALSA_8WAY(03, 02, 01, 13);  SALSA_8WAY(04, 07, 06, 13);
+		SALSA_8WAY(09, 08, 11, 13);  SALSA_8WAY(14, 13, 12, 13);
+
+		SALSA_8WAY(00, 03, 02, 18);  SALSA_8WAY(05, 04, 07, 18);
+		SALSA_8WAY(10, 09, 08, 18);  SALSA_8WAY(15, 14, 13, 18);
+	}
+	B[ 0] = _mm256_add_epi32(B[ 0], x00);
+	B[ 1] = _mm256_add_epi32(B[ 1], x01);
+	B[ 2] = _mm256_add_epi32(B[ 2], x02);
+	B[ 3] = _mm256_add_epi32(B[ 3], x03);
+	B[ 4] = _mm256_add_epi32(B[ 4], x04);
+	B[ 5] = _mm256_add_epi32(B[ 5], x05);
+	B[ 6] = _mm256_add_epi32(B[ 6], x06);
+	B[ 7] = _mm256_add_epi32(B[ 7], x07);
+	B[ 8] = _mm256_add_epi32(B[ 8], x08);
+	B[ 9] = _mm256_add_epi32(B[ 9], x09);
+	B[10] = _mm256_add_epi32(B[10], x10);
+	B[11] = _mm256_add_epi32(B[11], x11);
+	B[12] = _mm256_add_epi32(B[12], x12);
+	B[13] = _mm256_add_epi32(B[13], x13);
+	B[14] = _mm256_add_epi32(B[14], x14);
+	B[15] = _mm256_add_epi32(B[15], x15);
+}
+
+#undef SALSA_8WAY
+
+/*
+ * The ROMix of scrypt(1024,1,1) for eight lanes at once. X holds the 32
+ * words of each lane interleaved, word k of lane l at X[8 * k + l], and V is
+ * a 32-byte aligned scratchpad of 8 * 128KB laid out the same way.
+ */
+SCRYPT_AVX2_TARGET void scrypt_core_8way_avx2(uint32_t *X, uint32_t *V)
+{
+	__m256i *x = (__m256i *)X;
+	__m256i *v = (__m256i *)V;
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i mask = _mm256_set1_epi32(1023);
+	uint32_t i, k;
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			v[i * 32 + k] = x[k];
+		xor_salsa8_8way(&x[0], &x[16]);
+		xor_salsa8_8way(&x[16], &x[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Each lane reads its own block of the scratchpad, word k at index + 8 * k. */
+		__m256i index = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(x[16], mask), 8), lanes);
+		for (k = 0; k < 32; k++)
+			x[k] = _mm256_xor_si256(x[k], _mm256_i32gather_epi32((const int *)V + 8 * k, index, 4));
+		xor_salsa8_8way(&x[0], &x[16]);
+		xor_salsa8_8way(&x[16], &x[0]);
+	}
+}
+
+#endif
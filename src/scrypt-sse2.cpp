@@ -27,6 +27,8 @@
  * online backup system.
  */
 
+#if defined(USE_SSE2) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)))
+
 #include "scrypt.h"
 #include <stdlib.h>
 #include <stdint.h>
@@ -35,7 +37,14 @@
 
 #include <emmintrin.h>
 
-static inline void xor_salsa8_sse2(__m128i B[4], const __m128i Bx[4])
+#if defined(__GNUC__)
+// SSE2 is only baseline on x86_64, 32-bit builds call the kernels after scrypt_detect()
+#define SCRYPT_SSE2_TARGET __attribute__((target("sse2")))
+#else
+#define SCRYPT_SSE2_TARGET
+#endif
+
+SCRYPT_SSE2_TARGET static inline void xor_salsa8_sse2(__m128i B[4], const __m128i Bx[4])
 {
 	__m128i X0, X1, X2, X3;
 	__m128i T;
@@ -92,7 +101,7 @@ static inline void xor_salsa8_sse2(__m128i B[4], const __m128i Bx[4])
 	B[3] = _mm_add_epi32(B[3], X3);
 }
 
-void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad)
+SCRYPT_SSE2_TARGET void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad)
 {
 	uint8_t B[128];
 	union {
@@ -134,3 +143,111 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
+
+SCRYPT_SSE2_TARGET static inline __m128i rotl_4way(__m128i x, int n)
+{
+	return _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - n));
+}
+
+#define SALSA_4WAY(a, b, c, n) x##a = _mm_xor_si128(x##a, rotl_4way(_mm_add_epi32(x##b, x##c), n))
+
+/* xor_salsa8 on four interleaved lanes, word k of every lane in B[k] */
+SCRYPT_SSE2_TARGET static inline void xor_salsa8_4way(__m128i B[16], const __m128i Bx[16])
+{
+	__m128i x00, x01, x02, x03, x04, x05, x06, x07, x08, x09, x10, x11, x12, x13, x14, x15;
+	int i;
+
+	x00 = (B[ 0] = _mm_xor_si128(B[ 0], Bx[ 0]));
+	x01 = (B[ 1] = _mm_xor_si128(B[ 1], Bx[ 1]));
+	x02 = (B[ 2] = _mm_xor_si128(B[ 2], Bx[ 2]));
+	x03 = (B[ 3] = _mm_xor_si128(B[ 3], Bx[ 3]));
+	x04 = (B[ 4] = _mm_xor_si128(B[ 4], Bx[ 4]));
+	x05 = (B[ 5] = _mm_xor_si128(B[ 5], Bx[ 5]));
+	x06 = (B[ 6] = _mm_xor_si128(B[ 6], Bx[ 6]));
+	x07 = (B[ 7] = _mm_xor_si128(B[ 7], Bx[ 7]));
+	x08 = (B[ 8] = _mm_xor_si128(B[ 8], Bx[ 8]));
+	x09 = (B[ 9] = _mm_xor_si128(B[ 9], Bx[ 9]));
+	x10 = (B[10] = _mm_xor_si128(B[10], Bx[10]));
+	x11 = (B[11] = _mm_xor_si128(B[11], Bx[11]));
+	x12 = (B[12] = _mm_xor_si128(B[12], Bx[12]));
+	x13 = (B[13] = _mm_xor_si128(B[13], Bx[13]));
+	x14 = (B[14] = _mm_xor_si128(B[14], Bx[14]));
+	x15 = (B[15] = _mm_xor_si128(B[15], Bx[15]));
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		SALSA_4WAY(04, 00, 12,  7);  SALSA_4WAY(09, 05, 01,  7);
+		SALSA_4WAY(14, 10, 06,  7);  SALSA_4WAY(03, 15, 11,  7);
+
+		SALSA_4WAY(08, 04, 00,  9);  SALSA_4WAY(13, 09, 05,  9);
+		SALSA_4WAY(02, 14, 10,  9);  SALSA_4WAY(07, 03, 15,  9);
+
+		SALSA_4WAY(12, 08, 04, 13);  SALSA_4WAY(01, 13, 09, 13);
+		SALSA_4WAY(06, 02, 14, 13);  SALSA_4WAY(11, 07, 03, 13);
+
+		SALSA_4WAY(00, 12, 08, 18);  SALSA_4WAY(05, 01, 13, 18);
+		SALSA_4WAY(10, 06, 02, 18);  SALSA_4WAY(15, 11, 07, 18);
+
+		/* Operate on rows. */
+		SALSA_4WAY(01, 00, 03,  7);  SALSA_4WAY(06, 05, 04,  7);
+		SALSA_4WAY(11, 10, 09,  7);  SALSA_4WAY(12, 15, 14,  7);
+
+		SALSA_4WAY(02, 01, 00,  9);  SALSA_4WAY(07, 06, 05,  9);
+		SALSA_4WAY(08, 11, 10,  9);  SALSA_4WAY(13, 12, 15,  9);
+
+		SALSA_4WAY(03, 02, 01, 13);  SALSA_4WAY(04, 07, 06, 13);
+		SALSA_4WAY(09, 08, 11, 13);  SALSA_4WAY(14, 13, 12, 13);
+
+		SALSA_4WAY(00, 03, 02, 18);  SALSA_4WAY(05, 04, 07, 18);
+		SALSA_4WAY(10, 09, 08, 18);  SALSA_4WAY(15, 14, 13, 18);
+	}
+	B[ 0] = _mm_add_epi32(B[ 0], x00);
+	B[ 1] = _mm_add_epi32(B[ 1], x01);
+	B[ 2] = _mm_add_epi32(B[ 2], x02);
+	B[ 3] = _mm_add_epi32(B[ 3], x03);
+	B[ 4] = _mm_add_epi32(B[ 4], x04);
+	B[ 5] = _mm_add_epi32(B[ 5], x05);
+	B[ 6] = _mm_add_epi32(B[ 6], x06);
+	B[ 7] = _mm_add_epi32(B[ 7], x07);
+	B[ 8] = _mm_add_epi32(B[ 8], x08);
+	B[ 9] = _mm_add_epi32(B[ 9], x09);
+	B[10] = _mm_add_epi32(B[10], x10);
+	B[11] = _mm_add_epi32(B[11], x11);
+	B[12] = _mm_add_epi32(B[12], x12);
+	B[13] = _mm_add_epi32(B[13], x13);
+	B[14] = _mm_add_epi32(B[14], x14);
+	B[15] = _mm_add_epi32(B[15], x15);
+}
+
+#undef SALSA_4WAY
+
+/*
+ * The ROMix of scrypt(1024,1,1) for four lanes at once. X holds the 32 words
+ * of each lane interleaved, word k of lane l at X[4 * k + l], and V is a
+ * 16-byte aligned scratchpad of 4 * 128KB laid out the same way.
+ */
+SCRYPT_SSE2_TARGET void scrypt_core_4way_sse2(uint32_t *X, uint32_t *V)
+{
+	__m128i *x = (__m128i *)X;
+	__m128i *v = (__m128i *)V;
+	uint32_t i, k;
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			v[i * 32 + k] = x[k];
+		xor_salsa8_4way(&x[0], &x[16]);
+		xor_salsa8_4way(&x[16], &x[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Each lane reads its own block of the scratchpad. */
+		const uint32_t *v0 = &V[128 * (X[64] & 1023) + 0];
+		const uint32_t *v1 = &V[128 * (X[65] & 1023) + 1];
+		const uint32_t *v2 = &V[128 * (X[66] & 1023) + 2];
+		const uint32_t *v3 = &V[128 * (X[67] & 1023) + 3];
+		for (k = 0; k < 32; k++)
+			x[k] = _mm_xor_si128(x[k], _mm_set_epi32(v3[4 * k], v2[4 * k], v1[4 * k], v0[4 * k]));
+		xor_salsa8_4way(&x[0], &x[16]);
+		xor_salsa8_4way(&x[16], &x[0]);
+	}
+}
+
+#endif
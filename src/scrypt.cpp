@@ -29,9 +29,11 @@
 
 #include "scrypt.h"
 #include "util.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <vector>
 #include <openssl/sha.h>
 
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
@@ -44,6 +46,17 @@
 #endif
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define ENABLE_SCRYPT_X86
+#include <cpuid.h>
+void scrypt_core_4way_sse2(uint32_t *X, uint32_t *V);
+void scrypt_core_8way_avx2(uint32_t *X, uint32_t *V);
+#endif
+
+/* Multi-lane ROMix kernels, set by scrypt_detect() */
+static void (*scrypt_core_4way)(uint32_t *X, uint32_t *V) = NULL;
+static void (*scrypt_core_8way)(uint32_t *X, uint32_t *V) = NULL;
+
 static inline uint32_t be32dec(const void *pp)
 {
 	const uint8_t *p = (uint8_t const *)pp;
@@ -322,6 +335,108 @@ void scrypt_detect_sse2()
 }
 #endif
 
+void scrypt_1024_1_1_256_sp_many(const char *input, char *output, size_t n, char *scratchpad, int nMaxWays)
+{
+	uint8_t B[128];
+	alignas(32) uint32_t X[32 * SCRYPT_MAX_WAYS];
+	uint32_t *V;
+	int ways, l, k;
+
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	while (n > 0) {
+		void (*core)(uint32_t *X, uint32_t *V) = NULL;
+		ways = 1;
+		if (scrypt_core_8way && nMaxWays >= 8 && n >= 8) {
+			core = scrypt_core_8way;
+			ways = 8;
+		} else if (scrypt_core_4way && nMaxWays >= 4 && n >= 4) {
+			core = scrypt_core_4way;
+			ways = 4;
+		}
+		if (!core) {
+			scrypt_1024_1_1_256_sp(input, output, scratchpad);
+			input += 80;
+			output += 32;
+			n--;
+			continue;
+		}
+
+		/* PBKDF2 stays per lane, the ROMix takes nearly all the time. */
+		for (l = 0; l < ways; l++) {
+			PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, (const uint8_t *)input + 80 * l, 80, 1, B, 128);
+			for (k = 0; k < 32; k++)
+				X[ways * k + l] = le32dec(&B[4 * k]);
+		}
+		core(X, V);
+		for (l = 0; l < ways; l++) {
+			for (k = 0; k < 32; k++)
+				le32enc(&B[4 * k], X[ways * k + l]);
+			PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, B, 128, 1, (uint8_t *)output + 32 * l, 32);
+		}
+		input += 80 * ways;
+		output += 32 * ways;
+		n -= ways;
+	}
+}
+
+/* The multi-lane kernels must agree with the generic scrypt on every lane. */
+static bool scrypt_self_test()
+{
+	const int n = SCRYPT_MAX_WAYS + 4;
+	char input[80 * n], output[32 * n], expected[32];
+	std::vector<char> scratchpad(SCRYPT_MANY_SCRATCHPAD_SIZE);
+	for (int i = 0; i < 80 * n; i++)
+		input[i] = (char)(i * 7 + i / 80);
+	scrypt_1024_1_1_256_sp_many(input, output, n, &scratchpad[0]);
+	for (int i = 0; i < n; i++) {
+		scrypt_1024_1_1_256_sp_generic(input + 80 * i, expected, &scratchpad[0]);
+		if (memcmp(expected, output + 32 * i, 32))
+			return false;
+	}
+	return true;
+}
+
+std::string scrypt_detect()
+{
+	std::string ret = "generic";
+#if defined(USE_SSE2)
+	scrypt_detect_sse2();
+#if !defined(USE_SSE2_ALWAYS)
+	if (scrypt_1024_1_1_256_sp_detected == &scrypt_1024_1_1_256_sp_sse2)
+#endif
+		ret = "sse2";
+#endif
+
+	scrypt_core_4way = NULL;
+	scrypt_core_8way = NULL;
+#if defined(ENABLE_SCRYPT_X86)
+	uint32_t eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		if ((edx >> 26) & 1) {
+			scrypt_core_4way = scrypt_core_4way_sse2;
+			ret += ",sse2(4way)";
+		}
+		bool have_xsave = ((ecx >> 27) & 1) && ((ecx >> 28) & 1); // OSXSAVE and AVX
+		if (have_xsave && __get_cpuid_max(0, NULL) >= 7) {
+			__cpuid_count(7, 0, eax, ebx, ecx, edx);
+			if ((ebx >> 5) & 1) {
+				// The OS must save the YMM registers too
+				uint32_t xcr0_lo, xcr0_hi;
+				__asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+				if ((xcr0_lo & 6) == 6) {
+					scrypt_core_8way = scrypt_core_8way_avx2;
+					ret += ",avx2(8way)";
+				}
+			}
+		}
+	}
+#endif
+
+	assert(scrypt_self_test());
+	return ret;
+}
+
 void scrypt_1024_1_1_256(const char *input, char *output)
 {
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
@@ -2,12 +2,25 @@
 #define SCRYPT_H
 #include <stdlib.h>
 #include <stdint.h>
+#include <string>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
+/** Lanes of the widest multi-lane kernel */
+static const int SCRYPT_MAX_WAYS = 8;
+/** Scratchpad for scrypt_1024_1_1_256_sp_many, one 128KB ROMix area per lane */
+static const int SCRYPT_MANY_SCRATCHPAD_SIZE = 131072 * SCRYPT_MAX_WAYS + 63;
 
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/** Select the scrypt kernels for this CPU, returns their names */
+std::string scrypt_detect();
+/** scrypt n 80-byte inputs stored back to back into n 32-byte outputs. Runs
+ *  the inputs through the SSE2 4-way and AVX2 8-way kernels where the CPU has
+ *  them, never wider than nMaxWays, and the rest one at a time.
+ */
+void scrypt_1024_1_1_256_sp_many(const char *input, char *output, size_t n, char *scratchpad, int nMaxWays = SCRYPT_MAX_WAYS);
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
@@ -7,6 +7,7 @@
 
 #include <assert.h>
 #include <string.h>
+#include <algorithm>
 #include <atomic>
 
 #if defined(__x86_64__) || defined(__amd64__)
@@ -19,6 +20,23 @@ void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
 #endif
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define ENABLE_SHA256_X86
+#include <cpuid.h>
+namespace sha256_sse41
+{
+void Transform_4way(uint32_t* s, const unsigned char* chunk, size_t stride);
+}
+namespace sha256_avx2
+{
+void Transform_8way(uint32_t* s, const unsigned char* chunk, size_t stride);
+}
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -172,7 +190,90 @@ bool SelfTest(TransformType tr) {
     return true;
 }
 
+typedef void (*TransformMultiType)(uint32_t*, const unsigned char*, size_t);
+
 TransformType Transform = sha256::Transform;
+TransformMultiType Transform4 = NULL;
+TransformMultiType Transform8 = NULL;
+
+/** Number of hashes the double-SHA256 drivers keep in flight. */
+const size_t LANES = 8;
+
+/** Padding chunk of a 64-byte message: the end marker and a 512-bit length. */
+const unsigned char pad64[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0};
+
+/** Compress one chunk into each of lanes states, with the widest kernel that
+ *  fits. Lane i uses s[8*i..8*i+7] and the chunk at chunk + i*stride.
+ */
+void TransformLanes(uint32_t* s, const unsigned char* chunk, size_t stride, size_t lanes)
+{
+    if (Transform8) {
+        for (; lanes >= 8; lanes -= 8, s += 64, chunk += 8 * stride)
+            Transform8(s, chunk, stride);
+    }
+    if (Transform4) {
+        for (; lanes >= 4; lanes -= 4, s += 32, chunk += 4 * stride)
+            Transform4(s, chunk, stride);
+    }
+    for (; lanes > 0; lanes--, s += 8, chunk += stride)
+        Transform(s, chunk, 1);
+}
+
+/** Prepare lanes 64-byte chunks for hashing a 32-byte message each. */
+void InitPad32(unsigned char* buf, size_t lanes)
+{
+    for (size_t i = 0; i < lanes; i++) {
+        unsigned char* chunk = buf + 64 * i;
+        memset(chunk + 32, 0, 32);
+        chunk[32] = 0x80;
+        chunk[62] = 0x01; // 256-bit length
+    }
+}
+
+/** Hash the finished first SHA-256 of each lane again and write the results.
+ *  buf must have been prepared by InitPad32.
+ */
+void FinalizeDouble(unsigned char* out, uint32_t* s, unsigned char* buf, size_t lanes)
+{
+    for (size_t i = 0; i < lanes; i++) {
+        for (int j = 0; j < 8; j++)
+            WriteBE32(buf + 64 * i + 4 * j, s[8 * i + j]);
+        sha256::Initialize(s + 8 * i);
+    }
+    TransformLanes(s, buf, 64, lanes);
+    for (size_t i = 0; i < lanes; i++) {
+        for (int j = 0; j < 8; j++)
+            WriteBE32(out + 32 * i + 4 * j, s[8 * i + j]);
+    }
+}
+
+/** Check the batched double-SHA256 drivers against the plain hasher, with
+ *  enough hashes to go through every kernel width.
+ */
+bool SelfTestDouble()
+{
+    unsigned char in[64 * 13], out[32 * 13], hash[32];
+    for (size_t i = 0; i < sizeof(in); i++)
+        in[i] = (unsigned char)(i * 7 + 1);
+
+    SHA256D64(out, in, 13);
+    for (size_t i = 0; i < 13; i++) {
+        CSHA256().Write(in + 64 * i, 64).Finalize(hash);
+        CSHA256().Write(hash, 32).Finalize(hash);
+        if (memcmp(hash, out + 32 * i, 32)) return false;
+    }
+
+    SHA256D80Nonces(out, in, 13);
+    unsigned char header[80];
+    memcpy(header, in, 80);
+    for (size_t i = 0; i < 13; i++) {
+        WriteLE32(header + 76, ReadLE32(in + 76) + i);
+        CSHA256().Write(header, 80).Finalize(hash);
+        CSHA256().Write(hash, 32).Finalize(hash);
+        if (memcmp(hash, out + 32 * i, 32)) return false;
+    }
+    return true;
+}
 
 } // namespace
 
@@ -187,8 +288,100 @@ std::string SHA256AutoDetect()
     }
 #endif
 
+    std::string ret = "standard";
+    Transform = sha256::Transform;
+    Transform4 = NULL;
+    Transform8 = NULL;
+#if defined(ENABLE_SHA256_X86)
+    uint32_t eax, ebx, ecx, edx;
+    bool have_sse41 = false, have_avx2 = false, have_shani = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        have_sse41 = (ecx >> 19) & 1;
+        bool have_xsave = ((ecx >> 27) & 1) && ((ecx >> 28) & 1); // OSXSAVE and AVX
+        if (__get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            have_shani = have_sse41 && ((ebx >> 29) & 1);
+            if (have_xsave && ((ebx >> 5) & 1)) {
+                // The OS must save the YMM registers too
+                uint32_t xcr0_lo, xcr0_hi;
+                __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+                have_avx2 = (xcr0_lo & 6) == 6;
+            }
+        }
+    }
+
+    if (have_shani) {
+        // One SHA-NI lane beats the wide vector kernels, so use it everywhere
+        Transform = sha256_shani::Transform;
+        ret = "shani(1way)";
+    } else {
+        if (have_sse41) {
+            Transform4 = sha256_sse41::Transform_4way;
+            ret += ",sse41(4way)";
+        }
+        if (have_avx2) {
+            Transform8 = sha256_avx2::Transform_8way;
+            ret += ",avx2(8way)";
+        }
+    }
+#endif
+
     assert(SelfTest(Transform));
-    return "standard";
+    assert(SelfTestDouble());
+    return ret;
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    uint32_t s[8 * LANES];
+    unsigned char buf[64 * LANES];
+    InitPad32(buf, LANES);
+    while (blocks) {
+        size_t lanes = std::min(blocks, LANES);
+        for (size_t i = 0; i < lanes; i++)
+            sha256::Initialize(s + 8 * i);
+        TransformLanes(s, in, 64, lanes);
+        TransformLanes(s, pad64, 0, lanes);
+        // All of this group's input has been read, so out may overlap it
+        FinalizeDouble(out, s, buf, lanes);
+        in += 64 * lanes;
+        out += 32 * lanes;
+        blocks -= lanes;
+    }
+}
+
+void SHA256D80Nonces(unsigned char* out, const unsigned char* header, size_t count)
+{
+    uint32_t midstate[8];
+    sha256::Initialize(midstate);
+    Transform(midstate, header, 1);
+
+    // Second chunk of each lane: the last 16 header bytes, then the padding
+    // for an 80-byte (640-bit) message
+    uint32_t s[8 * LANES];
+    unsigned char chunks[64 * LANES], buf[64 * LANES];
+    for (size_t i = 0; i < LANES; i++) {
+        unsigned char* chunk = chunks + 64 * i;
+        memcpy(chunk, header + 64, 16);
+        memset(chunk + 16, 0, 48);
+        chunk[16] = 0x80;
+        chunk[62] = 0x02;
+        chunk[63] = 0x80;
+    }
+    InitPad32(buf, LANES);
+
+    uint32_t nNonce = ReadLE32(header + 76);
+    while (count) {
+        size_t lanes = std::min(count, LANES);
+        for (size_t i = 0; i < lanes; i++) {
+            memcpy(s + 8 * i, midstate, sizeof(midstate));
+            WriteLE32(chunks + 64 * i + 12, nNonce++);
+        }
+        TransformLanes(s, chunks, 64, lanes);
+        FinalizeDouble(out, s, buf, lanes);
+        out += 32 * lanes;
+        count -= lanes;
+    }
 }
 
 ////// SHA-256
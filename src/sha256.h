@@ -31,4 +31,19 @@ public:
  */
 std::string SHA256AutoDetect();
 
+/** Compute multiple double-SHA256's of 64-byte blobs, as used by merkle trees.
+ *  output:  pointer to a blocks*32 byte output buffer; may equal input, so a
+ *           merkle level can be hashed into its own first half
+ *  input:   pointer to a blocks*64 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
+/** Compute the double-SHA256 of an 80-byte block header for count consecutive
+ *  nonces, starting with the little-endian nonce stored at header[76..79].
+ *  The first 64 bytes are only compressed once.
+ *  output:  pointer to a count*32 byte output buffer
+ */
+void SHA256D80Nonces(unsigned char* output, const unsigned char* header, size_t count);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
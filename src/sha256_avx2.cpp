@@ -0,0 +1,174 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 8-way AVX2 SHA-256 compression, one independent state per lane.
+// Built with a per-function target attribute so the rest of the tree needs
+// no extra compiler flags; only called after SHA256AutoDetect() has checked
+// the CPU.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <immintrin.h>
+
+#include "cryptocommon.h"
+
+#define SHA256_TARGET __attribute__((target("avx2")))
+
+namespace sha256_avx2 {
+namespace {
+
+SHA256_TARGET inline __m256i K(uint32_t x) { return _mm256_set1_epi32(x); }
+
+SHA256_TARGET inline __m256i Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+SHA256_TARGET inline __m256i Add(__m256i x, __m256i y, __m256i z) { return Add(Add(x, y), z); }
+SHA256_TARGET inline __m256i Inc(__m256i& x, __m256i y, __m256i z, __m256i w) { x = Add(Add(x, y), Add(z, w)); return x; }
+SHA256_TARGET inline __m256i Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+SHA256_TARGET inline __m256i Xor(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+SHA256_TARGET inline __m256i Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+SHA256_TARGET inline __m256i And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+SHA256_TARGET inline __m256i ShR(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+SHA256_TARGET inline __m256i ShL(__m256i x, int n) { return _mm256_slli_epi32(x, n); }
+
+SHA256_TARGET inline __m256i Ch(__m256i x, __m256i y, __m256i z) { return Xor(z, And(x, Xor(y, z))); }
+SHA256_TARGET inline __m256i Maj(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), And(z, Or(x, y))); }
+SHA256_TARGET inline __m256i Sigma0(__m256i x) { return Xor(Or(ShR(x, 2), ShL(x, 30)), Or(ShR(x, 13), ShL(x, 19)), Or(ShR(x, 22), ShL(x, 10))); }
+SHA256_TARGET inline __m256i Sigma1(__m256i x) { return Xor(Or(ShR(x, 6), ShL(x, 26)), Or(ShR(x, 11), ShL(x, 21)), Or(ShR(x, 25), ShL(x, 7))); }
+SHA256_TARGET inline __m256i sigma0(__m256i x) { return Xor(Or(ShR(x, 7), ShL(x, 25)), Or(ShR(x, 18), ShL(x, 14)), ShR(x, 3)); }
+SHA256_TARGET inline __m256i sigma1(__m256i x) { return Xor(Or(ShR(x, 17), ShL(x, 15)), Or(ShR(x, 19), ShL(x, 13)), ShR(x, 10)); }
+
+/** One round of SHA-256, with the round constant already added to the message word. */
+SHA256_TARGET inline void Round(__m256i a, __m256i b, __m256i c, __m256i& d, __m256i e, __m256i f, __m256i g, __m256i& h, __m256i k)
+{
+    __m256i t1 = Add(h, Sigma1(e), Ch(e, f, g));
+    t1 = Add(t1, k);
+    __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+/** Gather one big-endian message word from each lane's chunk. */
+SHA256_TARGET inline __m256i Read(const unsigned char* chunk, size_t stride, size_t offset)
+{
+    return _mm256_set_epi32(ReadBE32(chunk + 7 * stride + offset), ReadBE32(chunk + 6 * stride + offset), ReadBE32(chunk + 5 * stride + offset), ReadBE32(chunk + 4 * stride + offset), ReadBE32(chunk + 3 * stride + offset), ReadBE32(chunk + 2 * stride + offset), ReadBE32(chunk + 1 * stride + offset), ReadBE32(chunk + offset));
+}
+
+} // namespace
+
+/** Compress one 64-byte chunk into each of 8 states. Lane i uses state
+ *  s[8*i..8*i+7] and the chunk at chunk + i*stride (stride 0 feeds the same
+ *  chunk to every lane).
+ */
+SHA256_TARGET void Transform_8way(uint32_t* s, const unsigned char* chunk, size_t stride)
+{
+    alignas(32) uint32_t v[8][8];
+    for (int i = 0; i < 8; ++i)
+        for (int l = 0; l < 8; ++l)
+            v[i][l] = s[8 * l + i];
+
+    __m256i a = _mm256_load_si256((const __m256i*)v[0]);
+    __m256i b = _mm256_load_si256((const __m256i*)v[1]);
+    __m256i c = _mm256_load_si256((const __m256i*)v[2]);
+    __m256i d = _mm256_load_si256((const __m256i*)v[3]);
+    __m256i e = _mm256_load_si256((const __m256i*)v[4]);
+    __m256i f = _mm256_load_si256((const __m256i*)v[5]);
+    __m256i g = _mm256_load_si256((const __m256i*)v[6]);
+    __m256i h = _mm256_load_si256((const __m256i*)v[7]);
+    __m256i w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13, w14, w15;
+    __m256i a0 = a, b0 = b, c0 = c, d0 = d, e0 = e, f0 = f, g0 = g, h0 = h;
+
+    Round(a, b, c, d, e, f, g, h, Add(K(0x428a2f98ul), w0 = Read(chunk, stride, 0)));
+    Round(h, a, b, c, d, e, f, g, Add(K(0x71374491ul), w1 = Read(chunk, stride, 4)));
+    Round(g, h, a, b, c, d, e, f, Add(K(0xb5c0fbcful), w2 = Read(chunk, stride, 8)));
+    Round(f, g, h, a, b, c, d, e, Add(K(0xe9b5dba5ul), w3 = Read(chunk, stride, 12)));
+    Round(e, f, g, h, a, b, c, d, Add(K(0x3956c25bul), w4 = Read(chunk, stride, 16)));
+    Round(d, e, f, g, h, a, b, c, Add(K(0x59f111f1ul), w5 = Read(chunk, stride, 20)));
+    Round(c, d, e, f, g, h, a, b, Add(K(0x923f82a4ul), w6 = Read(chunk, stride, 24)));
+    Round(b, c, d, e, f, g, h, a, Add(K(0xab1c5ed5ul), w7 = Read(chunk, stride, 28)));
+    Round(a, b, c, d, e, f, g, h, Add(K(0xd807aa98ul), w8 = Read(chunk, stride, 32)));
+    Round(h, a, b, c, d, e, f, g, Add(K(0x12835b01ul), w9 = Read(chunk, stride, 36)));
+    Round(g, h, a, b, c, d, e, f, Add(K(0x243185beul), w10 = Read(chunk, stride, 40)));
+    Round(f, g, h, a, b, c, d, e, Add(K(0x550c7dc3ul), w11 = Read(chunk, stride, 44)));
+    Round(e, f, g, h, a, b, c, d, Add(K(0x72be5d74ul), w12 = Read(chunk, stride, 48)));
+    Round(d, e, f, g, h, a, b, c, Add(K(0x80deb1feul), w13 = Read(chunk, stride, 52)));
+    Round(c, d, e, f, g, h, a, b, Add(K(0x9bdc06a7ul), w14 = Read(chunk, stride, 56)));
+    Round(b, c, d, e, f, g, h, a, Add(K(0xc19bf174ul), w15 = Read(chunk, stride, 60)));
+
+    Round(a, b, c, d, e, f, g, h, Add(K(0xe49b69c1ul), Inc(w0, sigma1(w14), w9, sigma0(w1))));
+    Round(h, a, b, c, d, e, f, g, Add(K(0xefbe4786ul), Inc(w1, sigma1(w15), w10, sigma0(w2))));
+    Round(g, h, a, b, c, d, e, f, Add(K(0x0fc19dc6ul), Inc(w2, sigma1(w0), w11, sigma0(w3))));
+    Round(f, g, h, a, b, c, d, e, Add(K(0x240ca1ccul), Inc(w3, sigma1(w1), w12, sigma0(w4))));
+    Round(e, f, g, h, a, b, c, d, Add(K(0x2de92c6ful), Inc(w4, sigma1(w2), w13, sigma0(w5))));
+    Round(d, e, f, g, h, a, b, c, Add(K(0x4a7484aaul), Inc(w5, sigma1(w3), w14, sigma0(w6))));
+    Round(c, d, e, f, g, h, a, b, Add(K(0x5cb0a9dcul), Inc(w6, sigma1(w4), w15, sigma0(w7))));
+    Round(b, c, d, e, f, g, h, a, Add(K(0x76f988daul), Inc(w7, sigma1(w5), w0, sigma0(w8))));
+    Round(a, b, c, d, e, f, g, h, Add(K(0x983e5152ul), Inc(w8, sigma1(w6), w1, sigma0(w9))));
+    Round(h, a, b, c, d, e, f, g, Add(K(0xa831c66dul), Inc(w9, sigma1(w7), w2, sigma0(w10))));
+    Round(g, h, a, b, c, d, e, f, Add(K(0xb00327c8ul), Inc(w10, sigma1(w8), w3, sigma0(w11))));
+    Round(f, g, h, a, b, c, d, e, Add(K(0xbf597fc7ul), Inc(w11, sigma1(w9), w4, sigma0(w12))));
+    Round(e, f, g, h, a, b, c, d, Add(K(0xc6e00bf3ul), Inc(w12, sigma1(w10), w5, sigma0(w13))));
+    Round(d, e, f, g, h, a, b, c, Add(K(0xd5a79147ul), Inc(w13, sigma1(w11), w6, sigma0(w14))));
+    Round(c, d, e, f, g, h, a, b, Add(K(0x06ca6351ul), Inc(w14, sigma1(w12), w7, sigma0(w15))));
+    Round(b, c, d, e, f, g, h, a, Add(K(0x14292967ul), Inc(w15, sigma1(w13), w8, sigma0(w0))));
+
+    Round(a, b, c, d, e, f, g, h, Add(K(0x27b70a85ul), Inc(w0, sigma1(w14), w9, sigma0(w1))));
+    Round(h, a, b, c, d, e, f, g, Add(K(0x2e1b2138ul), Inc(w1, sigma1(w15), w10, sigma0(w2))));
+    Round(g, h, a, b, c, d, e, f, Add(K(0x4d2c6dfcul), Inc(w2, sigma1(w0), w11, sigma0(w3))));
+    Round(f, g, h, a, b, c, d, e, Add(K(0x53380d13ul), Inc(w3, sigma1(w1), w12, sigma0(w4))));
+    Round(e, f, g, h, a, b, c, d, Add(K(0x650a7354ul), Inc(w4, sigma1(w2), w13, sigma0(w5))));
+    Round(d, e, f, g, h, a, b, c, Add(K(0x766a0abbul), Inc(w5, sigma1(w3), w14, sigma0(w6))));
+    Round(c, d, e, f, g, h, a, b, Add(K(0x81c2c92eul), Inc(w6, sigma1(w4), w15, sigma0(w7))));
+    Round(b, c, d, e, f, g, h, a, Add(K(0x92722c85ul), Inc(w7, sigma1(w5), w0, sigma0(w8))));
+    Round(a, b, c, d, e, f, g, h, Add(K(0xa2bfe8a1ul), Inc(w8, sigma1(w6), w1, sigma0(w9))));
+    Round(h, a, b, c, d, e, f, g, Add(K(0xa81a664bul), Inc(w9, sigma1(w7), w2, sigma0(w10))));
+    Round(g, h, a, b, c, d, e, f, Add(K(0xc24b8b70ul), Inc(w10, sigma1(w8), w3, sigma0(w11))));
+    Round(f, g, h, a, b, c, d, e, Add(K(0xc76c51a3ul), Inc(w11, sigma1(w9), w4, sigma0(w12))));
+    Round(e, f, g, h, a, b, c, d, Add(K(0xd192e819ul), Inc(w12, sigma1(w10), w5, sigma0(w13))));
+    Round(d, e, f, g, h, a, b, c, Add(K(0xd6990624ul), Inc(w13, sigma1(w11), w6, sigma0(w14))));
+    Round(c, d, e, f, g, h, a, b, Add(K(0xf40e3585ul), Inc(w14, sigma1(w12), w7, sigma0(w15))));
+    Round(b, c, d, e, f, g, h, a, Add(K(0x106aa070ul), Inc(w15, sigma1(w13), w8, sigma0(w0))));
+
+    Round(a, b, c, d, e, f, g, h, Add(K(0x19a4c116ul), Inc(w0, sigma1(w14), w9, sigma0(w1))));
+    Round(h, a, b, c, d, e, f, g, Add(K(0x1e376c08ul), Inc(w1, sigma1(w15), w10, sigma0(w2))));
+    Round(g, h, a, b, c, d, e, f, Add(K(0x2748774cul), Inc(w2, sigma1(w0), w11, sigma0(w3))));
+    Round(f, g, h, a, b, c, d, e, Add(K(0x34b0bcb5ul), Inc(w3, sigma1(w1), w12, sigma0(w4))));
+    Round(e, f, g, h, a, b, c, d, Add(K(0x391c0cb3ul), Inc(w4, sigma1(w2), w13, sigma0(w5))));
+    Round(d, e, f, g, h, a, b, c, Add(K(0x4ed8aa4aul), Inc(w5, sigma1(w3), w14, sigma0(w6))));
+    Round(c, d, e, f, g, h, a, b, Add(K(0x5b9cca4ful), Inc(w6, sigma1(w4), w15, sigma0(w7))));
+    Round(b, c, d, e, f, g, h, a, Add(K(0x682e6ff3ul), Inc(w7, sigma1(w5), w0, sigma0(w8))));
+    Round(a, b, c, d, e, f, g, h, Add(K(0x748f82eeul), Inc(w8, sigma1(w6), w1, sigma0(w9))));
+    Round(h, a, b, c, d, e, f, g, Add(K(0x78a5636ful), Inc(w9, sigma1(w7), w2, sigma0(w10))));
+    Round(g, h, a, b, c, d, e, f, Add(K(0x84c87814ul), Inc(w10, sigma1(w8), w3, sigma0(w11))));
+    Round(f, g, h, a, b, c, d, e, Add(K(0x8cc70208ul), Inc(w11, sigma1(w9), w4, sigma0(w12))));
+    Round(e, f, g, h, a, b, c, d, Add(K(0x90befffaul), Inc(w12, sigma1(w10), w5, sigma0(w13))));
+    Round(d, e, f, g, h, a, b, c, Add(K(0xa4506cebul), Inc(w13, sigma1(w11), w6, sigma0(w14))));
+    Round(c, d, e, f, g, h, a, b, Add(K(0xbef9a3f7ul), Inc(w14, sigma1(w12), w7, sigma0(w15))));
+    Round(b, c, d, e, f, g, h, a, Add(K(0xc67178f2ul), Inc(w15, sigma1(w13), w8, sigma0(w0))));
+
+    a = Add(a, a0);
+    b = Add(b, b0);
+    c = Add(c, c0);
+    d = Add(d, d0);
+    e = Add(e, e0);
+    f = Add(f, f0);
+    g = Add(g, g0);
+    h = Add(h, h0);
+
+    _mm256_store_si256((__m256i*)v[0], a);
+    _mm256_store_si256((__m256i*)v[1], b);
+    _mm256_store_si256((__m256i*)v[2], c);
+    _mm256_store_si256((__m256i*)v[3], d);
+    _mm256_store_si256((__m256i*)v[4], e);
+    _mm256_store_si256((__m256i*)v[5], f);
+    _mm256_store_si256((__m256i*)v[6], g);
+    _mm256_store_si256((__m256i*)v[7], h);
+    for (int i = 0; i < 8; ++i)
+        for (int l = 0; l < 8; ++l)
+            s[8 * l + i] = v[i][l];
+}
+
+} // namespace sha256_avx2
+
+#endif
@@ -105,7 +105,7 @@ CAuxpowBuilder::CAuxpowBuilder(int baseVersion, int16_t chainId)
 void
 CAuxpowBuilder::setCoinbase(const CScript& scr)
 {
-    CTransaction mtx;
+    CMutableTransaction mtx;
     mtx.vin.resize(1);
     mtx.vin[0].prevout.SetNull();
     mtx.vin[0].scriptSig = scr;
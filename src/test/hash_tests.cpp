@@ -3,7 +3,12 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "core.h"
 #include "hash.h"
+#include "hashx17.h"
+#include "main.h"
+#include "scrypt.h"
+#include "sha256.h"
 #include "util.h"
 
 #include <vector>
@@ -47,4 +52,206 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64_test)
+{
+    BOOST_TEST_MESSAGE("SHA256 implementation: " + SHA256AutoDetect());
+
+    // enough blobs to go through every lane width, and every remainder
+    std::vector<unsigned char> vIn(64 * 20);
+    for (unsigned int i = 0; i < vIn.size(); i++)
+        vIn[i] = insecure_rand();
+    for (unsigned int nBlocks = 0; nBlocks <= 20; nBlocks++) {
+        std::vector<unsigned char> vOut(32 * nBlocks);
+        SHA256D64(vOut.data(), vIn.data(), nBlocks);
+        for (unsigned int i = 0; i < nBlocks; i++) {
+            uint256 hash = Hash(vIn.begin() + 64 * i, vIn.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(hash.begin(), &vOut[32 * i], 32) == 0);
+        }
+
+        // merkle levels are hashed in place
+        std::vector<unsigned char> vInPlace(vIn.begin(), vIn.begin() + 64 * nBlocks);
+        if (nBlocks > 0) {
+            SHA256D64(vInPlace.data(), vInPlace.data(), nBlocks);
+            BOOST_CHECK(memcmp(vInPlace.data(), vOut.data(), vOut.size()) == 0);
+        }
+    }
+
+    // nonce batches, across the nonce wrapping round
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1500000000;
+    header.nBits = 0x1d00ffff;
+    header.nNonce = 0xfffffff8;
+    unsigned char out[32 * 20];
+    SHA256D80Nonces(out, (const unsigned char*)BEGIN(header.nVersion), 20);
+    for (unsigned int i = 0; i < 20; i++) {
+        uint256 hash = Hash(BEGIN(header.nVersion), END(header.nNonce));
+        BOOST_CHECK(memcmp(hash.begin(), out + 32 * i, 32) == 0);
+        BOOST_CHECK(header.GetHash() == hash);
+        header.nNonce++;
+    }
+}
+
+// The merkle root as built before the batched double-SHA256, one pair at a time
+static uint256 SerialMerkleRoot(const CBlock& block)
+{
+    std::vector<uint256> vTree;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        vTree.push_back(tx.GetHash());
+    int j = 0;
+    for (int nSize = block.vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        for (int i = 0; i < nSize; i += 2)
+        {
+            int i2 = std::min(i+1, nSize-1);
+            vTree.push_back(Hash(BEGIN(vTree[j+i]), END(vTree[j+i]), BEGIN(vTree[j+i2]), END(vTree[j+i2])));
+        }
+        j += nSize;
+    }
+    return vTree.empty() ? 0 : vTree.back();
+}
+
+BOOST_AUTO_TEST_CASE(merkle_root_benchmark)
+{
+    const unsigned int nTxCounts[] = {1000, 4000, 10000};
+    for (unsigned int n = 0; n < sizeof(nTxCounts) / sizeof(nTxCounts[0]); n++) {
+        CBlock block;
+        for (unsigned int i = 0; i < nTxCounts[n]; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            tx.vout.resize(1);
+            tx.vout[0].nValue = i;
+            block.vtx.push_back(tx);
+        }
+
+        const int nRounds = 20;
+        uint256 hashRoot;
+        int64_t nStart = GetTimeMicros();
+        for (int r = 0; r < nRounds; r++)
+            hashRoot = block.BuildMerkleTree();
+        int64_t nBatched = GetTimeMicros() - nStart;
+
+        uint256 hashSerial;
+        nStart = GetTimeMicros();
+        for (int r = 0; r < nRounds; r++)
+            hashSerial = SerialMerkleRoot(block);
+        int64_t nSerial = GetTimeMicros() - nStart;
+        BOOST_CHECK(hashRoot == hashSerial);
+
+        // the partial merkle tree of one matched tx needs the whole tree's hashes too
+        std::vector<uint256> vTxid;
+        std::vector<bool> vMatch(block.vtx.size(), false);
+        vMatch[block.vtx.size() - 1] = true;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            vTxid.push_back(tx.GetHash());
+        CPartialMerkleTree pmt(vTxid, vMatch);
+        std::vector<uint256> vMatched;
+        BOOST_CHECK(pmt.ExtractMatches(vMatched) == hashRoot);
+        BOOST_CHECK(vMatched.size() == 1 && vMatched[0] == vTxid.back());
+
+        BOOST_TEST_MESSAGE(strprintf("%u txs: %d merkle roots/s batched, %d merkle roots/s serial", nTxCounts[n],
+                                     nRounds * 1000000LL / std::max(nBatched, (int64_t)1),
+                                     nRounds * 1000000LL / std::max(nSerial, (int64_t)1)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(x17_batch)
+{
+    BOOST_TEST_MESSAGE(strprintf("X17 AVX2 stages: %s", CHashX17::IsVectorized() ? "yes" : "no"));
+
+    CHashX17 hasher;
+    unsigned char data[80 * 10];
+    for (unsigned int i = 0; i < 80; i++)
+        data[i] = i;
+    BOOST_CHECK_EQUAL(hasher.Hash(data, 80).GetHex(), "46d6e98b38cf958524d425e39ddc2477c05dd22720fd97422797620d81096835");
+
+    // full lane groups and partial ones, checked against single hashes
+    for (unsigned int i = 0; i < sizeof(data); i++)
+        data[i] = insecure_rand();
+    for (unsigned int n = 0; n <= 10; n++) {
+        uint256 hashes[10];
+        hasher.HashMany(hashes, data, 80, n);
+        for (unsigned int i = 0; i < n; i++)
+            BOOST_CHECK(hashes[i] == hasher.Hash(data + 80 * i, 80));
+    }
+    // messages longer than one BLAKE block take the per-lane BLAKE
+    uint256 hashes[4];
+    hasher.HashMany(hashes, data, 200, 4);
+    for (unsigned int i = 0; i < 4; i++)
+        BOOST_CHECK(hashes[i] == hasher.Hash(data + 200 * i, 200));
+
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1500000000;
+    header.nBits = 0x1d00ffff;
+    header.nNonce = 0;
+    BOOST_CHECK(header.GetPoWHash(ALGO_X17) == hasher.Hash(BEGIN(header.nVersion), 80));
+
+    const unsigned int nHashes = 400;
+    std::vector<unsigned char> vHeaders(80 * nHashes);
+    for (unsigned int i = 0; i < nHashes; i++, header.nNonce++)
+        memcpy(&vHeaders[80 * i], BEGIN(header.nVersion), 80);
+    std::vector<uint256> vSingle(nHashes), vBatched(nHashes);
+    int64_t nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nHashes; i++)
+        vSingle[i] = hasher.Hash(&vHeaders[80 * i], 80);
+    int64_t nSingle = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    hasher.HashMany(&vBatched[0], &vHeaders[0], 80, nHashes);
+    int64_t nBatched = GetTimeMicros() - nStart;
+    BOOST_CHECK(vSingle == vBatched);
+    BOOST_TEST_MESSAGE(strprintf("X17: %d H/s single, %d H/s batched",
+                                 nHashes * 1000000LL / std::max(nSingle, (int64_t)1),
+                                 nHashes * 1000000LL / std::max(nBatched, (int64_t)1)));
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_batch)
+{
+    CBlockHeader header;
+    header.nVersion = 2;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1405274400;
+    header.nBits = 0x1e0fffff;
+    header.nNonce = 0;
+    const unsigned int nHashes = 64;
+    std::vector<char> vHeaders(80 * nHashes);
+    for (unsigned int i = 0; i < nHashes; i++, header.nNonce++)
+        memcpy(&vHeaders[80 * i], BEGIN(header.nVersion), 80);
+    std::vector<char> vScratchpad(SCRYPT_MANY_SCRATCHPAD_SIZE);
+
+    // every lane width and remainder against the single hash
+    std::vector<uint256> vExpected(nHashes);
+    for (unsigned int i = 0; i < nHashes; i++)
+        scrypt_1024_1_1_256_sp_generic(&vHeaders[80 * i], BEGIN(vExpected[i]), &vScratchpad[0]);
+    for (unsigned int n = 0; n <= 2 * SCRYPT_MAX_WAYS + 3; n++) {
+        std::vector<uint256> vHashes(n);
+        if (n > 0)
+            scrypt_1024_1_1_256_sp_many(&vHeaders[0], BEGIN(vHashes[0]), n, &vScratchpad[0]);
+        for (unsigned int i = 0; i < n; i++)
+            BOOST_CHECK(vHashes[i] == vExpected[i]);
+    }
+
+    const std::string strImpl = scrypt_detect();
+    BOOST_TEST_MESSAGE("scrypt implementation: " + strImpl);
+    const int nWays[] = {1, 4, 8};
+    const char* strKernel[] = {"generic", "sse2(4way)", "avx2(8way)"};
+    for (unsigned int k = 0; k < sizeof(nWays) / sizeof(nWays[0]); k++) {
+        if (k > 0 && strImpl.find(strKernel[k]) == std::string::npos)
+            continue;
+        std::vector<uint256> vHashes(nHashes);
+        int64_t nStart = GetTimeMicros();
+        scrypt_1024_1_1_256_sp_many(&vHeaders[0], BEGIN(vHashes[0]), nHashes, &vScratchpad[0], nWays[k]);
+        int64_t nTime = GetTimeMicros() - nStart;
+        BOOST_CHECK(vHashes == vExpected);
+        BOOST_TEST_MESSAGE(strprintf("scrypt %s: %d H/s", strKernel[k],
+                                     nHashes * 1000000LL / std::max(nTime, (int64_t)1)));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
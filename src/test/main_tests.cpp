@@ -3,11 +3,23 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "argon2.h"
 #include "core.h"
+#include "equihash.h"
+#include "hash.h"
 #include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
+extern "C" void slow_hash_free_state(void);
+extern "C" void cn_slow_hash(const void *data, size_t length, char *hash, int variant, int prehashed);
+
 BOOST_AUTO_TEST_SUITE(main_tests)
 
 BOOST_AUTO_TEST_CASE(subsidy_limit_test)
@@ -25,4 +37,946 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
   */
 }
 
+/* Build a chain of nBlocks entries whose versions drift in and out of the fork majority */
+static void BuildSyntheticChain(std::vector<CBlockIndex>& vIndex, int nBlocks)
+{
+    vIndex.resize(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex& index = vIndex[i];
+        index.pprev = i ? &vIndex[i - 1] : NULL;
+        index.nHeight = i;
+        index.nTime = 1405274400 + i * 120;
+        unsigned int nPercentV4 = ((i / 500) % 4) * 30 + 10; // 10%, 40%, 70%, 100%
+        index.nVersion = (insecure_rand() % 100 < nPercentV4) ? 4 : 2;
+        index.nVersion |= (insecure_rand() % NUM_ALGOS) << 9;
+        if (insecure_rand() % 8 == 0)
+            index.nVersion |= BLOCK_VERSION_UPDATE_SSF;
+        index.BuildForkState();
+        index.BuildAlgoSkip();
+        index.BuildMedianTimePast();
+    }
+}
+
+/* Reference implementation of get_pprev_algo, walking the chain block by block */
+static const CBlockIndex* LegacyPrevAlgo(const CBlockIndex* p, int algo)
+{
+    if (!p || !p->onFork())
+        return NULL;
+    for (const CBlockIndex* pprev = p->pprev; pprev && pprev->onFork(); pprev = pprev->pprev)
+        if (pprev->GetAlgo() == algo)
+            return pprev;
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(fork_state_cache_test)
+{
+    std::vector<CBlockIndex> vIndex;
+    BuildSyntheticChain(vIndex, 10000);
+
+    int nOnFork = 0;
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        const CBlockIndex& index = vIndex[i];
+        bool fLegacyOnFork = index.nHeight >= nForkHeight && CBlockIndex::IsSuperMajority(4, index.pprev, 75, 100);
+        bool fLegacyMajority = CBlockIndex::IsSuperMajority(4, &index, 75, 100);
+        BOOST_CHECK_EQUAL(index.onFork(), fLegacyOnFork);
+        BOOST_CHECK_EQUAL(index.IsForkMajority(), fLegacyMajority);
+        if (fLegacyOnFork)
+            nOnFork++;
+    }
+    // the synthetic chain must actually cross the activation threshold in both directions
+    BOOST_CHECK(nOnFork > 0 && nOnFork < (int)vIndex.size());
+
+    // an entry whose parent has no cached state falls back to walking the chain
+    CBlockIndex indexDummy;
+    indexDummy.pprev = &vIndex.back();
+    indexDummy.nHeight = vIndex.back().nHeight + 1;
+    indexDummy.nVersion = 4;
+    BOOST_CHECK_EQUAL(indexDummy.onFork(), CBlockIndex::IsSuperMajority(4, indexDummy.pprev, 75, 100));
+    vIndex.back().fForkStateBuilt = 0;
+    indexDummy.BuildForkState();
+    BOOST_CHECK_EQUAL(indexDummy.IsForkMajority(), CBlockIndex::IsSuperMajority(4, &indexDummy, 75, 100));
+}
+
+BOOST_AUTO_TEST_CASE(algo_skiplist_test)
+{
+    std::vector<CBlockIndex> vIndex;
+    BuildSyntheticChain(vIndex, 10000);
+
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        const CBlockIndex* pindex = &vIndex[i];
+        BOOST_CHECK(get_pprev_algo(pindex, -1) == LegacyPrevAlgo(pindex, pindex->GetAlgo()));
+        int algo = insecure_rand() % NUM_ALGOS;
+        BOOST_CHECK(get_pprev_algo(pindex, algo) == LegacyPrevAlgo(pindex, algo));
+        if (pindex->pprevAlgo)
+            BOOST_CHECK_EQUAL(pindex->nAlgoHeight, pindex->pprevAlgo->nAlgoHeight + 1);
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        const CBlockIndex* pindex = &vIndex[insecure_rand() % vIndex.size()];
+        int n = 1 + insecure_rand() % 400;
+        int algo = insecure_rand() % NUM_ALGOS;
+        const CBlockIndex* pexpected = LegacyPrevAlgo(pindex, algo);
+        for (int j = 1; j < n && pexpected; j++)
+            pexpected = LegacyPrevAlgo(pexpected, algo);
+        BOOST_CHECK(get_pprev_algo_n(pindex, n, algo) == pexpected);
+    }
+}
+
+/* Reference implementation of get_ssf, measuring all 365 windows from scratch */
+static CBigNum LegacyGetSSF(CBlockIndex* pindex)
+{
+    CBigNum scalingFactor = CBigNum(0);
+    CBlockIndex* pprev_algo = pindex;
+    CBigNum hashes_peak = CBigNum(0);
+    CBigNum hashes_cur = CBigNum(0);
+    for (int i = 0; i < 365; i++) {
+        pprev_algo = get_pprev_algo(pprev_algo, -1);
+        if (!pprev_algo)
+            break;
+        CBigNum hashes = pprev_algo->GetBlockWork();
+        unsigned int time_f = pprev_algo->GetMedianTimePast();
+        unsigned int time_i = 0;
+        for (int j = 0; j < nSSF - 1; j++) {
+            pprev_algo = get_pprev_algo(pprev_algo, -1);
+            if (!pprev_algo) {
+                hashes = CBigNum(0);
+                break;
+            }
+            hashes += pprev_algo->GetBlockWork();
+            time_i = pprev_algo->GetMedianTimePast();
+        }
+        CBlockIndex* pprev_algo_time = get_pprev_algo(pprev_algo, -1);
+        if (pprev_algo_time) {
+            time_i = pprev_algo_time->GetMedianTimePast();
+        } else {
+            CBlockIndex* blockindex = pprev_algo;
+            while (blockindex && blockindex->onFork())
+                blockindex = blockindex->pprev;
+            if (blockindex)
+                time_i = blockindex->GetBlockTime();
+        }
+        if (time_f > time_i)
+            time_f -= time_i;
+        else
+            return scalingFactor;
+        hashes = (hashes * 100000000) / time_f;
+        if (hashes > hashes_peak)
+            hashes_peak = hashes;
+        if (i == 0)
+            hashes_cur = hashes;
+    }
+    if (hashes_peak > CBigNum(0) && hashes_cur != hashes_peak)
+        scalingFactor = CBigNum(((100000000 * hashes_peak) / (hashes_peak - hashes_cur)).getuint());
+    return scalingFactor;
+}
+
+/* Build a two algo chain of nBlocks entries with an update block every nSSF blocks of each algo
+   and a stretch of stalled timestamps early on */
+static void BuildSSFChain(std::vector<CBlockIndex>& vIndex, std::vector<uint256>& vHashes, int nBlocks)
+{
+    vIndex.resize(nBlocks);
+    vHashes.resize(nBlocks);
+    int nAlgoBlocks[NUM_ALGOS] = {};
+    unsigned int nTime = 1405274400;
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex& index = vIndex[i];
+        vHashes[i] = i + 1;
+        index.phashBlock = &vHashes[i];
+        index.pprev = i ? &vIndex[i - 1] : NULL;
+        index.nHeight = i;
+        if (i < 1000 || i > 1400)
+            nTime += 30 + insecure_rand() % 180;
+        index.nTime = nTime;
+        index.nBits = 0x1d00ffff - (insecure_rand() % 4) * 0x1000;
+        int algo = (insecure_rand() % 20 == 0) ? ALGO_SHA256D : ALGO_SCRYPT;
+        index.nVersion = 4 | (algo == ALGO_SHA256D ? BLOCK_VERSION_SHA256D : BLOCK_VERSION_SCRYPT);
+        index.BuildForkState();
+        if (index.onFork() && nAlgoBlocks[algo]++ % nSSF == 0)
+            index.nVersion |= BLOCK_VERSION_UPDATE_SSF;
+        index.BuildAlgoSkip();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ssf_accumulator_test)
+{
+    // more than 365 windows of the main algo
+    const int nBlocks = 36000;
+    std::vector<CBlockIndex> vIndex;
+    std::vector<uint256> vHashes;
+    BuildSSFChain(vIndex, vHashes, nBlocks);
+
+    reset_ssf_accumulators();
+    int nUpdates = 0, nZero = 0;
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex* pindex = &vIndex[i];
+        if (!pindex->onFork() || !update_ssf(pindex->nVersion))
+            continue;
+        CBigNum ssf = get_ssf(pindex);
+        // the reference walk is slow, check a sample of it and the tail past the 365 window horizon
+        if (nUpdates % 8 == 0 || i > nBlocks - 2000)
+            BOOST_CHECK(ssf == LegacyGetSSF(pindex));
+        nUpdates++;
+        if (ssf == 0)
+            nZero++;
+    }
+    BOOST_CHECK(nUpdates > 365);
+    BOOST_CHECK(nZero > 0 && nZero < nUpdates);
+
+    // out of order requests rebuild the windows and still agree
+    for (int i = 0; i < 20; i++) {
+        CBlockIndex* pindex = &vIndex[insecure_rand() % nBlocks];
+        if (pindex->onFork() && update_ssf(pindex->nVersion))
+            BOOST_CHECK(get_ssf(pindex) == LegacyGetSSF(pindex));
+    }
+
+    // templates and the RPC hashrates are measured without moving the windows
+    for (int i = 0; i < 20; i++) {
+        CBlockIndex* pindex = &vIndex[insecure_rand() % nBlocks];
+        if (!pindex->onFork() || !update_ssf(pindex->nVersion))
+            continue;
+        CBigNum ssf = LegacyGetSSF(pindex);
+        CBlockIndex indexTemplate = *pindex;
+        indexTemplate.phashBlock = NULL;
+        BOOST_CHECK(get_ssf(&indexTemplate) == ssf);
+        CBigNum hashes_cur, hashes_peak;
+        if (get_ssf_hashrates(pindex, hashes_cur, hashes_peak)) {
+            if (hashes_peak > CBigNum(0) && hashes_cur != hashes_peak)
+                BOOST_CHECK(ssf == CBigNum(((100000000 * hashes_peak) / (hashes_peak - hashes_cur)).getuint()));
+            else
+                BOOST_CHECK(ssf == 0);
+        } else {
+            BOOST_CHECK(ssf == 0);
+        }
+    }
+    reset_ssf_accumulators();
+}
+
+BOOST_AUTO_TEST_CASE(disk_index_ssf_test)
+{
+    CBlockIndex index;
+    index.nHeight = 500000;
+    index.nMoneySupply = 1234567890123LL;
+    index.nStatus = BLOCK_VALID_SCRIPTS;
+    index.nVersion = 4 | BLOCK_VERSION_SHA256D;
+    index.nTime = 1405274400;
+    index.nBits = 0x1d00ffff;
+    index.subsidyScalingFactor = CBigNum(123456789);
+
+    // the index record carries neither the factor nor its flag, an older client
+    // rewriting it would keep the flag and drop the factor
+    CDataStream ssWithout(SER_DISK, CLIENT_VERSION);
+    ssWithout << CDiskBlockIndex(&index);
+    index.nStatus |= BLOCK_HAVE_SSF;
+    CDataStream ssWith(SER_DISK, CLIENT_VERSION);
+    ssWith << CDiskBlockIndex(&index);
+    BOOST_CHECK(ssWith.str() == ssWithout.str());
+    CDiskBlockIndex diskindex;
+    ssWith >> diskindex;
+    BOOST_CHECK(ssWith.empty());
+    BOOST_CHECK(!(diskindex.nStatus & BLOCK_HAVE_SSF));
+    BOOST_CHECK_EQUAL(diskindex.nMoneySupply, index.nMoneySupply);
+
+    // the factor is kept under its own key
+    uint256 hash = GetRandHash();
+    CBigNum scalingFactor;
+    BOOST_CHECK(!pblocktree->ReadSubsidyScalingFactor(hash, scalingFactor));
+    BOOST_CHECK(pblocktree->WriteSubsidyScalingFactor(hash, index.subsidyScalingFactor));
+    BOOST_CHECK(pblocktree->ReadSubsidyScalingFactor(hash, scalingFactor));
+    BOOST_CHECK(scalingFactor == index.subsidyScalingFactor);
+}
+
+BOOST_AUTO_TEST_CASE(ssf_restart_bench)
+{
+    const int nBlocks = 36000;
+    std::vector<CBlockIndex> vIndex;
+    std::vector<uint256> vHashes;
+    BuildSSFChain(vIndex, vHashes, nBlocks);
+
+    // scaling factors as ConnectBlock sets them while syncing
+    reset_ssf_accumulators();
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex* pindex = &vIndex[i];
+        if (!pindex->onFork())
+            continue;
+        CBlockIndex* pprev_algo = get_pprev_algo(pindex, -1);
+        if (update_ssf(pindex->nVersion)) {
+            pindex->subsidyScalingFactor = get_ssf(pindex);
+            pindex->nStatus |= BLOCK_HAVE_SSF;
+        } else if (pprev_algo) {
+            pindex->subsidyScalingFactor = pprev_algo->subsidyScalingFactor;
+            if (pprev_algo->nStatus & BLOCK_HAVE_SSF)
+                pindex->nStatus |= BLOCK_HAVE_SSF;
+        }
+    }
+
+    // the index records, and the factors an upgraded node keeps next to them
+    CDataStream ssRecords(SER_DISK, CLIENT_VERSION);
+    CDataStream ssFactors(SER_DISK, CLIENT_VERSION);
+    std::map<uint256, CBlockIndex*> mapIndex;
+    for (int i = 0; i < nBlocks; i++) {
+        ssRecords << CDiskBlockIndex(&vIndex[i]);
+        if (vIndex[i].nStatus & BLOCK_HAVE_SSF)
+            ssFactors << vHashes[i] << vIndex[i].subsidyScalingFactor;
+        mapIndex[vHashes[i]] = &vIndex[i];
+    }
+    CBlockIndex* vTip[NUM_ALGOS] = {};
+    for (int i = nBlocks - 1; i >= 0; i--)
+        if (!vTip[vIndex[i].GetAlgo()])
+            vTip[vIndex[i].GetAlgo()] = &vIndex[i];
+
+    // restart-to-ready: load every record and the stored factors, then value the tip of each algo
+    int64_t nValue[2][NUM_ALGOS] = {};
+    int64_t nTime[2];
+    for (int n = 0; n < 2; n++) {
+        CDataStream ss(ssRecords);
+        CDataStream ssSSF(ssFactors);
+        reset_ssf_accumulators();
+        int64_t nStart = GetTimeMicros();
+        for (int i = 0; i < nBlocks; i++) {
+            CDiskBlockIndex diskindex;
+            ss >> diskindex;
+            vIndex[i].nStatus = diskindex.nStatus;
+            vIndex[i].subsidyScalingFactor = 0;
+        }
+        while (n && !ssSSF.empty()) {
+            uint256 hash;
+            ssSSF >> hash;
+            CBlockIndex* pindex = mapIndex[hash];
+            ssSSF >> pindex->subsidyScalingFactor;
+            pindex->nStatus |= BLOCK_HAVE_SSF;
+        }
+        for (int algo = 0; algo < NUM_ALGOS; algo++)
+            if (vTip[algo])
+                nValue[n][algo] = GetBlockValue(vTip[algo], 0);
+        nTime[n] = GetTimeMicros() - nStart;
+        BOOST_CHECK(ss.empty());
+    }
+    for (int algo = 0; algo < NUM_ALGOS; algo++)
+        BOOST_CHECK_EQUAL(nValue[0][algo], nValue[1][algo]);
+    BOOST_TEST_MESSAGE(strprintf("restart-to-ready over %d blocks: %.2fms recomputing scaling factors, %.2fms with stored factors",
+                                 nBlocks, 0.001 * nTime[0], 0.001 * nTime[1]));
+    reset_ssf_accumulators();
+}
+
+BOOST_AUTO_TEST_CASE(retarget_context_test)
+{
+    std::vector<CBlockIndex> vIndex;
+    BuildSyntheticChain(vIndex, 3000);
+    std::vector<uint256> vHashes(vIndex.size());
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        vHashes[i] = i + 1;
+        vIndex[i].phashBlock = &vHashes[i];
+        vIndex[i].nBits = 0x1d00ffff - (insecure_rand() % 0x8000);
+    }
+
+    // the per-algo contexts follow the tip block by block and match the full DarkGravityWave
+    // walk, which entries outside mapBlockIndex always take
+    reset_retarget_contexts();
+    std::vector<unsigned int> vWarm(vIndex.size() * NUM_ALGOS);
+    for (unsigned int i = nForkHeight; i < vIndex.size(); i++) {
+        CBlockIndex indexWalk(vIndex[i]);
+        indexWalk.phashBlock = NULL;
+        for (int algo = 0; algo < NUM_ALGOS; algo++) {
+            vWarm[i * NUM_ALGOS + algo] = GetNextWorkRequired(&vIndex[i], algo);
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&vIndex[i], algo), vWarm[i * NUM_ALGOS + algo]);
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&indexWalk, algo), vWarm[i * NUM_ALGOS + algo]);
+        }
+    }
+    for (int n = 0; n < 500; n++) {
+        unsigned int i = nForkHeight + insecure_rand() % (vIndex.size() - nForkHeight);
+        int algo = insecure_rand() % NUM_ALGOS;
+        reset_retarget_contexts();
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(&vIndex[i], algo), vWarm[i * NUM_ALGOS + algo]);
+    }
+
+    // entries outside mapBlockIndex bypass the contexts and still agree
+    CBlockIndex indexDummy(vIndex.back());
+    indexDummy.phashBlock = NULL;
+    for (int algo = 0; algo < NUM_ALGOS; algo++)
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(&indexDummy, algo), vWarm[(vIndex.size() - 1) * NUM_ALGOS + algo]);
+    reset_retarget_contexts();
+}
+
+BOOST_AUTO_TEST_CASE(median_time_past_test)
+{
+    std::vector<CBlockIndex> vIndex;
+    BuildSyntheticChain(vIndex, 10000);
+    for (unsigned int i = 0; i < vIndex.size(); i++)
+        BOOST_CHECK_EQUAL(vIndex[i].GetMedianTimePast(), vIndex[i].ComputeMedianTimePast());
+
+    // time GetNextWorkRequired for every algo at the tip of a chain past the fork, with the
+    // median time past read from the entries and recomputed on each call as before
+    const int nBlocks = 2000;
+    std::vector<CBlockIndex> vChain(nBlocks);
+    std::vector<uint256> vHashes(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex& index = vChain[i];
+        vHashes[i] = i + 1;
+        index.phashBlock = &vHashes[i];
+        index.pprev = i ? &vChain[i - 1] : NULL;
+        index.nHeight = i;
+        index.nTime = 1405274400 + i * 120 + insecure_rand() % 600;
+        index.nBits = 0x1d00ffff - (insecure_rand() % 0x8000);
+        index.nVersion = 4 | ((insecure_rand() % NUM_ALGOS) << 9);
+        index.BuildForkState();
+        index.BuildAlgoSkip();
+        index.BuildMedianTimePast();
+    }
+    const CBlockIndex* pindexTip = &vChain.back();
+    BOOST_CHECK(pindexTip->onFork());
+
+    const int nRounds = 200;
+    unsigned int nBitsCached[NUM_ALGOS], nBitsComputed[NUM_ALGOS];
+    int64_t nStart = GetTimeMicros();
+    for (int n = 0; n < nRounds; n++) {
+        for (int algo = 0; algo < NUM_ALGOS; algo++) {
+            reset_retarget_contexts();
+            nBitsCached[algo] = GetNextWorkRequired(pindexTip, algo);
+        }
+    }
+    int64_t nCached = GetTimeMicros() - nStart;
+
+    for (int i = 0; i < nBlocks; i++)
+        vChain[i].fMedianTimeBuilt = 0;
+    nStart = GetTimeMicros();
+    for (int n = 0; n < nRounds; n++) {
+        for (int algo = 0; algo < NUM_ALGOS; algo++) {
+            reset_retarget_contexts();
+            nBitsComputed[algo] = GetNextWorkRequired(pindexTip, algo);
+        }
+    }
+    int64_t nComputed = GetTimeMicros() - nStart;
+
+    for (int algo = 0; algo < NUM_ALGOS; algo++)
+        BOOST_CHECK_EQUAL(nBitsCached[algo], nBitsComputed[algo]);
+    BOOST_TEST_MESSAGE(strprintf("GetNextWorkRequired x%d for %d algos: %d us with cached median time past, %d us recomputing it",
+                                 nRounds, NUM_ALGOS, nCached, nComputed));
+    reset_retarget_contexts();
+}
+
+BOOST_AUTO_TEST_CASE(disk_index_auxpow_test)
+{
+    CBlockIndex index;
+    index.nHeight = 500000;
+    index.nStatus = BLOCK_VALID_TRANSACTIONS;
+    index.nVersion = 4 | BLOCK_VERSION_AUXPOW | BLOCK_VERSION_SHA256D;
+    index.nTime = 1405274400;
+    index.nBits = 0x1d00ffff;
+    index.pauxpow.reset(new CAuxPow());
+    index.pauxpow->nChainIndex = 3;
+    index.pauxpow->vChainMerkleBranch.push_back(uint256(12345));
+    index.pauxpow->parentBlock.nNonce = 42;
+
+    CDataStream ssLoaded(SER_DISK, CLIENT_VERSION);
+    ssLoaded << CDiskBlockIndex(&index);
+    uint256 hash = CDiskBlockIndex(&index).GetBlockHash();
+    index.phashBlock = &hash;
+    BOOST_CHECK(pblocktree->WriteBlockIndex(CDiskBlockIndex(&index)));
+
+    // with only the flag left in memory the record is rebuilt from the block tree DB
+    ClearBlockIndexAuxPowCache();
+    index.pauxpow.reset();
+    CDataStream ssPaged(SER_DISK, CLIENT_VERSION);
+    ssPaged << CDiskBlockIndex(&index);
+    BOOST_CHECK(ssPaged.str() == ssLoaded.str());
+    BOOST_CHECK(!index.pauxpow);
+
+    // later requests are served from the cache
+    boost::shared_ptr<CAuxPow> pauxpow = GetBlockIndexAuxPow(&index);
+    BOOST_CHECK(pauxpow && pauxpow->parentBlock.nNonce == 42);
+    BOOST_CHECK(GetBlockIndexAuxPow(&index) == pauxpow);
+
+    uint256 hashUnknown = 1;
+    index.phashBlock = &hashUnknown;
+    BOOST_CHECK(!GetBlockIndexAuxPow(&index));
+
+    // an entry whose auxpow cannot be paged back in is refused rather than written without it
+    BOOST_CHECK(!pblocktree->WriteBlockIndex(CDiskBlockIndex(&index)));
+    CDataStream ssMissing(SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(ssMissing << CDiskBlockIndex(&index), std::ios_base::failure);
+    ClearBlockIndexAuxPowCache();
+}
+
+BOOST_AUTO_TEST_CASE(block_index_arena_test)
+{
+    const int nBlocks = 100000;
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vArena(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        vArena[i] = arena.Allocate();
+        BOOST_CHECK(vArena[i]->pprev == NULL && vArena[i]->nHeight == 0);
+        vArena[i]->pprev = i ? vArena[i - 1] : NULL;
+        vArena[i]->nHeight = i;
+        vArena[i]->nBits = 0x1d00ffff - i;
+        if (i && i % 4096)
+            BOOST_CHECK(vArena[i] == vArena[i - 1] + 1);
+    }
+    BOOST_CHECK_EQUAL(arena.size(), (size_t)nBlocks);
+
+    // the same chain allocated one entry at a time, interleaved with other allocations
+    std::vector<CBlockIndex*> vHeap(nBlocks);
+    std::vector<std::vector<char> > vOther(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        vOther[i].resize(16 + insecure_rand() % 512);
+        vHeap[i] = new CBlockIndex(*vArena[i]);
+        vHeap[i]->pprev = i ? vHeap[i - 1] : NULL;
+    }
+
+    const int nRounds = 20;
+    uint64_t nSumArena = 0, nSumHeap = 0;
+    int64_t nStart = GetTimeMicros();
+    for (int n = 0; n < nRounds; n++)
+        for (const CBlockIndex* pindex = vArena.back(); pindex; pindex = pindex->pprev)
+            nSumArena += pindex->nBits;
+    int64_t nArena = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int n = 0; n < nRounds; n++)
+        for (const CBlockIndex* pindex = vHeap.back(); pindex; pindex = pindex->pprev)
+            nSumHeap += pindex->nBits;
+    int64_t nHeap = GetTimeMicros() - nStart;
+    BOOST_CHECK_EQUAL(nSumArena, nSumHeap);
+    BOOST_TEST_MESSAGE(strprintf("backward scan of %d entries x%d: %d us from the arena, %d us from the heap (entry size %u)",
+                                 nBlocks, nRounds, nArena, nHeap, sizeof(CBlockIndex)));
+
+    // hash lookups through the block map
+    BlockMap mapIndex;
+    for (int i = 0; i < 1000; i++)
+        mapIndex.insert(std::make_pair(GetRandHash(), vArena[i]));
+    uint256 hash = GetRandHash();
+    BOOST_CHECK(mapIndex.find(hash) == mapIndex.end());
+    mapIndex[hash] = vArena.back();
+    BOOST_CHECK(mapIndex.find(hash)->second == vArena.back());
+
+    for (int i = 0; i < nBlocks; i++)
+        delete vHeap[i];
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.size(), (size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(pow_check_queue_test)
+{
+    static const char* algoNames[NUM_ALGOS] = {"scrypt", "sha256d", "yescrypt", "argon2d", "x17", "lyra2rev2", "equihash", "cryptonight"};
+    const int nBlocks = 24;
+    for (int algo = 0; algo < NUM_ALGOS; algo++) {
+        // headers at the weighted limit with random nonces, some meet the target and most do not
+        std::vector<CBlock> vBlocks(nBlocks);
+        for (int i = 0; i < nBlocks; i++) {
+            CBlock& block = vBlocks[i];
+            block.nVersion = 4 | (algo << 9);
+            block.hashPrevBlock = GetRandHash();
+            block.hashMerkleRoot = GetRandHash();
+            block.nTime = 1405274400 + i;
+            block.nBits = (Params().ProofOfWorkLimit() * GetAlgoWeight(algo)).GetCompact();
+            block.nNonce = insecure_rand();
+        }
+
+        std::vector<bool> vSerial(nBlocks);
+        int64_t nStart = GetTimeMicros();
+        for (int i = 0; i < nBlocks; i++) {
+            CValidationState state;
+            vSerial[i] = CheckBlockProofOfWork(vBlocks[i], state);
+        }
+        int64_t nSerial = GetTimeMicros() - nStart;
+
+        std::vector<CBlock*> vpblock;
+        for (int i = 0; i < nBlocks; i++)
+            vpblock.push_back(&vBlocks[i]);
+        nStart = GetTimeMicros();
+        VerifyBlocksProofOfWork(vpblock);
+        int64_t nParallel = GetTimeMicros() - nStart;
+
+        for (int i = 0; i < nBlocks; i++)
+            BOOST_CHECK_EQUAL(vBlocks[i].fPoWChecked, vSerial[i]);
+        BOOST_TEST_MESSAGE(strprintf("%s: %d headers/s serial, %d headers/s on %d threads", algoNames[algo],
+                                     nBlocks * 1000000LL / std::max(nSerial, (int64_t)1),
+                                     nBlocks * 1000000LL / std::max(nParallel, (int64_t)1), nScriptCheckThreads));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pow_hasher_context_test)
+{
+    // hashes from the thread's CPoWHasher must match fresh allocations per hash
+    const int nRounds = 20;
+    std::vector<CBlockHeader> vHeaders(nRounds);
+    for (int i = 0; i < nRounds; i++) {
+        vHeaders[i].hashPrevBlock = GetRandHash();
+        vHeaders[i].hashMerkleRoot = GetRandHash();
+        vHeaders[i].nTime = 1405274400 + i;
+        vHeaders[i].nNonce = insecure_rand();
+    }
+
+    std::vector<uint256> vFresh(nRounds), vReused(nRounds);
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++)
+        argon2d_hash_raw(1,4096,1,BEGIN(vHeaders[i].nVersion),80,BEGIN(vHeaders[i].nVersion),80,BEGIN(vFresh[i]),32);
+    int64_t nFresh = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++)
+        CPoWHasher::ForThread().HashArgon2(BEGIN(vHeaders[i].nVersion),BEGIN(vReused[i]));
+    int64_t nReused = GetTimeMicros() - nStart;
+    BOOST_CHECK(vFresh == vReused);
+    BOOST_TEST_MESSAGE(strprintf("argon2d: %d hashes/s allocating per hash, %d hashes/s with the thread context",
+                                 nRounds * 1000000LL / std::max(nFresh, (int64_t)1), nRounds * 1000000LL / std::max(nReused, (int64_t)1)));
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++) {
+        cn_slow_hash(BEGIN(vHeaders[i].nVersion),80,BEGIN(vFresh[i]),1,0);
+        slow_hash_free_state();
+    }
+    nFresh = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++)
+        CPoWHasher::ForThread().HashCryptonight(BEGIN(vHeaders[i].nVersion),BEGIN(vReused[i]),80);
+    nReused = GetTimeMicros() - nStart;
+    BOOST_CHECK(vFresh == vReused);
+    BOOST_TEST_MESSAGE(strprintf("cryptonight: %d hashes/s allocating per hash, %d hashes/s with the thread context",
+                                 nRounds * 1000000LL / std::max(nFresh, (int64_t)1), nRounds * 1000000LL / std::max(nReused, (int64_t)1)));
+
+    BOOST_CHECK(&CPoWHasher::ForThread() == &CPoWHasher::ForThread());
+}
+
+BOOST_AUTO_TEST_CASE(argon2d_kat_test)
+{
+    // the Argon2d v1.3 vector of ar2/genkat.c, with every fill_block this CPU has
+    unsigned char pwd[32], salt[16], secret[8], ad[12], out[32];
+    memset(pwd, 1, sizeof(pwd));
+    memset(salt, 2, sizeof(salt));
+    memset(secret, 3, sizeof(secret));
+    memset(ad, 4, sizeof(ad));
+
+    std::vector<CBlockHeader> vHeaders(20);
+    for (unsigned int i = 0; i < vHeaders.size(); i++) {
+        vHeaders[i].hashPrevBlock = GetRandHash();
+        vHeaders[i].hashMerkleRoot = GetRandHash();
+        vHeaders[i].nTime = 1405274400 + i;
+        vHeaders[i].nNonce = insecure_rand();
+    }
+    std::vector<uint256> vExpected;
+
+    std::string strLast;
+    for (int fAVX2 = 0; fAVX2 <= 1; fAVX2++) {
+        std::string strImpl = argon2_select_impl(fAVX2);
+        if (strImpl == strLast)
+            continue;
+        strLast = strImpl;
+
+        argon2_context context;
+        memset(&context, 0, sizeof(context));
+        context.out = out;
+        context.outlen = sizeof(out);
+        context.pwd = pwd;
+        context.pwdlen = sizeof(pwd);
+        context.salt = salt;
+        context.saltlen = sizeof(salt);
+        context.secret = secret;
+        context.secretlen = sizeof(secret);
+        context.ad = ad;
+        context.adlen = sizeof(ad);
+        context.t_cost = 3;
+        context.m_cost = 32;
+        context.lanes = 4;
+        context.threads = 1;
+        context.flags = ARGON2_DEFAULT_FLAGS;
+        context.version = ARGON2_VERSION_13;
+        BOOST_CHECK_EQUAL(argon2_ctx(&context, Argon2_d), ARGON2_OK);
+        BOOST_CHECK_EQUAL(HexStr(out, out + sizeof(out)), "512b391b6f1162975371d30919734294f868e3be3984f3c1a13a4db9fabe4acb");
+
+        // proof of work hashes agree across implementations
+        std::vector<uint256> vHashes(vHeaders.size());
+        int64_t nStart = GetTimeMicros();
+        for (unsigned int i = 0; i < vHeaders.size(); i++)
+            CPoWHasher::ForThread().HashArgon2(BEGIN(vHeaders[i].nVersion), BEGIN(vHashes[i]));
+        int64_t nTime = GetTimeMicros() - nStart;
+        if (vExpected.empty())
+            vExpected = vHashes;
+        BOOST_CHECK(vHashes == vExpected);
+        BOOST_TEST_MESSAGE(strprintf("argon2d %s: %d H/s", strImpl,
+                                     vHeaders.size() * 1000000LL / std::max(nTime, (int64_t)1)));
+    }
+    argon2_select_impl(1);
+}
+
+BOOST_AUTO_TEST_CASE(equihash_header_hasher_test)
+{
+    // leaf hashes must match libsodium's BLAKE2b of the same state and index
+    unsigned char header[140];
+    for (unsigned int i = 0; i < sizeof(header); i++)
+        header[i] = insecure_rand();
+    eh_HashState state;
+    EhInitialiseState(200, 9, state);
+    crypto_generichash_blake2b_update(&state, header, sizeof(header));
+    EhHeaderHasher hasher(200, 9, header, sizeof(header));
+    BOOST_CHECK_EQUAL(hasher.GetOutputLength(), 50U);
+
+    // an odd count leaves spare lanes in the last batch
+    eh_index g[7];
+    unsigned char out[7 * 50];
+    for (int i = 0; i < 7; i++)
+        g[i] = insecure_rand() & 0xfffff;
+    hasher.Hash(g, 7, out);
+    for (int i = 0; i < 7; i++) {
+        eh_HashState s = state;
+        eh_index lei = htole32(g[i]);
+        crypto_generichash_blake2b_update(&s, (const unsigned char*)&lei, sizeof(lei));
+        unsigned char ref[50];
+        crypto_generichash_blake2b_final(&s, ref, sizeof(ref));
+        BOOST_CHECK(memcmp(ref, out + 50 * i, 50) == 0);
+    }
+
+    // both verifiers agree on a solution that isn't one
+    std::vector<unsigned char> soln(equihash_solution_size(200, 9));
+    for (unsigned int i = 0; i < soln.size(); i++)
+        soln[i] = insecure_rand();
+    bool fValid = true;
+    EhIsValidSolution(200, 9, state, soln, fValid);
+    BOOST_CHECK(!fValid);
+    BOOST_CHECK(!EhIsValidHeaderSolution(200, 9, hasher, soln));
+    soln.pop_back();
+    BOOST_CHECK(!EhIsValidHeaderSolution(200, 9, hasher, soln));
+}
+
+/* Check a BasicSolve solution for the header 00 01 .. 8a 00 through both verifiers, along with
+   every single bit flip of it and the swap of its two top level subtrees */
+static void CheckKnownSolution(unsigned int n, unsigned int k, const char* pszSoln)
+{
+    unsigned char header[140];
+    for (unsigned int i = 0; i < sizeof(header) - 1; i++)
+        header[i] = i;
+    header[sizeof(header) - 1] = 0;
+    eh_HashState state;
+    EhInitialiseState(n, k, state);
+    crypto_generichash_blake2b_update(&state, header, sizeof(header));
+    EhHeaderHasher hasher(n, k, header, sizeof(header));
+
+    std::vector<unsigned char> soln = ParseHex(pszSoln);
+    BOOST_CHECK_EQUAL(soln.size(), equihash_solution_size(n, k));
+    bool fValid = false;
+    EhIsValidSolution(n, k, state, soln, fValid);
+    BOOST_CHECK(fValid);
+    BOOST_CHECK(EhIsValidHeaderSolution(n, k, hasher, soln));
+
+    for (unsigned int i = 0; i < soln.size() * 8; i++) {
+        std::vector<unsigned char> flipped = soln;
+        flipped[i / 8] ^= 1 << (i % 8);
+        EhIsValidSolution(n, k, state, flipped, fValid);
+        BOOST_CHECK(!fValid);
+        BOOST_CHECK(!EhIsValidHeaderSolution(n, k, hasher, flipped));
+    }
+
+    // both halves hold a whole number of bytes for these parameters
+    std::vector<unsigned char> swapped = soln;
+    std::rotate(swapped.begin(), swapped.begin() + swapped.size() / 2, swapped.end());
+    EhIsValidSolution(n, k, state, swapped, fValid);
+    BOOST_CHECK(!fValid);
+    BOOST_CHECK(!EhIsValidHeaderSolution(n, k, hasher, swapped));
+}
+
+BOOST_AUTO_TEST_CASE(equihash_known_solution_test)
+{
+    CheckKnownSolution(48, 5, "087f0ead41dba8ab393dbe1e31f68e2b19bd08e348c6b0cc59fbeb46ed6a5dc4bee247af");
+    CheckKnownSolution(96, 5, "0d5e1511e9871c0a42ec11ae252499ba7030fa7d33ed2cf788544c6773559ffb65cb103b11ea8d2a4ba7162996a4120c631a2e1737b1ad5c59d13123418bf629d51b1ba2");
+}
+
+// Append a block to blk<nFile>.dat, away from the file the block store writes to
+static CDiskBlockPos WriteTestBlock(CBlock& block, int nFile)
+{
+    static std::map<int, unsigned int> mapFileEnd;
+    CDiskBlockPos pos(nFile, mapFileEnd[nFile]);
+    BOOST_CHECK(WriteBlockToDisk(block, pos));
+    mapFileEnd[nFile] = pos.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    return pos;
+}
+
+BOOST_AUTO_TEST_CASE(trusted_block_read_test)
+{
+    // regtest limits let a few nonces find a valid header for every algo
+    SelectParams(CChainParams::REGTEST);
+    static const char* algoNames[NUM_ALGOS] = {"scrypt", "sha256d", "yescrypt", "argon2d", "x17", "lyra2rev2", "equihash", "cryptonight"};
+    const int nBlocks = 8, nReads = 4;
+    for (int algo = 0; algo < NUM_ALGOS; algo++) {
+        if (algo == ALGO_EQUIHASH)
+            continue; // needs a solution, not just a nonce
+
+        std::vector<uint256> vHash(nBlocks);
+        std::vector<CBlockIndex> vIndex(nBlocks);
+        for (int i = 0; i < nBlocks; i++) {
+            CBlock block;
+            block.nVersion = 4 | (algo << 9);
+            block.hashPrevBlock = GetRandHash();
+            block.nTime = 1405274400 + i;
+            block.nBits = Params().ProofOfWorkLimit().GetCompact();
+            block.vtx.push_back(CTransaction());
+            block.hashMerkleRoot = block.BuildMerkleTree();
+            while (!CheckAuxPowProofOfWork(block, Params()))
+                block.nNonce++;
+
+            CDiskBlockPos pos = WriteTestBlock(block, 1);
+            vHash[i] = block.GetHash();
+            vIndex[i].phashBlock = &vHash[i];
+            vIndex[i].nVersion = block.nVersion;
+            vIndex[i].nFile = pos.nFile;
+            vIndex[i].nDataPos = pos.nPos;
+            vIndex[i].nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
+        }
+
+        CBlock block;
+        int64_t nStart = GetTimeMicros();
+        for (int n = 0; n < nReads; n++)
+            for (int i = 0; i < nBlocks; i++)
+                BOOST_CHECK(ReadBlockFromDisk(block, &vIndex[i], true));
+        int64_t nVerified = GetTimeMicros() - nStart;
+        nStart = GetTimeMicros();
+        for (int n = 0; n < nReads; n++)
+            for (int i = 0; i < nBlocks; i++)
+                BOOST_CHECK(ReadBlockFromDisk(block, &vIndex[i]));
+        int64_t nTrusted = GetTimeMicros() - nStart;
+        BOOST_TEST_MESSAGE(strprintf("%s: %d blocks/s verified, %d blocks/s trusted", algoNames[algo],
+                                     nBlocks * nReads * 1000000LL / std::max(nVerified, (int64_t)1),
+                                     nBlocks * nReads * 1000000LL / std::max(nTrusted, (int64_t)1)));
+
+        // an entry that has not been validated yet is always rechecked
+        vIndex[0].nStatus = BLOCK_VALID_TREE | BLOCK_HAVE_DATA;
+        BOOST_CHECK(!vIndex[0].IsProofOfWorkChecked());
+        BOOST_CHECK(ReadBlockFromDisk(block, &vIndex[0]));
+        BOOST_CHECK(block.GetHash() == vHash[0]);
+    }
+    SelectParams(CChainParams::MAIN);
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_read_test)
+{
+    SelectParams(CChainParams::REGTEST);
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = 1405274400;
+    block.nBits = Params().ProofOfWorkLimit().GetCompact();
+    block.vtx.push_back(CTransaction());
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CDiskBlockPos pos = WriteTestBlock(block, 2);
+    uint256 hash = block.GetHash();
+    CBlockIndex index;
+    index.phashBlock = &hash;
+    index.nFile = pos.nFile;
+    index.nDataPos = pos.nPos;
+
+    // the bytes on disk are exactly what "block" would serialize to the network
+    std::vector<unsigned char> vchBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, &index));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(std::vector<unsigned char>(ss.begin(), ss.end()) == vchBlock);
+
+    // a position that does not start a block is rejected
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, CDiskBlockPos(pos.nFile, pos.nPos + 1)));
+    uint256 hashOther = GetRandHash();
+    index.phashBlock = &hashOther;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, &index));
+    SelectParams(CChainParams::MAIN);
+}
+
+BOOST_AUTO_TEST_CASE(mapped_block_read_test)
+{
+    SelectParams(CChainParams::REGTEST);
+    const int nBlocks = 200, nTxs = 50, nReads = 2000;
+    std::vector<CDiskBlockPos> vPos;
+    std::vector<uint256> vHash;
+    for (int i = 0; i < nBlocks; i++) {
+        CBlock block;
+        block.nVersion = 4;
+        block.hashPrevBlock = GetRandHash();
+        block.nTime = 1405274400 + i;
+        block.nBits = Params().ProofOfWorkLimit().GetCompact();
+        for (int j = 0; j < nTxs; j++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(GetRandHash(), j);
+            tx.vout.resize(2);
+            tx.vout[0].nValue = j;
+            tx.vout[1].nValue = i;
+            block.vtx.push_back(tx);
+        }
+        block.hashMerkleRoot = block.BuildMerkleTree();
+        vPos.push_back(WriteTestBlock(block, 3));
+        vHash.push_back(block.GetHash());
+    }
+    std::vector<int> vRandom(nReads);
+    for (int n = 0; n < nReads; n++)
+        vRandom[n] = GetRand(nBlocks);
+
+    // sequential rescan and random fetches, through stdio and through the mapping,
+    // which must give the same blocks down to the byte
+    std::vector<std::string> vSerialized(nBlocks);
+    for (int nMapped = 0; nMapped < 2; nMapped++) {
+        fMapBlockFiles = nMapped;
+        CBlock block;
+        int64_t nStart = GetTimeMicros();
+        for (int i = 0; i < nBlocks; i++) {
+            BOOST_CHECK(ReadBlockFromDisk(block, vPos[i], false));
+            BOOST_CHECK(block.GetHash() == vHash[i]);
+            CDataStream ss(SER_DISK, CLIENT_VERSION);
+            ss << block;
+            if (nMapped)
+                BOOST_CHECK(ss.str() == vSerialized[i]);
+            else
+                vSerialized[i] = ss.str();
+        }
+        int64_t nSequential = GetTimeMicros() - nStart;
+        nStart = GetTimeMicros();
+        for (int n = 0; n < nReads; n++) {
+            BOOST_CHECK(ReadBlockFromDisk(block, vPos[vRandom[n]], false));
+            BOOST_CHECK(block.GetHash() == vHash[vRandom[n]]);
+        }
+        int64_t nRandom = GetTimeMicros() - nStart;
+        BOOST_TEST_MESSAGE(strprintf("%s: %d blocks/s sequential, %d blocks/s random", nMapped ? "mmap" : "stdio",
+                                     nBlocks * 1000000LL / std::max(nSequential, (int64_t)1),
+                                     nReads * 1000000LL / std::max(nRandom, (int64_t)1)));
+    }
+
+    // the mapped reads all came from one cached mapping holding the written blocks
+    boost::shared_ptr<CMappedBlockFile> pmap = MapBlockFile(vPos[0], "blk");
+    BOOST_CHECK(pmap);
+    BOOST_CHECK(pmap == MapBlockFile(vPos[nBlocks - 1], "blk"));
+    for (int i = 0; pmap && i < nBlocks; i++) {
+        BOOST_CHECK(vPos[i].nPos + vSerialized[i].size() <= pmap->nSize);
+        BOOST_CHECK(memcmp(pmap->pbegin + vPos[i].nPos, vSerialized[i].data(), vSerialized[i].size()) == 0);
+    }
+    pmap.reset();
+
+    // undo data reads from the mapping as well
+    CBlockUndo undo, undoRead;
+    undo.vtxundo.resize(1);
+    undo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(5, CScript()), true, 7, 2));
+    CDiskBlockPos posUndo(3, 0);
+    BOOST_CHECK(undo.WriteToDisk(posUndo, vHash[0]));
+    BOOST_CHECK(MapBlockFile(posUndo, "rev"));
+    BOOST_CHECK(undoRead.ReadFromDisk(posUndo, vHash[0]));
+    BOOST_CHECK(undoRead.vtxundo.size() == 1 && undoRead.vtxundo[0].vprevout[0].nHeight == 7);
+    BOOST_CHECK(SerializeHash(undoRead) == SerializeHash(undo));
+    BOOST_CHECK(!undoRead.ReadFromDisk(posUndo, vHash[1]));
+
+    // a record appended across the end of the mapped rev file is still read
+    CDiskBlockPos posGrow(3, boost::filesystem::file_size(GetDataDir() / "blocks" / "rev00003.dat") - MESSAGE_START_SIZE - sizeof(unsigned int) - 1);
+    undo.vtxundo.resize(20, undo.vtxundo[0]);
+    BOOST_CHECK(undo.WriteToDisk(posGrow, vHash[1]));
+    BOOST_CHECK(undoRead.ReadFromDisk(posGrow, vHash[1]));
+    BOOST_CHECK(undoRead.vtxundo.size() == 20);
+    BOOST_CHECK(SerializeHash(undoRead) == SerializeHash(undo));
+    BOOST_CHECK(undoRead.ReadFromDisk(posGrow, vHash[1])); // remapped
+    BOOST_CHECK(SerializeHash(undoRead) == SerializeHash(undo));
+    pmap = MapBlockFile(posGrow, "rev");
+    BOOST_CHECK(pmap && pmap->nSize == boost::filesystem::file_size(GetDataDir() / "blocks" / "rev00003.dat"));
+    pmap.reset();
+
+    // positions past the end of a file fall back to stdio and fail there
+    BOOST_CHECK(!MapBlockFile(CDiskBlockPos(3, 0x7fffffff), "blk"));
+    BOOST_CHECK(!MapBlockFile(CDiskBlockPos(0, 0), "blk")); // being appended
+    fMapBlockFiles = false;
+    BOOST_CHECK(!MapBlockFile(vPos[0], "blk"));
+    fMapBlockFiles = true;
+    ClearBlockFileMaps();
+    SelectParams(CChainParams::MAIN);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
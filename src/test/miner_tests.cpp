@@ -57,7 +57,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
   
     CScript scriptPubKey = CScript() << ParseHex("04678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5f") << OP_CHECKSIG;
     CBlockTemplate *pblocktemplate;
-    CTransaction tx,tx2;
+    CMutableTransaction tx,tx2;
     CScript script;
     uint256 hash;
 
@@ -77,13 +77,15 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
       if (i==0) pblock->hashPrevBlock = uint256("0x168329a349fc93768bfb02e536bbe1e1847d77a65764564552122fa9268d8841");
       pblock->nVersion = 1;
       pblock->nTime = chainActive.Tip()->GetMedianTimePast()+1;
-      pblock->vtx[0].vin[0].scriptSig = CScript();
-      pblock->vtx[0].vout[0].scriptPubKey = CScript();
+      CMutableTransaction txCoinbase(pblock->vtx[0]);
+      txCoinbase.vin[0].scriptSig = CScript();
+      txCoinbase.vout[0].scriptPubKey = CScript();
       uint256 best_hash = 0;
       while (1) {
 	pblock->nNonce = curNonce;
-	pblock->vtx[0].vin[0].scriptSig.push_back(curExtraNonce);
-	pblock->vtx[0].vin[0].scriptSig.push_back(chainActive.Height());
+	txCoinbase.vin[0].scriptSig.push_back(curExtraNonce);
+	txCoinbase.vin[0].scriptSig.push_back(chainActive.Height());
+	pblock->vtx[0] = CTransaction(txCoinbase);
 	if (txFirst.size() < 2)
 	  txFirst.push_back(new CTransaction(pblock->vtx[0]));
 	pblock->hashMerkleRoot = pblock->BuildMerkleTree();
@@ -292,6 +294,302 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
 }
 
+BOOST_AUTO_TEST_CASE(algo_template_copy_test)
+{
+    SelectParams(CChainParams::REGTEST);
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    LOCK(cs_main);
+    CBlockTemplate *pbase = CreateNewBlock(scriptPubKey, ALGO_SCRYPT);
+    BOOST_CHECK(pbase);
+    BOOST_CHECK(pbase->block.hashMerkleRoot == pbase->block.BuildMerkleTree());
+
+    for (int algo = 0; algo < NUM_ALGOS; algo++) {
+        CBlockTemplate *pblocktemplate = CopyBlockTemplateForAlgo(*pbase, chainActive.Tip(), algo);
+        const CBlock& block = pblocktemplate->block;
+        BOOST_CHECK_EQUAL(block.vtx.size(), pbase->block.vtx.size());
+        for (unsigned int i = 1; i < block.vtx.size(); i++)
+            BOOST_CHECK(block.vtx[i].GetHash() == pbase->block.vtx[i].GetHash());
+        BOOST_CHECK(block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK(block.nBits == GetNextWorkRequired(chainActive.Tip(), algo));
+        BOOST_CHECK(block.hashMerkleRoot == block.BuildMerkleTree());
+
+        // the shared branch keeps the root right as the coinbase changes
+        unsigned int nExtraNonce = 0;
+        IncrementExtraNonce(pblocktemplate, chainActive.Tip(), nExtraNonce);
+        BOOST_CHECK(block.hashMerkleRoot == block.BuildMerkleTree());
+        delete pblocktemplate;
+    }
+    delete pbase;
+    SelectParams(CChainParams::MAIN);
+}
+
+BOOST_AUTO_TEST_CASE(CreateNewBlock_latency)
+{
+    SelectParams(CChainParams::REGTEST);
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    LOCK(cs_main);
+
+    // Coinbases in the test chain are far from mature, so fund the pool from
+    // a made-up transaction put straight into the coins
+    const unsigned int nMaxTx = 4000;
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(uint256(1), 0);
+    txFund.vout.resize(nMaxTx / 2);
+    for (unsigned int i = 0; i < txFund.vout.size(); i++)
+    {
+        txFund.vout[i].nValue = COIN;
+        txFund.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    uint256 hashFund = txFund.GetHash();
+    pcoinsTip->SetCoins(hashFund, CCoins(txFund, chainActive.Height()));
+
+    // Each funding output is spent by a transaction paying a varying fee,
+    // which is spent again by a lower paying child
+    std::vector<CTransaction> vtx;
+    std::vector<int64_t> vFee;
+    for (unsigned int i = 0; i < txFund.vout.size(); i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(hashFund, i);
+        tx.vout.resize(1);
+        int64_t nFee = 20000 + 1000 * (i % 37);
+        tx.vout[0].nValue = COIN - nFee;
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        vtx.push_back(tx);
+        vFee.push_back(nFee);
+
+        CMutableTransaction txChild;
+        txChild.vin.resize(1);
+        txChild.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+        txChild.vout.resize(1);
+        txChild.vout[0].nValue = tx.vout[0].nValue - 10000;
+        txChild.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        vtx.push_back(txChild);
+        vFee.push_back(10000);
+    }
+
+    std::map<uint256, int64_t> mapFee;
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        mapFee[vtx[i].GetHash()] = vFee[i];
+
+    const bool fMinSizeSet = mapArgs.count("-blockminsize");
+    const std::string strMinSize = fMinSizeSet ? mapArgs["-blockminsize"] : "";
+
+    unsigned int nAdded = 0;
+    const unsigned int nSizes[] = {500, 1000, 2000, 4000};
+    for (unsigned int s = 0; s < sizeof(nSizes)/sizeof(*nSizes); s++)
+    {
+        // Leave a few transactions to patch the template with
+        for (; nAdded < nSizes[s] - 10; nAdded++)
+            mempool.addUnchecked(vtx[nAdded].GetHash(), CTxMemPoolEntry(vtx[nAdded], vFee[nAdded], GetTime(), 0.0, chainActive.Height(), GetLegacySigOpCount(vtx[nAdded])));
+
+        // A different -blockminsize makes the next template start from scratch
+        mapArgs["-blockminsize"] = strprintf("%u", s);
+        int64_t nStart = GetTimeMicros();
+        CBlockTemplate *pblocktemplate = CreateNewBlock(scriptPubKey);
+        int64_t nFull = GetTimeMicros() - nStart;
+        BOOST_CHECK(pblocktemplate);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), nAdded + 1);
+        BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == mempool.setTxByFee.rbegin()->second);
+
+        // Every pool transaction is in, once, with its fee. Children pay less
+        // than any parent, so the whole block runs down the fee index.
+        std::vector<uint256> vHashFull;
+        std::set<uint256> setFull;
+        int64_t nFees = 0;
+        for (unsigned int i = 1; i < pblocktemplate->block.vtx.size(); i++)
+        {
+            uint256 hash = pblocktemplate->block.vtx[i].GetHash();
+            BOOST_CHECK(mempool.mapTx.count(hash));
+            BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[i], mapFee[hash]);
+            if (i > 1)
+                BOOST_CHECK(mempool.mapTx[vHashFull.back()].GetFeePerKb() >= mempool.mapTx[hash].GetFeePerKb());
+            vHashFull.push_back(hash);
+            setFull.insert(hash);
+            nFees += mapFee[hash];
+        }
+        BOOST_CHECK_EQUAL(setFull.size(), nAdded);
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -nFees);
+        delete pblocktemplate;
+
+        for (; nAdded < nSizes[s]; nAdded++)
+            mempool.addUnchecked(vtx[nAdded].GetHash(), CTxMemPoolEntry(vtx[nAdded], vFee[nAdded], GetTime(), 0.0, chainActive.Height(), GetLegacySigOpCount(vtx[nAdded])));
+
+        nStart = GetTimeMicros();
+        pblocktemplate = CreateNewBlock(scriptPubKey);
+        int64_t nPatched = GetTimeMicros() - nStart;
+        BOOST_CHECK(pblocktemplate);
+        const std::vector<CTransaction>& vtxBlock = pblocktemplate->block.vtx;
+        BOOST_CHECK_EQUAL(vtxBlock.size(), nAdded + 1);
+
+        // The previous selection is kept in its order, the new transactions
+        // follow it, and parents always come before their children
+        std::set<uint256> setSeen;
+        nFees = 0;
+        for (unsigned int i = 1; i < vtxBlock.size(); i++)
+        {
+            uint256 hash = vtxBlock[i].GetHash();
+            if (i <= vHashFull.size())
+                BOOST_CHECK(hash == vHashFull[i - 1]);
+            else
+                BOOST_CHECK(mempool.mapTx.count(hash) && !setFull.count(hash));
+            BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[i], mapFee[hash]);
+            nFees += mapFee[hash];
+            BOOST_FOREACH(const CTxIn& txin, vtxBlock[i].vin)
+                BOOST_CHECK(txin.prevout.hash == hashFund || setSeen.count(txin.prevout.hash));
+            setSeen.insert(hash);
+        }
+        BOOST_CHECK_EQUAL(setSeen.size(), nAdded);
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -nFees);
+        delete pblocktemplate;
+
+        BOOST_TEST_MESSAGE(strprintf("CreateNewBlock with %u pool transactions: %d us from scratch, %d us patching in 10 more",
+                                     nAdded, nFull, nPatched));
+    }
+
+    if (fMinSizeSet)
+        mapArgs["-blockminsize"] = strMinSize;
+    else
+        mapArgs.erase("-blockminsize");
+    mempool.clear();
+    pcoinsTip->SetCoins(hashFund, CCoins());
+    SelectParams(CChainParams::MAIN);
+}
+
+BOOST_AUTO_TEST_CASE(ConnectBlock_full_block)
+{
+    SelectParams(CChainParams::REGTEST);
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    LOCK(cs_main);
+
+    // Fill the pool with single input transactions until a template is
+    // close to the default maximum block size
+    const unsigned int nTx = 12000;
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(uint256(2), 0);
+    txFund.vout.resize(nTx);
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        txFund.vout[i].nValue = COIN;
+        txFund.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    uint256 hashFund = txFund.GetHash();
+    pcoinsTip->SetCoins(hashFund, CCoins(txFund, chainActive.Height()));
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(hashFund, i);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN - 10000 - i;
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        CTransaction txConst(tx);
+        mempool.addUnchecked(txConst.GetHash(), CTxMemPoolEntry(txConst, 10000 + i, GetTime(), 0.0, chainActive.Height(), GetLegacySigOpCount(txConst)));
+    }
+
+    CBlockTemplate *pblocktemplate = CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(pblocktemplate);
+    CBlock& block = pblocktemplate->block;
+    unsigned int nBlockSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(nBlockSize > DEFAULT_BLOCK_MAX_SIZE * 9 / 10);
+
+    // The header hash follows the header fields
+    uint256 hashBlock = block.GetHash();
+    block.nNonce++;
+    BOOST_CHECK(block.GetHash() != hashBlock);
+    block.nNonce--;
+    BOOST_CHECK(block.GetHash() == hashBlock);
+
+    CBlockIndex indexDummy(block);
+    indexDummy.pprev = chainActive.Tip();
+    indexDummy.nHeight = chainActive.Height() + 1;
+    indexDummy.BuildForkState();
+    indexDummy.BuildAlgoSkip();
+
+    const int nRounds = 5;
+    int64_t nStart = GetTimeMicros();
+    for (int n = 0; n < nRounds; n++)
+    {
+        CCoinsViewCache view(*pcoinsTip, true);
+        CValidationState state;
+        BOOST_CHECK(ConnectBlock(block, state, &indexDummy, view, true));
+    }
+    int64_t nElapsed = GetTimeMicros() - nStart;
+    BOOST_TEST_MESSAGE(strprintf("ConnectBlock of %u transactions (%u bytes): %d us per block",
+                                 block.vtx.size(), nBlockSize, nElapsed / nRounds));
+
+    delete pblocktemplate;
+    mempool.clear();
+    pcoinsTip->SetCoins(hashFund, CCoins());
+    SelectParams(CChainParams::MAIN);
+}
+
+static void NotifyNewTransaction()
+{
+    MilliSleep(100);
+    LOCK(cs_main);
+    mempool.AddTransactionsUpdated(1);
+    NotifyNewWork();
+}
+
+BOOST_AUTO_TEST_CASE(new_work_wait_test)
+{
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    // Nothing new: gives up at the deadline
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    BOOST_CHECK(!WaitForNewWork(hashTip, nTransactionsUpdated, GetTime(), GetTime()));
+
+    // Pool changes only count once it is past the transaction time
+    mempool.AddTransactionsUpdated(1);
+    BOOST_CHECK(!WaitForNewWork(hashTip, nTransactionsUpdated, GetTime() + 60, GetTime()));
+    BOOST_CHECK(WaitForNewWork(hashTip, nTransactionsUpdated, GetTime(), GetTime() + 60));
+
+    // A notification ends the wait well before the deadline
+    nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    int64_t nStart = GetTime();
+    boost::thread notifier(&NotifyNewTransaction);
+    BOOST_CHECK(WaitForNewWork(hashTip, nTransactionsUpdated, nStart, nStart + 60));
+    notifier.join();
+    BOOST_CHECK(GetTime() - nStart < 30);
+}
+
+BOOST_AUTO_TEST_CASE(miner_hasher_equality)
+{
+    CBlockHeader header;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1500000000;
+    header.nBits = 0x1d00ffff;
+
+    int algos[] = {ALGO_SHA256D, ALGO_SCRYPT};
+    for (unsigned int i = 0; i < sizeof(algos)/sizeof(algos[0]); i++) {
+        header.nVersion = CBlockHeader::CURRENT_VERSION;
+        header.SetAlgo(algos[i]);
+        header.nNonce = 0;
+
+        CMinerHasher hasher;
+        hasher.SetHeader(header, algos[i]);
+        for (int n = 0; n < 8; n++) {
+            BOOST_CHECK(hasher.GetPoWHash(header) == header.GetPoWHash(algos[i]));
+            header.nNonce += 0x01010101;
+            // nTime is hashed per nonce, after the midstate
+            header.nTime++;
+        }
+
+        header.hashMerkleRoot = GetRandHash();
+        hasher.SetHeader(header, algos[i]);
+        BOOST_CHECK(hasher.GetPoWHash(header) == header.GetPoWHash(algos[i]));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha256transform_equality)
 {
     unsigned int pSHA256InitState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
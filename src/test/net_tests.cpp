@@ -0,0 +1,87 @@
+// Copyright (c) 2014 Project Bitmark
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+BOOST_AUTO_TEST_CASE(send_buffer_pool)
+{
+    CSendBufferPool pool;
+
+    CSerializeData a;
+    pool.Acquire(100, a);
+    BOOST_CHECK(a.empty());
+    BOOST_CHECK(a.capacity() >= 512);
+    a.resize(100);
+    const char* pa = &a[0];
+    size_t nCapacity = a.capacity();
+
+    pool.Release(a);
+    BOOST_CHECK(a.empty());
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), nCapacity);
+
+    // A request of the same size class gets the same storage back
+    CSerializeData b;
+    pool.Acquire(300, b);
+    BOOST_CHECK(b.empty());
+    BOOST_CHECK_EQUAL(b.capacity(), nCapacity);
+    b.resize(300);
+    BOOST_CHECK(&b[0] == pa);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0U);
+
+    // A larger request does not take a buffer that is too small
+    pool.Release(b);
+    CSerializeData c;
+    pool.Acquire(nCapacity + 1, c);
+    BOOST_CHECK(c.capacity() > nCapacity);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), nCapacity);
+
+    // Buffers too large to pool are simply freed
+    CSerializeData d;
+    pool.Acquire(((size_t)1 << CSendBufferPool::MAX_CLASS) + 1, d);
+    pool.Release(d);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), nCapacity);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(send_coalesces_queued_messages)
+{
+    int sv[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+    // Inbound, so the node does not queue a version message of its own
+    CNode node(sv[0], CAddress(CService("127.0.0.1", 0)), "test", true);
+    string strExpected;
+    {
+        LOCK(node.cs_vSend);
+        for (int i = 0; i < 10; i++) {
+            string str = strprintf("message %d", i);
+            node.vSendMsg.push_back(CSerializeData(str.begin(), str.end()));
+            node.nSendSize += str.size();
+            strExpected += str;
+        }
+        SocketSendData(&node);
+        BOOST_CHECK(node.vSendMsg.empty());
+        BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+    }
+    BOOST_CHECK_EQUAL(node.nSendSyscalls, 1U);
+    BOOST_CHECK_EQUAL(node.nSendMessages, 10U);
+    BOOST_CHECK_EQUAL(node.nSendBytes, strExpected.size());
+
+    char buf[256];
+    ssize_t nRead = recv(sv[1], buf, sizeof(buf), 0);
+    BOOST_CHECK_EQUAL(string(buf, nRead > 0 ? nRead : 0), strExpected);
+
+    close(sv[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,7 +7,10 @@
 
 
 
+#include "argon2.h"
 #include "main.h"
+#include "scrypt.h"
+#include "sha256.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -33,6 +36,9 @@ struct TestingSetup {
     TestingSetup() {
         fPrintToDebugLog = false; // don't want to write to debug.log file
         noui_connect();
+        SHA256AutoDetect();
+        scrypt_detect();
+        argon2_select_impl(1);
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
 #endif
@@ -51,8 +57,10 @@ struct TestingSetup {
         RegisterWallet(pwalletMain);
 #endif
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadPoWCheck);
+        }
         RegisterNodeSignals(GetNodeSignals());
     }
     ~TestingSetup()
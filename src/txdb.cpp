@@ -72,9 +72,29 @@ CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevel
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
 {
+    // the auxpow is paged out of memory, an entry that could not read it back cannot be rewritten
+    if (blockindex.IsAuxpow() && !blockindex.pauxpow)
+        return error("WriteBlockIndex() : auxpow of block %s not available", blockindex.GetBlockHash().ToString());
     return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
 }
 
+bool CBlockTreeDB::ReadBlockIndex(const uint256 &hash, CDiskBlockIndex& blockindex)
+{
+    return Read(make_pair('b', hash), blockindex);
+}
+
+// Kept apart from the 'b' records, which older clients rewrite without fields they do not know.
+// The factor of a block only depends on the chain below it, so it stays valid for its hash.
+bool CBlockTreeDB::WriteSubsidyScalingFactor(const uint256 &hash, const CBigNum &scalingFactor)
+{
+    return Write(make_pair('s', hash), scalingFactor);
+}
+
+bool CBlockTreeDB::ReadSubsidyScalingFactor(const uint256 &hash, CBigNum &scalingFactor)
+{
+    return Read(make_pair('s', hash), scalingFactor);
+}
+
 bool CBlockTreeDB::WriteBestInvalidWork(const CBigNum& bnBestInvalidWork)
 {
     // Obsolete; only written for backward compatibility.
@@ -208,7 +228,6 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 // Construct block index object
                 CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
                 pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-		pindexNew->pauxpow        = diskindex.pauxpow;
                 pindexNew->nHeight        = diskindex.nHeight;
                 pindexNew->nMoneySupply   = diskindex.nMoneySupply;
                 pindexNew->nFile          = diskindex.nFile;
@@ -219,7 +238,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nTime          = diskindex.nTime;
                 pindexNew->nBits          = diskindex.nBits;
                 pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
+                pindexNew->nStatus        = diskindex.nStatus & ~BLOCK_HAVE_SSF;
                 pindexNew->nTx            = diskindex.nTx;
 
                 if (!pindexNew->CheckIndex())
@@ -233,6 +252,34 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+
+    // Load the stored subsidy scaling factors
+    ssKeySet.clear();
+    ssKeySet << make_pair('s', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 's')
+                break;
+            uint256 hash;
+            ssKey >> hash;
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
+            if (mi != mapBlockIndex.end()) {
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+                ssValue >> mi->second->subsidyScalingFactor;
+                mi->second->nStatus |= BLOCK_HAVE_SSF;
+            }
+            pcursor->Next();
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
     delete pcursor;
 
     return true;
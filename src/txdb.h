@@ -53,6 +53,9 @@ private:
     void operator=(const CBlockTreeDB&);
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool ReadBlockIndex(const uint256 &hash, CDiskBlockIndex& blockindex);
+    bool WriteSubsidyScalingFactor(const uint256 &hash, const CBigNum &scalingFactor);
+    bool ReadSubsidyScalingFactor(const uint256 &hash, CBigNum &scalingFactor);
     bool WriteBestInvalidWork(const CBigNum& bnBestInvalidWork);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo &fileinfo);
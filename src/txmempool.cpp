@@ -12,12 +12,15 @@ using namespace std;
 CTxMemPoolEntry::CTxMemPoolEntry()
 {
     nHeight = MEMPOOL_HEIGHT;
+    nSigOps = 0;
+    nSequence = 0;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, int64_t _nFee,
                                  int64_t _nTime, double _dPriority,
-                                 unsigned int _nHeight):
-    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+                                 unsigned int _nHeight, unsigned int _nSigOps):
+    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
+    nSigOps(_nSigOps), nSequence(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 }
@@ -36,12 +39,22 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+double
+CTxMemPoolEntry::GetFeePerKb() const
+{
+    // Exact size rather than the rounded-up kilobytes of GetMinFee, which
+    // rewards smaller transactions
+    return double(nFee) / (double(nTxSize)/1000.0);
+}
+
 CTxMemPool::CTxMemPool()
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
     // of transactions in the pool
     fSanityCheck = false;
+    nTransactionsUpdated = 0;
+    nSequence = 0;
 }
 
 void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
@@ -69,6 +82,12 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+uint64_t CTxMemPool::GetSequence() const
+{
+    LOCK(cs);
+    return nSequence;
+}
+
 
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
 {
@@ -77,8 +96,14 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
     // all the appropriate checks.
     LOCK(cs);
     {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+        if (it != mapTx.end())
+            setTxByFee.erase(make_pair(it->second.GetFeePerKb(), hash));
+        CTxMemPoolEntry& newentry = mapTx[hash];
+        newentry = entry;
+        newentry.nSequence = ++nSequence;
+        setTxByFee.insert(make_pair(newentry.GetFeePerKb(), hash));
+        const CTransaction& tx = newentry.GetTx();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
         nTransactionsUpdated++;
@@ -101,12 +126,14 @@ void CTxMemPool::remove(const CTransaction &tx, std::list<CTransaction>& removed
                 remove(*it->second.ptx, removed, true);
             }
         }
-        if (mapTx.count(hash))
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+        if (it != mapTx.end())
         {
             removed.push_front(tx);
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
-            mapTx.erase(hash);
+            setTxByFee.erase(make_pair(it->second.GetFeePerKb(), hash));
+            mapTx.erase(it);
             nTransactionsUpdated++;
         }
     }
@@ -134,6 +161,7 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    setTxByFee.clear();
     ++nTransactionsUpdated;
 }
 
@@ -145,9 +173,11 @@ void CTxMemPool::check(CCoinsViewCache *pcoins) const
     LogPrint("mempool", "Checking mempool with %u transactions and %u inputs\n", (unsigned int)mapTx.size(), (unsigned int)mapNextTx.size());
 
     LOCK(cs);
+    assert(setTxByFee.size() == mapTx.size());
     for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
         const CTransaction& tx = it->second.GetTx();
+        assert(setTxByFee.count(make_pair(it->second.GetFeePerKb(), it->first)));
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
             std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
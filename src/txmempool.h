@@ -7,6 +7,7 @@
 #define BITMARK_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "coins.h"
 #include "core.h"
@@ -27,10 +28,15 @@ private:
     int64_t nTime; // Local time when entering the mempool
     double dPriority; // Priority when entering the mempool
     unsigned int nHeight; // Chain height when entering the mempool
+    unsigned int nSigOps; // Legacy and P2SH sigops, counted when the inputs were at hand
+    uint64_t nSequence; // Order of entry into the mempool, set by CTxMemPool
+
+    friend class CTxMemPool;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, int64_t _nFee,
-                    int64_t _nTime, double _dPriority, unsigned int _nHeight);
+                    int64_t _nTime, double _dPriority, unsigned int _nHeight,
+                    unsigned int _nSigOps = 0);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
@@ -40,6 +46,9 @@ public:
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    unsigned int GetSigOps() const { return nSigOps; }
+    uint64_t GetSequence() const { return nSequence; }
+    double GetFeePerKb() const;
 };
 
 /*
@@ -57,11 +66,15 @@ class CTxMemPool
 private:
     bool fSanityCheck; // Normally false, true if -checkmempool or -regtest
     unsigned int nTransactionsUpdated;
+    uint64_t nSequence; // Sequence of the last entry added
 
 public:
+    typedef std::set<std::pair<double, uint256> > FeeIndex;
+
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
+    FeeIndex setTxByFee; // (fee per kB, txid) of every entry in mapTx, for block assembly
 
     CTxMemPool();
 
@@ -82,6 +95,7 @@ public:
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
+    uint64_t GetSequence() const;
 
     unsigned long size()
     {
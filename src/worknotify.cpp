@@ -0,0 +1,155 @@
+// Copyright (c) 2014 Project Bitmark
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "worknotify.h"
+
+#include "main.h"
+#include "miner.h"
+#include "ui_interface.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+#if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef WIN32
+static void GetWorkState(uint256& hashTip, int& nHeight, unsigned int& nTransactionsUpdated)
+{
+    LOCK(cs_main);
+    hashTip = chainActive.Tip()->GetBlockHash();
+    nHeight = chainActive.Height();
+    nTransactionsUpdated = mempool.GetTransactionsUpdated();
+}
+
+// Send an event to every client. Clients that can't take it right away are
+// dropped rather than holding up the others.
+static void SendWorkEvent(vector<SOCKET>& vClients, const string& strEvent)
+{
+    vector<SOCKET>::iterator it = vClients.begin();
+    while (it != vClients.end())
+    {
+        int nBytes = send(*it, strEvent.data(), strEvent.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (nBytes != (int)strEvent.size())
+        {
+            LogPrint("worknotify", "worknotify: dropping client\n");
+            closesocket(*it);
+            it = vClients.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+static void ThreadWorkNotify(SOCKET hListenSocket, boost::filesystem::path path)
+{
+    RenameThread("bitmark-worknotify");
+    vector<SOCKET> vClients;
+
+    try
+    {
+        uint256 hashTip;
+        int nHeight;
+        unsigned int nTransactionsUpdated;
+        GetWorkState(hashTip, nHeight, nTransactionsUpdated);
+        int64_t nTxTime = GetTime() + NEW_WORK_TX_DELAY;
+
+        while (true)
+        {
+            // Wake up every second to pick up new clients
+            bool fNewWork = WaitForNewWork(hashTip, nTransactionsUpdated, nTxTime, GetTime() + 1);
+            boost::this_thread::interruption_point();
+
+            SOCKET hSocket;
+            while ((hSocket = accept(hListenSocket, NULL, NULL)) != INVALID_SOCKET)
+            {
+                fcntl(hSocket, F_SETFL, O_NONBLOCK);
+                vector<SOCKET> vNew(1, hSocket);
+                SendWorkEvent(vNew, strprintf("tip %s %d\n", hashTip.GetHex(), nHeight));
+                vClients.insert(vClients.end(), vNew.begin(), vNew.end());
+            }
+
+            if (!fNewWork)
+                continue;
+
+            uint256 hashPrevTip = hashTip;
+            GetWorkState(hashTip, nHeight, nTransactionsUpdated);
+            nTxTime = GetTime() + NEW_WORK_TX_DELAY;
+            if (hashTip != hashPrevTip)
+                SendWorkEvent(vClients, strprintf("tip %s %d\n", hashTip.GetHex(), nHeight));
+            else
+                SendWorkEvent(vClients, strprintf("template %s%u\n", hashTip.GetHex(), nTransactionsUpdated));
+        }
+    }
+    catch (boost::thread_interrupted)
+    {
+        BOOST_FOREACH(SOCKET& hSocket, vClients)
+            closesocket(hSocket);
+        closesocket(hListenSocket);
+        unlink(path.string().c_str());
+        throw;
+    }
+}
+#endif
+
+bool StartWorkNotify(boost::thread_group& threadGroup, std::string& strError)
+{
+    if (!mapArgs.count("-worknotifysocket"))
+        return true;
+
+#ifdef WIN32
+    LogPrintf("StartWorkNotify() : -worknotifysocket is not supported on Windows\n");
+    return true;
+#else
+    boost::filesystem::path path(GetArg("-worknotifysocket", ""));
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.string().size() >= sizeof(addr.sun_path))
+    {
+        strError = strprintf(_("Path for -worknotifysocket is too long: %s"), path.string());
+        return false;
+    }
+    strncpy(addr.sun_path, path.string().c_str(), sizeof(addr.sun_path) - 1);
+
+    // A socket left behind by an earlier run would stop the bind
+    struct stat st;
+    if (stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(addr.sun_path);
+
+    SOCKET hListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (hListenSocket == INVALID_SOCKET)
+    {
+        strError = strprintf(_("Unable to create socket for -worknotifysocket (error %d)"), errno);
+        return false;
+    }
+    if (::bind(hListenSocket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(hListenSocket, SOMAXCONN) == SOCKET_ERROR ||
+        fcntl(hListenSocket, F_SETFL, O_NONBLOCK) == SOCKET_ERROR)
+    {
+        int nErr = errno;
+        closesocket(hListenSocket);
+        strError = strprintf(_("Unable to listen on %s for -worknotifysocket (error %d)"), path.string(), nErr);
+        return false;
+    }
+
+    LogPrintf("Announcing new work on %s\n", path.string());
+    threadGroup.create_thread(boost::bind(&ThreadWorkNotify, hListenSocket, path));
+    return true;
+#endif
+}
@@ -0,0 +1,25 @@
+// Copyright (c) 2014 Project Bitmark
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITMARK_WORKNOTIFY_H
+#define BITMARK_WORKNOTIFY_H
+
+#include <string>
+
+namespace boost {
+    class thread_group;
+} // namespace boost
+
+/** Announce new work on the Unix domain socket named by -worknotifysocket, if any.
+ *  Every connected client is sent one line per event:
+ *    tip <blockhash> <height>      the best block changed
+ *    template <id>                 the memory pool changed enough for a new block template;
+ *                                  the id is the tip hash followed by the memory pool update
+ *                                  counter, laid out like a longpollid. It is not the id of any
+ *                                  template: getblocktemplate and getauxblock return the counter
+ *                                  their cached template was built at, which may be older
+ *  Returns false with strError set if the socket could not be set up. */
+bool StartWorkNotify(boost::thread_group& threadGroup, std::string& strError);
+
+#endif // BITMARK_WORKNOTIFY_H